@@ -23,6 +23,8 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <dirent.h>
+#include <time.h>
 
 #include <linux/genetlink.h>
 #include <linux/taskstats.h>
@@ -74,8 +76,9 @@ char cpumask[100+6*MAX_CPUS];
 
 static void usage(void)
 {
-	fprintf(stderr, "getdelays [-dilv] [-w logfile] [-r bufsize] "
+	fprintf(stderr, "getdelays [-adilv] [-w logfile] [-r bufsize] "
 			"[-m cpumask] [-t tgid] [-p pid]\n");
+	fprintf(stderr, "  -a: dump all tasks, compare cost with /proc\n");
 	fprintf(stderr, "  -d: print delayacct stats\n");
 	fprintf(stderr, "  -i: print IO accounting (works only with -p)\n");
 	fprintf(stderr, "  -l: listen forever\n");
@@ -254,6 +257,135 @@ static void print_ioacct(struct taskstats *t)
 		(unsigned long long)t->cancelled_write_bytes);
 }
 
+static double now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * Fetch the stats of all tasks with a single NLM_F_DUMP request and
+ * return the number of tasks seen, or -1 on error.
+ */
+static int dump_all_tasks(int sd, __u16 id)
+{
+	static char buf[65536];
+	struct msgtemplate msg;
+	struct sockaddr_nl nladdr;
+	struct nlmsghdr *nlh;
+	int rep_len, count = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.n.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	msg.n.nlmsg_type = id;
+	msg.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	msg.n.nlmsg_pid = getpid();
+	msg.g.cmd = TASKSTATS_CMD_GET;
+	msg.g.version = 0x1;
+
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+	if (sendto(sd, &msg, msg.n.nlmsg_len, 0, (struct sockaddr *) &nladdr,
+		   sizeof(nladdr)) < 0)
+		return -1;
+
+	for (;;) {
+		rep_len = recv(sd, buf, sizeof(buf), 0);
+		if (rep_len < 0)
+			return -1;
+		for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, rep_len);
+		     nlh = NLMSG_NEXT(nlh, rep_len)) {
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return count;
+			if (nlh->nlmsg_type == NLMSG_ERROR)
+				return -1;
+			count++;
+		}
+	}
+}
+
+static int read_proc_file(const char *path)
+{
+	char buf[4096];
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buf, sizeof(buf));
+	close(fd);
+	return ret;
+}
+
+/*
+ * Read stat, status and io of every task the way /proc scrapers do and
+ * return the number of tasks seen.
+ */
+static int scan_proc_tasks(void)
+{
+	char path[1024];
+	struct dirent *pd, *td;
+	DIR *pdir, *tdir;
+	int count = 0;
+
+	pdir = opendir("/proc");
+	if (!pdir)
+		return -1;
+	while ((pd = readdir(pdir)) != NULL) {
+		if (pd->d_name[0] < '0' || pd->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/task", pd->d_name);
+		tdir = opendir(path);
+		if (!tdir)
+			continue;
+		while ((td = readdir(tdir)) != NULL) {
+			if (td->d_name[0] < '0' || td->d_name[0] > '9')
+				continue;
+			snprintf(path, sizeof(path), "/proc/%s/task/%s/stat",
+				 pd->d_name, td->d_name);
+			if (read_proc_file(path) < 0)
+				continue;
+			snprintf(path, sizeof(path), "/proc/%s/task/%s/status",
+				 pd->d_name, td->d_name);
+			read_proc_file(path);
+			snprintf(path, sizeof(path), "/proc/%s/task/%s/io",
+				 pd->d_name, td->d_name);
+			read_proc_file(path);
+			count++;
+		}
+		closedir(tdir);
+	}
+	closedir(pdir);
+	return count;
+}
+
+static void compare_dump_with_proc(int sd, __u16 id)
+{
+	double start, nl_usecs, proc_usecs;
+	int nl_count, proc_count;
+
+	start = now_usecs();
+	nl_count = dump_all_tasks(sd, id);
+	nl_usecs = now_usecs() - start;
+	if (nl_count <= 0) {
+		fprintf(stderr, "taskstats dump failed, errno %d\n", errno);
+		return;
+	}
+
+	start = now_usecs();
+	proc_count = scan_proc_tasks();
+	proc_usecs = now_usecs() - start;
+
+	printf("taskstats dump: %d tasks in %.0f usecs, %.2f usecs/task\n",
+	       nl_count, nl_usecs, nl_usecs / nl_count);
+	if (proc_count > 0)
+		printf("/proc scan:     %d tasks in %.0f usecs, "
+		       "%.2f usecs/task\n", proc_count, proc_usecs,
+		       proc_usecs / proc_count);
+}
+
 int main(int argc, char *argv[])
 {
 	int c, rc, rep_len, aggr_len, len2;
@@ -277,16 +409,20 @@ int main(int argc, char *argv[])
 	char containerpath[1024];
 	int cfd = 0;
 	int forking = 0;
+	int dump_all = 0;
 	sigset_t sigset;
 
 	struct msgtemplate msg;
 
 	while (!forking) {
-		c = getopt(argc, argv, "qdiw:r:m:t:p:vlC:c:");
+		c = getopt(argc, argv, "aqdiw:r:m:t:p:vlC:c:");
 		if (c < 0)
 			break;
 
 		switch (c) {
+		case 'a':
+			dump_all = 1;
+			break;
 		case 'd':
 			printf("print delayacct stats ON\n");
 			print_delays = 1;
@@ -388,6 +524,11 @@ int main(int argc, char *argv[])
 	}
 	PRINTF("family id %d\n", id);
 
+	if (dump_all) {
+		compare_dump_with_proc(nl_sd, id);
+		goto err;
+	}
+
 	if (maskset) {
 		rc = send_cmd(nl_sd, id, mypid, TASKSTATS_CMD_GET,
 			      TASKSTATS_CMD_ATTR_REGISTER_CPUMASK,
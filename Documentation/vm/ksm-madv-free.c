@@ -0,0 +1,158 @@
+/*
+ * Check that KSM merging does not lose data to MADV_FREE.
+ *
+ * Two ranges are filled with the same contents, one page pattern per pair.
+ * The first range is then given up with MADV_FREE, which leaves its pages
+ * clean, while the second one stays dirty.  Once KSM has merged the pairs,
+ * memory pressure pushes the stable pages out, and the second range must
+ * still read back its contents.
+ *
+ * Needs root to drive /sys/kernel/mm/ksm, and swap space, since reclaim only
+ * drops or writes out anonymous pages that got a swap slot.  The amount of
+ * memory to touch for the pressure can be given in MB as the only argument;
+ * it defaults to the size of RAM.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MADV_FREE
+#define MADV_FREE 8
+#endif
+#ifndef MADV_MERGEABLE
+#define MADV_MERGEABLE 12
+#endif
+
+#define NR_PAGES	256
+#define KSM_PATH	"/sys/kernel/mm/ksm/"
+
+static long page_size;
+
+static int ksm_write(const char *name, const char *val)
+{
+	char path[64];
+	FILE *f;
+
+	snprintf(path, sizeof(path), KSM_PATH "%s", name);
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fputs(val, f);
+	return fclose(f);
+}
+
+static long ksm_read(const char *name)
+{
+	char path[64];
+	long val = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), KSM_PATH "%s", name);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%ld", &val) != 1)
+		val = -1;
+	fclose(f);
+	return val;
+}
+
+static long status_kb(const char *file, const char *field)
+{
+	char line[128];
+	long val = -1;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, field, strlen(field))) {
+			val = atol(line + strlen(field));
+			break;
+		}
+	fclose(f);
+	return val;
+}
+
+static void fill(char *addr, int i)
+{
+	memset(addr, 0, page_size);
+	snprintf(addr, page_size, "ksm madv_free test page %d", i);
+}
+
+int main(int argc, char **argv)
+{
+	char *freed, *kept, *pressure, *expect;
+	long len, pressure_mb, i;
+	int failed = 0;
+
+	page_size = sysconf(_SC_PAGESIZE);
+	len = NR_PAGES * page_size;
+	pressure_mb = argc > 1 ? atol(argv[1]) :
+			status_kb("/proc/meminfo", "MemTotal:") / 1024;
+
+	freed = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	kept = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	expect = malloc(page_size);
+	if (freed == MAP_FAILED || kept == MAP_FAILED || !expect) {
+		perror("mmap");
+		return 1;
+	}
+
+	for (i = 0; i < NR_PAGES; i++) {
+		fill(freed + i * page_size, i);
+		fill(kept + i * page_size, i);
+	}
+	if (madvise(freed, len, MADV_FREE)) {
+		perror("madvise(MADV_FREE)");
+		return 1;
+	}
+	if (madvise(freed, len, MADV_MERGEABLE) ||
+	    madvise(kept, len, MADV_MERGEABLE)) {
+		perror("madvise(MADV_MERGEABLE)");
+		return 1;
+	}
+
+	if (ksm_write("sleep_millisecs", "0") ||
+	    ksm_write("pages_to_scan", "10000") || ksm_write("run", "1"))
+		return 1;
+	for (i = 0; i < 300 && ksm_read("pages_sharing") < NR_PAGES; i++)
+		usleep(100000);
+	printf("pages_shared %ld pages_sharing %ld\n",
+	       ksm_read("pages_shared"), ksm_read("pages_sharing"));
+	if (ksm_read("pages_sharing") < NR_PAGES) {
+		printf("SKIP: KSM did not merge the ranges\n");
+		return 0;
+	}
+
+	/* push the stable pages out */
+	pressure = mmap(NULL, pressure_mb << 20, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (pressure == MAP_FAILED) {
+		perror("mmap pressure");
+		return 1;
+	}
+	for (i = 0; i < pressure_mb << 20; i += page_size)
+		pressure[i] = 1;
+	printf("VmSwap %ld kB\n", status_kb("/proc/self/status", "VmSwap:"));
+	munmap(pressure, pressure_mb << 20);
+
+	for (i = 0; i < NR_PAGES; i++) {
+		fill(expect, i);
+		if (memcmp(kept + i * page_size, expect, page_size)) {
+			printf("FAIL: page %ld lost its contents\n", i);
+			failed = 1;
+		}
+	}
+	if (!failed)
+		printf("PASS\n");
+
+	return failed;
+}
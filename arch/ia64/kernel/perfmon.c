@@ -2318,6 +2318,7 @@ pfm_smpl_buffer_alloc(struct task_struct *task, struct file *filp, pfm_context_t
 		goto error_kmem;
 	}
 	INIT_LIST_HEAD(&vma->anon_vma_chain);
+	vma_init_speculative(vma);
 
 	/*
 	 * partially initialize the vma for the sampling buffer
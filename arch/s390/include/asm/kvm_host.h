@@ -129,6 +129,8 @@ struct kvm_vcpu_stat {
 	u32 deliver_restart_signal;
 	u32 deliver_program_int;
 	u32 exit_wait_state;
+	u32 halt_successful_poll;
+	u32 halt_attempted_poll;
 	u32 instruction_stidp;
 	u32 instruction_spx;
 	u32 instruction_stpx;
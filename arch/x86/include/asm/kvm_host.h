@@ -27,6 +27,7 @@
 #include <asm/msr-index.h>
 
 #define KVM_MAX_VCPUS 64
+#define KVM_HALT_POLL_NS_DEFAULT 500000
 #define KVM_MEMORY_SLOTS 32
 /* memory slots that does not exposed to userspace */
 #define KVM_PRIVATE_MEM_SLOTS 4
@@ -236,6 +237,9 @@ struct kvm_mmu_page {
 		struct hlist_head parent_ptes; /* multimapped, kvm_pte_chain */
 	};
 	DECLARE_BITMAP(unsync_child_bitmap, 512);
+
+	/* freed after a grace period if lockless walkers were active */
+	struct rcu_head rcu;
 };
 
 struct kvm_pv_mmu_op_buffer {
@@ -442,6 +446,8 @@ struct kvm_arch {
 	unsigned int n_requested_mmu_pages;
 	unsigned int n_max_mmu_pages;
 	atomic_t invlpg_counter;
+	/* number of vcpus walking the shadow page tables without mmu_lock */
+	atomic_t reader_counter;
 	struct hlist_head mmu_page_hash[KVM_NUM_MMU_PAGES];
 	/*
 	 * Hash table of struct kvm_mmu_page.
@@ -497,6 +503,7 @@ struct kvm_vm_stat {
 
 struct kvm_vcpu_stat {
 	u32 pf_fixed;
+	u32 pf_fast;
 	u32 pf_guest;
 	u32 tlb_flush;
 	u32 invlpg;
@@ -508,6 +515,8 @@ struct kvm_vcpu_stat {
 	u32 irq_window_exits;
 	u32 nmi_window_exits;
 	u32 halt_exits;
+	u32 halt_successful_poll;
+	u32 halt_attempted_poll;
 	u32 halt_wakeup;
 	u32 request_irq_exits;
 	u32 irq_exits;
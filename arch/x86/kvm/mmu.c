@@ -161,6 +161,12 @@ module_param(oos_shadow, bool, 0644);
 #include "mmutrace.h"
 
 #define SPTE_HOST_WRITEABLE (1ULL << PT_FIRST_AVAIL_BITS_SHIFT)
+/*
+ * The spte may be made writable without changing the mmu state, i.e. it
+ * is write-protected (if at all) only for dirty logging.  Cleared when
+ * the gfn is write-protected because it is shadowed.
+ */
+#define SPTE_MMU_WRITEABLE (1ULL << (PT_FIRST_AVAIL_BITS_SHIFT + 1))
 
 #define SHADOW_PT_INDEX(addr, level) PT64_INDEX(addr, level)
 
@@ -182,6 +188,12 @@ struct kvm_shadow_walk_iterator {
 	     shadow_walk_okay(&(_walker));			\
 	     shadow_walk_next(&(_walker)))
 
+#define for_each_shadow_entry_lockless(_vcpu, _addr, _walker, spte)	\
+	for (shadow_walk_init(&(_walker), _vcpu, _addr);		\
+	     shadow_walk_okay(&(_walker)) &&				\
+		({ spte = ACCESS_ONCE(*(_walker).sptep); 1; });		\
+	     __shadow_walk_next(&(_walker), spte))
+
 typedef void (*mmu_parent_walk_fn) (struct kvm_mmu_page *sp, u64 *spte);
 
 static struct kmem_cache *pte_chain_cache;
@@ -302,8 +314,21 @@ static u64 __xchg_spte(u64 *sptep, u64 new_spte)
 #endif
 }
 
+static bool spte_is_locklessly_modifiable(u64 spte)
+{
+	return (spte & (SPTE_HOST_WRITEABLE | SPTE_MMU_WRITEABLE)) ==
+		(SPTE_HOST_WRITEABLE | SPTE_MMU_WRITEABLE);
+}
+
 static bool spte_has_volatile_bits(u64 spte)
 {
+	/*
+	 * fast_page_fault() may set the writable bit of such an spte
+	 * without holding mmu_lock, so it has to be updated atomically.
+	 */
+	if (spte_is_locklessly_modifiable(spte))
+		return true;
+
 	if (!shadow_accessed_mask)
 		return false;
 
@@ -322,9 +347,14 @@ static bool spte_is_bit_cleared(u64 old_spte, u64 new_spte, u64 bit_mask)
 	return (old_spte & bit_mask) && !(new_spte & bit_mask);
 }
 
-static void update_spte(u64 *sptep, u64 new_spte)
+/*
+ * Returns true if a writable spte was made read-only, in which case the
+ * caller has to flush remote TLBs.
+ */
+static bool update_spte(u64 *sptep, u64 new_spte)
 {
 	u64 mask, old_spte = *sptep;
+	bool ret = false;
 
 	WARN_ON(!is_rmap_spte(new_spte));
 
@@ -334,18 +364,24 @@ static void update_spte(u64 *sptep, u64 new_spte)
 	if (is_writable_pte(old_spte))
 		mask |= shadow_dirty_mask;
 
-	if (!spte_has_volatile_bits(old_spte) || (new_spte & mask) == mask)
+	if (!spte_has_volatile_bits(old_spte) ||
+	    ((new_spte & mask) == mask &&
+	     !spte_is_locklessly_modifiable(old_spte)))
 		__set_spte(sptep, new_spte);
 	else
 		old_spte = __xchg_spte(sptep, new_spte);
 
+	if (is_writable_pte(old_spte) && !is_writable_pte(new_spte))
+		ret = true;
+
 	if (!shadow_accessed_mask)
-		return;
+		return ret;
 
 	if (spte_is_bit_cleared(old_spte, new_spte, shadow_accessed_mask))
 		kvm_set_pfn_accessed(spte_to_pfn(old_spte));
 	if (spte_is_bit_cleared(old_spte, new_spte, shadow_dirty_mask))
 		kvm_set_pfn_dirty(spte_to_pfn(old_spte));
+	return ret;
 }
 
 static int mmu_topup_memory_cache(struct kvm_mmu_memory_cache *cache,
@@ -789,9 +825,15 @@ static int rmap_write_protect(struct kvm *kvm, u64 gfn)
 		BUG_ON(!spte);
 		BUG_ON(!(*spte & PT_PRESENT_MASK));
 		rmap_printk("rmap_write_protect: spte %p %llx\n", spte, *spte);
-		if (is_writable_pte(*spte)) {
-			update_spte(spte, *spte & ~PT_WRITABLE_MASK);
-			write_protected = 1;
+		/*
+		 * Clear SPTE_MMU_WRITEABLE even if the spte is already
+		 * read-only, so that fast_page_fault() won't make it
+		 * writable again.
+		 */
+		if (*spte & (PT_WRITABLE_MASK | SPTE_MMU_WRITEABLE)) {
+			if (update_spte(spte, *spte & ~(PT_WRITABLE_MASK |
+							SPTE_MMU_WRITEABLE)))
+				write_protected = 1;
 		}
 		spte = rmap_next(kvm, rmapp, spte);
 	}
@@ -1032,16 +1074,25 @@ static inline void kvm_mod_used_mmu_pages(struct kvm *kvm, int nr)
 	percpu_counter_add(&kvm_total_used_mmu_pages, nr);
 }
 
-static void kvm_mmu_free_page(struct kvm *kvm, struct kvm_mmu_page *sp)
+/*
+ * Remove the shadow page from the mmu bookkeeping.  Its memory is
+ * released separately by kvm_mmu_free_page(), possibly after an RCU
+ * grace period.
+ */
+static void kvm_mmu_isolate_page(struct kvm *kvm, struct kvm_mmu_page *sp)
 {
 	ASSERT(is_empty_shadow_page(sp->spt));
 	hlist_del(&sp->hash_link);
+	kvm_mod_used_mmu_pages(kvm, -1);
+}
+
+static void kvm_mmu_free_page(struct kvm_mmu_page *sp)
+{
 	list_del(&sp->link);
 	free_page((unsigned long)sp->spt);
 	if (!sp->role.direct)
 		free_page((unsigned long)sp->gfns);
 	kmem_cache_free(mmu_page_header_cache, sp);
-	kvm_mod_used_mmu_pages(kvm, -1);
 }
 
 static unsigned kvm_page_table_hashfn(gfn_t gfn)
@@ -1581,12 +1632,46 @@ static bool shadow_walk_okay(struct kvm_shadow_walk_iterator *iterator)
 	return true;
 }
 
+static void __shadow_walk_next(struct kvm_shadow_walk_iterator *iterator,
+			       u64 spte)
+{
+	if (is_last_spte(spte, iterator->level)) {
+		iterator->level = 0;
+		return;
+	}
+
+	iterator->shadow_addr = spte & PT64_BASE_ADDR_MASK;
+	--iterator->level;
+}
+
 static void shadow_walk_next(struct kvm_shadow_walk_iterator *iterator)
 {
 	iterator->shadow_addr = *iterator->sptep & PT64_BASE_ADDR_MASK;
 	--iterator->level;
 }
 
+/*
+ * Walking the shadow page tables without mmu_lock: shadow pages zapped
+ * while anybody is walking are freed only after an RCU grace period,
+ * see kvm_mmu_commit_zap_page().
+ */
+static void walk_shadow_page_lockless_begin(struct kvm_vcpu *vcpu)
+{
+	rcu_read_lock();
+	atomic_inc(&vcpu->kvm->arch.reader_counter);
+
+	/* Increase the counter before walking shadow page table */
+	smp_mb__after_atomic_inc();
+}
+
+static void walk_shadow_page_lockless_end(struct kvm_vcpu *vcpu)
+{
+	/* Decrease the counter after walking shadow page table finished */
+	smp_mb__before_atomic_dec();
+	atomic_dec(&vcpu->kvm->arch.reader_counter);
+	rcu_read_unlock();
+}
+
 static void link_shadow_page(u64 *sptep, struct kvm_mmu_page *sp)
 {
 	u64 spte;
@@ -1744,6 +1829,22 @@ static int kvm_mmu_prepare_zap_page(struct kvm *kvm, struct kvm_mmu_page *sp,
 	return ret;
 }
 
+static void free_pages_rcu(struct rcu_head *head)
+{
+	struct kvm_mmu_page *next, *sp;
+
+	sp = container_of(head, struct kvm_mmu_page, rcu);
+	while (sp) {
+		if (!list_empty(&sp->link))
+			next = list_first_entry(&sp->link,
+						struct kvm_mmu_page, link);
+		else
+			next = NULL;
+		kvm_mmu_free_page(sp);
+		sp = next;
+	}
+}
+
 static void kvm_mmu_commit_zap_page(struct kvm *kvm,
 				    struct list_head *invalid_list)
 {
@@ -1754,12 +1855,26 @@ static void kvm_mmu_commit_zap_page(struct kvm *kvm,
 
 	kvm_flush_remote_tlbs(kvm);
 
+	list_for_each_entry(sp, invalid_list, link) {
+		WARN_ON(!sp->role.invalid || sp->root_count);
+		kvm_mmu_isolate_page(kvm, sp);
+	}
+
+	/*
+	 * A vcpu may be walking the page tables in fast_page_fault(),
+	 * hand the pages to RCU instead of freeing them here.
+	 */
+	if (atomic_read(&kvm->arch.reader_counter)) {
+		sp = list_first_entry(invalid_list, struct kvm_mmu_page, link);
+		list_del_init(invalid_list);
+		call_rcu(&sp->rcu, free_pages_rcu);
+		return;
+	}
+
 	do {
 		sp = list_first_entry(invalid_list, struct kvm_mmu_page, link);
-		WARN_ON(!sp->role.invalid || sp->root_count);
-		kvm_mmu_free_page(kvm, sp);
+		kvm_mmu_free_page(sp);
 	} while (!list_empty(invalid_list));
-
 }
 
 /*
@@ -2006,7 +2121,7 @@ static int set_spte(struct kvm_vcpu *vcpu, u64 *sptep,
 		    gfn_t gfn, pfn_t pfn, bool speculative,
 		    bool can_unsync, bool host_writable)
 {
-	u64 spte, entry = *sptep;
+	u64 spte;
 	int ret = 0;
 
 	/*
@@ -2049,7 +2164,7 @@ static int set_spte(struct kvm_vcpu *vcpu, u64 *sptep,
 			goto done;
 		}
 
-		spte |= PT_WRITABLE_MASK;
+		spte |= PT_WRITABLE_MASK | SPTE_MMU_WRITEABLE;
 
 		if (!vcpu->arch.mmu.direct_map
 		    && !(pte_access & ACC_WRITE_MASK))
@@ -2069,8 +2184,7 @@ static int set_spte(struct kvm_vcpu *vcpu, u64 *sptep,
 				 __func__, gfn);
 			ret = 1;
 			pte_access &= ~ACC_WRITE_MASK;
-			if (is_writable_pte(spte))
-				spte &= ~PT_WRITABLE_MASK;
+			spte &= ~(PT_WRITABLE_MASK | SPTE_MMU_WRITEABLE);
 		}
 	}
 
@@ -2078,14 +2192,15 @@ static int set_spte(struct kvm_vcpu *vcpu, u64 *sptep,
 		mark_page_dirty(vcpu->kvm, gfn);
 
 set_pte:
-	update_spte(sptep, spte);
 	/*
 	 * If we overwrite a writable spte with a read-only one we
 	 * should flush remote TLBs. Otherwise rmap_write_protect
 	 * will find a read-only spte, even though the writable spte
-	 * might be cached on a CPU's TLB.
+	 * might be cached on a CPU's TLB.  update_spte() looks at the
+	 * old value it actually replaced, which may have been made
+	 * writable by fast_page_fault() in the meantime.
 	 */
-	if (is_writable_pte(entry) && !is_writable_pte(*sptep))
+	if (update_spte(sptep, spte))
 		kvm_flush_remote_tlbs(vcpu->kvm);
 done:
 	return ret;
@@ -2735,6 +2850,75 @@ static bool try_async_pf(struct kvm_vcpu *vcpu, bool prefault, gfn_t gfn,
 	return false;
 }
 
+static bool page_fault_can_be_fast(struct kvm_vcpu *vcpu, u32 error_code)
+{
+#ifdef CONFIG_X86_64
+	/* Reserved bit faults are never fixed here. */
+	return !(error_code & PFERR_RSVD_MASK);
+#else
+	/* 64-bit sptes can't be read atomically without mmu_lock. */
+	return false;
+#endif
+}
+
+/*
+ * Handle the faults that don't need to change the mmu state without
+ * taking mmu_lock:
+ *  - the 4K spte is already present and allows the access, i.e. another
+ *    vcpu has fixed the fault in the meantime;
+ *  - the spte is write-protected only for dirty logging, in which case
+ *    it is made writable again with cmpxchg.
+ * Installing a new leaf spte is not done here, even though that is what
+ * most faults of a booting guest need: the spte has to be added to the
+ * rmap, which mmu notifier invalidation and write protection rely on and
+ * which is protected by mmu_lock.  Such faults still take mmu_lock.
+ *
+ * Returns true if the fault has been handled and the guest can retry.
+ */
+static bool fast_page_fault(struct kvm_vcpu *vcpu, gva_t gva, u32 error_code)
+{
+	struct kvm_shadow_walk_iterator iterator;
+	bool ret = false;
+	u64 spte = shadow_trap_nonpresent_pte;
+
+	if (!page_fault_can_be_fast(vcpu, error_code))
+		return false;
+
+	walk_shadow_page_lockless_begin(vcpu);
+	for_each_shadow_entry_lockless(vcpu, gva, iterator, spte)
+		if (!is_shadow_present_pte(spte) ||
+		    is_last_spte(spte, iterator.level))
+			break;
+
+	if (!is_shadow_present_pte(spte) ||
+	    iterator.level != PT_PAGE_TABLE_LEVEL)
+		goto exit;
+
+	if (!(error_code & PFERR_WRITE_MASK) || is_writable_pte(spte)) {
+		ret = true;
+		goto exit;
+	}
+
+	if (!spte_is_locklessly_modifiable(spte))
+		goto exit;
+
+	/*
+	 * The dirty bitmap is updated after the spte has been made
+	 * writable; kvm_vm_ioctl_get_dirty_log() waits for us through
+	 * synchronize_srcu before it looks at the old bitmap.
+	 */
+	if (cmpxchg64(iterator.sptep, spte, spte | PT_WRITABLE_MASK) == spte)
+		mark_page_dirty(vcpu->kvm, gva >> PAGE_SHIFT);
+	ret = true;
+
+exit:
+	walk_shadow_page_lockless_end(vcpu);
+	if (ret)
+		++vcpu->stat.pf_fast;
+	trace_fast_page_fault(vcpu, gva, error_code, spte, ret);
+	return ret;
+}
+
 static int tdp_page_fault(struct kvm_vcpu *vcpu, gva_t gpa, u32 error_code,
 			  bool prefault)
 {
@@ -2750,6 +2934,9 @@ static int tdp_page_fault(struct kvm_vcpu *vcpu, gva_t gpa, u32 error_code,
 	ASSERT(vcpu);
 	ASSERT(VALID_PAGE(vcpu->arch.mmu.root_hpa));
 
+	if (fast_page_fault(vcpu, gpa, error_code))
+		return 0;
+
 	r = mmu_topup_memory_caches(vcpu);
 	if (r)
 		return r;
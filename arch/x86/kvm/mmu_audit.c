@@ -209,10 +209,26 @@ static void audit_write_protection(struct kvm *kvm, struct kvm_mmu_page *sp)
 			audit_printk(kvm, "shadow page has writable "
 				     "mappings: gfn %llx role %x\n",
 				     sp->gfn, sp->role.word);
+		/* fast_page_fault() would make it writable behind our back */
+		else if (spte_is_locklessly_modifiable(*spte))
+			audit_printk(kvm, "shadow page has lockless writable "
+				     "mappings: gfn %llx role %x\n",
+				     sp->gfn, sp->role.word);
 		spte = rmap_next(kvm, rmapp, spte);
 	}
 }
 
+static void audit_spte_mmu_writable(struct kvm_vcpu *vcpu, u64 *sptep,
+				    int level)
+{
+	if (!is_shadow_present_pte(*sptep) || !is_last_spte(*sptep, level))
+		return;
+
+	if (is_writable_pte(*sptep) && !(*sptep & SPTE_MMU_WRITEABLE))
+		audit_printk(vcpu->kvm, "writable spte %llx without "
+			     "SPTE_MMU_WRITEABLE\n", *sptep);
+}
+
 static void audit_sp(struct kvm *kvm, struct kvm_mmu_page *sp)
 {
 	check_mappings_rmap(kvm, sp);
@@ -229,6 +245,7 @@ static void audit_spte(struct kvm_vcpu *vcpu, u64 *sptep, int level)
 	audit_sptes_have_rmaps(vcpu, sptep, level);
 	audit_mappings(vcpu, sptep, level);
 	audit_spte_after_sync(vcpu, sptep, level);
+	audit_spte_mmu_writable(vcpu, sptep, level);
 }
 
 static void audit_vcpu_spte(struct kvm_vcpu *vcpu)
@@ -48,6 +48,7 @@ struct driver_private {
 	struct klist_node knode_bus;
 	struct module_kobject *mkobj;
 	struct device_driver *driver;
+	atomic_t async_probes;
 };
 #define to_driver(obj) container_of(obj, struct driver_private, kobj)
 
@@ -60,6 +61,8 @@ struct driver_private {
  * @knode_bus - node in bus list
  * @driver_data - private pointer for driver specific info.  Will turn into a
  * list soon.
+ * @async_driver - driver an asynchronous probe is scheduled for, if any.
+ * @dead - the device is being deleted, don't bind it to a driver anymore.
  * @device - pointer back to the struct class that this structure is
  * associated with.
  *
@@ -71,7 +74,9 @@ struct device_private {
 	struct klist_node knode_driver;
 	struct klist_node knode_bus;
 	void *driver_data;
+	struct device_driver *async_driver;
 	struct device *device;
+	unsigned int dead:1;
 };
 #define to_device_private_parent(obj)	\
 	container_of(obj, struct device_private, knode_parent)
@@ -1088,6 +1088,16 @@ void device_del(struct device *dev)
 	struct device *parent = dev->parent;
 	struct class_interface *class_intf;
 
+	/*
+	 * Keep a pending asynchronous probe from binding a driver to the
+	 * device once we have started to tear it down.  A probe that is
+	 * already running holds the device lock, so it completes first
+	 * and the driver is released again by bus_remove_device().
+	 */
+	device_lock(dev);
+	dev->p->dead = true;
+	device_unlock(dev);
+
 	/* Notify clients of device removal.  This call must come
 	 * before dpm_sysfs_remove().
 	 */
@@ -24,6 +24,7 @@
 #include <linux/wait.h>
 #include <linux/async.h>
 #include <linux/pm_runtime.h>
+#include <linux/ktime.h>
 
 #include "base.h"
 #include "power/power.h"
@@ -105,6 +106,10 @@ EXPORT_SYMBOL_GPL(device_bind_driver);
 static atomic_t probe_count = ATOMIC_INIT(0);
 static DECLARE_WAIT_QUEUE_HEAD(probe_waitqueue);
 
+/* Asynchronous probes of drivers and buses that asked for them */
+static LIST_HEAD(probe_domain);
+static atomic_t async_probe_count = ATOMIC_INIT(0);
+
 static int really_probe(struct device *dev, struct device_driver *drv)
 {
 	int ret = 0;
@@ -169,7 +174,7 @@ int driver_probe_done(void)
 {
 	pr_debug("%s: probe_count = %d\n", __func__,
 		 atomic_read(&probe_count));
-	if (atomic_read(&probe_count))
+	if (atomic_read(&probe_count) || atomic_read(&async_probe_count))
 		return -EBUSY;
 	return 0;
 }
@@ -181,11 +186,42 @@ int driver_probe_done(void)
 void wait_for_device_probe(void)
 {
 	/* wait for the known devices to complete their probing */
+	async_synchronize_full_domain(&probe_domain);
 	wait_event(probe_waitqueue, atomic_read(&probe_count) == 0);
 	async_synchronize_full();
 }
 EXPORT_SYMBOL_GPL(wait_for_device_probe);
 
+/*
+ * Devices which are probed asynchronously during boot should be bound by
+ * the time the late initcalls and userspace run.
+ */
+static int __init async_probe_sync(void)
+{
+	async_synchronize_full_domain(&probe_domain);
+	return 0;
+}
+late_initcall(async_probe_sync);
+
+/* Print the probe time of a device for scripts/bootgraph.pl. */
+static int really_probe_debug(struct device *dev, struct device_driver *drv)
+{
+	ktime_t calltime, delta, rettime;
+	int ret;
+
+	printk(KERN_DEBUG "calling  %s:%s+ @ %i, parent: %s\n",
+	       drv->name, dev_name(dev), task_pid_nr(current),
+	       dev->parent ? dev_name(dev->parent) : "none");
+	calltime = ktime_get();
+	ret = really_probe(dev, drv);
+	rettime = ktime_get();
+	delta = ktime_sub(rettime, calltime);
+	printk(KERN_DEBUG "initcall %s:%s+ returned %d after %lld usecs\n",
+	       drv->name, dev_name(dev), ret,
+	       (unsigned long long)ktime_to_ns(delta) >> 10);
+	return ret;
+}
+
 /**
  * driver_probe_device - attempt to bind device & driver together
  * @drv: driver to bind a device to
@@ -209,12 +245,74 @@ int driver_probe_device(struct device_driver *drv, struct device *dev)
 
 	pm_runtime_get_noresume(dev);
 	pm_runtime_barrier(dev);
-	ret = really_probe(dev, drv);
+	if (initcall_debug && system_state == SYSTEM_BOOTING)
+		ret = really_probe_debug(dev, drv);
+	else
+		ret = really_probe(dev, drv);
 	pm_runtime_put_sync(dev);
 
 	return ret;
 }
 
+static bool driver_allows_async_probing(struct device_driver *drv)
+{
+	return drv->async_probe || drv->bus->async_probe;
+}
+
+static void __driver_probe_device_async(void *data, async_cookie_t cookie)
+{
+	struct device *dev = data;
+	struct device_driver *drv = dev->p->async_driver;
+	bool parent_pending = false;
+
+	/*
+	 * If the parent is still waiting for its own asynchronous probe,
+	 * let it and everything else scheduled before us finish first.
+	 * Its async_driver is only stable under its lock, but we must not
+	 * hold that while waiting for the parent's probe, which takes it.
+	 */
+	if (dev->parent && dev->parent->p) {
+		device_lock(dev->parent);
+		parent_pending = dev->parent->p->async_driver != NULL;
+		device_unlock(dev->parent);
+	}
+	if (parent_pending)
+		async_synchronize_cookie_domain(cookie, &probe_domain);
+
+	if (dev->parent)	/* Needed for USB */
+		device_lock(dev->parent);
+	device_lock(dev);
+	/* device_del() may have run while we were queued */
+	if (!dev->p->dead && !dev->driver)
+		driver_probe_device(drv, dev);
+	dev->p->async_driver = NULL;
+	device_unlock(dev);
+	if (dev->parent)
+		device_unlock(dev->parent);
+
+	atomic_dec(&drv->p->async_probes);
+	atomic_dec(&async_probe_count);
+	wake_up(&probe_waitqueue);
+	put_device(dev);
+}
+
+/*
+ * Schedule an asynchronous probe of @dev with @drv, unless one is pending
+ * already.  Must be called with @dev lock held.
+ */
+static void driver_probe_device_async(struct device_driver *drv,
+				      struct device *dev)
+{
+	if (dev->p->dead || dev->p->async_driver)
+		return;
+
+	dev->p->async_driver = drv;
+	get_device(dev);
+	atomic_inc(&drv->p->async_probes);
+	atomic_inc(&async_probe_count);
+	async_schedule_domain(__driver_probe_device_async, dev, &probe_domain);
+}
+
 static int __device_attach(struct device_driver *drv, void *data)
 {
 	struct device *dev = data;
@@ -222,6 +320,11 @@ static int __device_attach(struct device_driver *drv, void *data)
 	if (!driver_match_device(drv, dev))
 		return 0;
 
+	if (driver_allows_async_probing(drv)) {
+		driver_probe_device_async(drv, dev);
+		return 1;
+	}
+
 	return driver_probe_device(drv, dev);
 }
 
@@ -233,7 +336,8 @@ static int __device_attach(struct device_driver *drv, void *data)
  * driver_probe_device() for each pair. If a compatible
  * pair is found, break out and return.
  *
- * Returns 1 if the device was bound to a driver;
+ * Returns 1 if the device was bound to a driver, or an asynchronous
+ * probe of a driver has been scheduled;
  * 0 if no matching driver was found;
  * -ENODEV if the device is not registered.
  *
@@ -284,6 +388,14 @@ static int __driver_attach(struct device *dev, void *data)
 	if (!driver_match_device(drv, dev))
 		return 0;
 
+	if (driver_allows_async_probing(drv)) {
+		device_lock(dev);
+		if (!dev->driver)
+			driver_probe_device_async(drv, dev);
+		device_unlock(dev);
+		return 0;
+	}
+
 	if (dev->parent)	/* Needed for USB */
 		device_lock(dev->parent);
 	device_lock(dev);
@@ -376,6 +488,9 @@ void driver_detach(struct device_driver *drv)
 	struct device_private *dev_prv;
 	struct device *dev;
 
+	/* Let pending asynchronous probes with this driver finish. */
+	wait_event(probe_waitqueue, atomic_read(&drv->p->async_probes) == 0);
+
 	for (;;) {
 		spin_lock(&drv->p->klist_devices.k_lock);
 		if (list_empty(&drv->p->klist_devices.k_list)) {
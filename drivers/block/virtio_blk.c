@@ -193,8 +193,12 @@ static void do_virtblk_request(struct request_queue *q)
 		issued++;
 	}
 
-	if (issued)
-		virtqueue_kick(vblk->vq);
+	/* The notification traps to the host, don't hold the lock over it. */
+	if (issued && virtqueue_kick_prepare(vblk->vq)) {
+		spin_unlock_irq(q->queue_lock);
+		virtqueue_notify(vblk->vq);
+		spin_lock_irq(q->queue_lock);
+	}
 }
 
 /* return id (s/n) string for *disk to *id_str
@@ -119,6 +119,11 @@
  * this will result in random numbers that are merely cryptographically
  * strong.  For many applications, however, this is acceptable.
  *
+ * Both get_random_bytes() and /dev/urandom are served by a ChaCha20
+ * based generator on each cpu, periodically reseeded from the entropy
+ * pools, rather than by hashing a pool under its lock for every few
+ * bytes of output.
+ *
  * Exported interfaces ---- input
  * ==============================
  *
@@ -248,6 +253,7 @@
 #include <linux/percpu.h>
 #include <linux/cryptohash.h>
 #include <linux/fips.h>
+#include <crypto/chacha20.h>
 
 #ifdef CONFIG_GENERIC_HARDIRQS
 # include <linux/irq.h>
@@ -925,6 +931,160 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
 	return ret;
 }
 
+/*********************************************************************
+ *
+ * CRNG using the ChaCha20 block function
+ *
+ * Hashing the nonblocking pool with SHA-1 under its lock for every 10
+ * bytes handed out does not scale to many concurrent readers, so
+ * get_random_bytes() and /dev/urandom are served by a ChaCha20
+ * keystream generator on each cpu instead, needing nothing more than
+ * interrupts disabled.
+ *
+ * The per-cpu generators are keyed from a primary one, which is
+ * reseeded from the nonblocking pool every CRNG_RESEED_INTERVAL (every
+ * second until the input pool has collected some entropy) and whenever
+ * data is written to the device.  A generator overwrites its key with
+ * fresh keystream after each request, so that its output cannot be
+ * recovered from a later compromise of its state.
+ *
+ *********************************************************************/
+
+#define CRNG_RESEED_INTERVAL	(300 * HZ)
+#define CRNG_BATCH_SIZE		(4 * CHACHA20_BLOCK_SIZE)
+
+struct crng_state {
+	__u32 state[CHACHA20_STATE_WORDS];
+	unsigned long generation;
+};
+
+static struct crng_state primary_crng;
+static DEFINE_SPINLOCK(primary_crng_lock);
+static unsigned long primary_crng_init_time;
+static bool crng_fully_seeded;
+
+/* Bumped on every reseed of primary_crng; 0 until it is first seeded. */
+static unsigned long crng_generation;
+
+static DEFINE_PER_CPU(struct crng_state, cpu_crng);
+
+static void crng_init_constants(struct crng_state *crng)
+{
+	/* "expand 32-byte k" */
+	crng->state[0] = 0x61707865;
+	crng->state[1] = 0x3320646e;
+	crng->state[2] = 0x79622d32;
+	crng->state[3] = 0x6b206574;
+}
+
+static unsigned long crng_reseed_interval(void)
+{
+	return crng_fully_seeded ? CRNG_RESEED_INTERVAL : HZ;
+}
+
+/*
+ * Mix fresh output of the nonblocking pool into the key, counter and
+ * nonce of primary_crng.  Called with primary_crng_lock held.
+ */
+static void crng_reseed_primary(void)
+{
+	__u32 seed[CHACHA20_STATE_WORDS - 4];
+	int i;
+
+	if (input_pool.entropy_count >= random_read_wakeup_thresh * 2)
+		crng_fully_seeded = true;
+
+	extract_entropy(&nonblocking_pool, seed, sizeof(seed), 0, 0);
+	for (i = 0; i < ARRAY_SIZE(seed); i++)
+		primary_crng.state[4 + i] ^= seed[i];
+	memset(seed, 0, sizeof(seed));
+
+	primary_crng_init_time = jiffies;
+	if (++crng_generation == 0)
+		crng_generation = 1;
+}
+
+static void crng_initialize(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&primary_crng_lock, flags);
+	crng_init_constants(&primary_crng);
+	crng_reseed_primary();
+	spin_unlock_irqrestore(&primary_crng_lock, flags);
+}
+
+static void crng_reseed(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&primary_crng_lock, flags);
+	if (crng_generation)
+		crng_reseed_primary();
+	spin_unlock_irqrestore(&primary_crng_lock, flags);
+}
+
+/*
+ * Give this cpu's generator a new key, counter and nonce from
+ * primary_crng, reseeding that first if it is due.  Called with
+ * interrupts disabled.
+ */
+static void crng_rekey(struct crng_state *crng)
+{
+	__u32 block[2][CHACHA20_STATE_WORDS];
+	int i;
+
+	spin_lock(&primary_crng_lock);
+	if (time_after(jiffies, primary_crng_init_time +
+				crng_reseed_interval()))
+		crng_reseed_primary();
+	chacha20_block(primary_crng.state, block[0]);
+	chacha20_block(primary_crng.state, block[1]);
+	for (i = 0; i < CHACHA20_KEY_SIZE / 4; i++)
+		primary_crng.state[4 + i] ^= block[1][i];
+	crng->generation = crng_generation;
+	spin_unlock(&primary_crng_lock);
+
+	crng_init_constants(crng);
+	memcpy(&crng->state[4], block[0], sizeof(crng->state) - 16);
+	memset(block, 0, sizeof(block));
+}
+
+/*
+ * Fill buf with nbytes, at most CRNG_BATCH_SIZE, of output from this
+ * cpu's generator.
+ */
+static void crng_fill(__u8 *buf, int nbytes)
+{
+	__u32 block[CHACHA20_STATE_WORDS];
+	struct crng_state *crng;
+	unsigned long flags;
+	int i;
+
+	local_irq_save(flags);
+	crng = &__get_cpu_var(cpu_crng);
+	if (unlikely(crng->generation != ACCESS_ONCE(crng_generation) ||
+		     time_after(jiffies, ACCESS_ONCE(primary_crng_init_time) +
+					 crng_reseed_interval())))
+		crng_rekey(crng);
+
+	while (nbytes) {
+		i = min_t(int, nbytes, CHACHA20_BLOCK_SIZE);
+		chacha20_block(crng->state, block);
+		memcpy(buf, block, i);
+		nbytes -= i;
+		buf += i;
+	}
+
+	/* Erase the key that produced this output */
+	chacha20_block(crng->state, block);
+	for (i = 0; i < CHACHA20_KEY_SIZE / 4; i++)
+		crng->state[4 + i] ^= block[i];
+	local_irq_restore(flags);
+
+	memset(block, 0, sizeof(block));
+}
+
 /*
  * This function is the exported kernel interface.  It returns some
  * number of good random numbers, suitable for seeding TCP sequence
@@ -932,7 +1092,20 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
  */
 void get_random_bytes(void *buf, int nbytes)
 {
-	extract_entropy(&nonblocking_pool, buf, nbytes, 0, 0);
+	int n;
+
+	/* too early in boot for the crng, see rand_initialize() */
+	if (unlikely(!ACCESS_ONCE(crng_generation))) {
+		extract_entropy(&nonblocking_pool, buf, nbytes, 0, 0);
+		return;
+	}
+
+	while (nbytes > 0) {
+		n = min_t(int, nbytes, CRNG_BATCH_SIZE);
+		crng_fill(buf, n);
+		nbytes -= n;
+		buf += n;
+	}
 }
 EXPORT_SYMBOL(get_random_bytes);
 
@@ -964,6 +1137,7 @@ static int rand_initialize(void)
 	init_std_data(&input_pool);
 	init_std_data(&blocking_pool);
 	init_std_data(&nonblocking_pool);
+	crng_initialize();
 	return 0;
 }
 module_init(rand_initialize);
@@ -1060,7 +1234,39 @@ random_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
 static ssize_t
 urandom_read(struct file *file, char __user *buf, size_t nbytes, loff_t *ppos)
 {
-	return extract_entropy_user(&nonblocking_pool, buf, nbytes);
+	__u8 tmp[CRNG_BATCH_SIZE];
+	ssize_t ret = 0;
+	size_t n;
+
+	if (unlikely(!ACCESS_ONCE(crng_generation)))
+		return extract_entropy_user(&nonblocking_pool, buf, nbytes);
+
+	while (nbytes) {
+		if (need_resched()) {
+			if (signal_pending(current)) {
+				if (ret == 0)
+					ret = -ERESTARTSYS;
+				break;
+			}
+			schedule();
+		}
+
+		n = min_t(size_t, nbytes, sizeof(tmp));
+		crng_fill(tmp, n);
+		if (copy_to_user(buf, tmp, n)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		nbytes -= n;
+		buf += n;
+		ret += n;
+	}
+
+	/* Wipe data just returned from memory */
+	memset(tmp, 0, sizeof(tmp));
+
+	return ret;
 }
 
 static unsigned int
@@ -1112,6 +1318,9 @@ static ssize_t random_write(struct file *file, const char __user *buffer,
 	if (ret)
 		return ret;
 
+	/* Let data written to the device, e.g. a saved seed, count at once */
+	crng_reseed();
+
 	return (ssize_t)count;
 }
 
@@ -30,12 +30,8 @@
  * Generic simple memory manager implementation. Intended to be used as a base
  * class implementation for more advanced memory managers.
  *
- * Note that the algorithm used is quite simple and there might be substantial
- * performance gains if a smarter free list is implemented. Currently it is just an
- * unordered stack of free regions. This could easily be improved if an RB-tree
- * is used instead. At least if we expect heavy fragmentation.
- *
- * Aligned allocations can also see improvement.
+ * Free regions are kept in rbtrees sorted by size and by address, so finding a
+ * suitable hole takes logarithmic time even with heavy fragmentation.
  *
  * Authors:
  * Thomas Hellström <thomas-at-tungstengraphics-dot-com>
@@ -45,6 +41,7 @@
 #include "drm_mm.h"
 #include <linux/slab.h>
 #include <linux/seq_file.h>
+#include <linux/rbtree.h>
 
 #define MM_UNUSED_TARGET 4
 
@@ -115,124 +112,168 @@ static inline unsigned long drm_mm_hole_node_end(struct drm_mm_node *hole_node)
 	return next_node->start;
 }
 
-static void drm_mm_insert_helper(struct drm_mm_node *hole_node,
-				 struct drm_mm_node *node,
-				 unsigned long size, unsigned alignment)
-{
-	struct drm_mm *mm = hole_node->mm;
-	unsigned long tmp = 0, wasted = 0;
-	unsigned long hole_start = drm_mm_hole_node_start(hole_node);
-	unsigned long hole_end = drm_mm_hole_node_end(hole_node);
+/*
+ * Free holes are indexed by two rbtrees: mm->holes_size is sorted by hole
+ * size and used for best fit searches, mm->holes_addr is sorted by hole
+ * address and used for bottom-up and top-down searches.  The address tree is
+ * augmented with the size of the largest hole in each subtree, so a search
+ * can skip whole subtrees which cannot satisfy the request.  A node is linked
+ * into both trees exactly when hole_follows is set.
+ */
+#define DRM_MM_HOLE_SIZE(rb) rb_entry(rb, struct drm_mm_node, rb_hole_size)
+#define DRM_MM_HOLE_ADDR(rb) rb_entry(rb, struct drm_mm_node, rb_hole_addr)
 
-	BUG_ON(!hole_node->hole_follows || node->allocated);
+static inline unsigned long drm_mm_subtree_max_hole(struct rb_node *rb)
+{
+	return rb ? DRM_MM_HOLE_ADDR(rb)->subtree_max_hole : 0;
+}
 
-	if (alignment)
-		tmp = hole_start % alignment;
+/* Update subtree_max_hole for a node, based on the node and its children */
+static void drm_mm_hole_augment_cb(struct rb_node *rb, void *unused)
+{
+	struct drm_mm_node *node;
+	unsigned long max_hole, child_max_hole;
 
-	if (!tmp) {
-		hole_node->hole_follows = 0;
-		list_del_init(&hole_node->hole_stack);
-	} else
-		wasted = alignment - tmp;
+	if (!rb)
+		return;
 
-	node->start = hole_start + wasted;
-	node->size = size;
-	node->mm = mm;
-	node->allocated = 1;
+	node = DRM_MM_HOLE_ADDR(rb);
+	max_hole = node->hole_size;
 
-	INIT_LIST_HEAD(&node->hole_stack);
-	list_add(&node->node_list, &hole_node->node_list);
+	child_max_hole = drm_mm_subtree_max_hole(rb->rb_left);
+	if (child_max_hole > max_hole)
+		max_hole = child_max_hole;
 
-	BUG_ON(node->start + node->size > hole_end);
+	child_max_hole = drm_mm_subtree_max_hole(rb->rb_right);
+	if (child_max_hole > max_hole)
+		max_hole = child_max_hole;
 
-	if (node->start + node->size < hole_end) {
-		list_add(&node->hole_stack, &mm->hole_stack);
-		node->hole_follows = 1;
-	} else {
-		node->hole_follows = 0;
-	}
+	node->subtree_max_hole = max_hole;
 }
 
-struct drm_mm_node *drm_mm_get_block_generic(struct drm_mm_node *hole_node,
-					     unsigned long size,
-					     unsigned alignment,
-					     int atomic)
+static void drm_mm_add_hole(struct drm_mm_node *node)
 {
-	struct drm_mm_node *node;
-
-	node = drm_mm_kmalloc(hole_node->mm, atomic);
-	if (unlikely(node == NULL))
-		return NULL;
-
-	drm_mm_insert_helper(hole_node, node, size, alignment);
+	struct drm_mm *mm = node->mm;
+	unsigned long hole_start = drm_mm_hole_node_start(node);
+	struct rb_node **link, *parent;
+
+	node->hole_size = drm_mm_hole_node_end(node) - hole_start;
+	node->subtree_max_hole = node->hole_size;
+
+	parent = NULL;
+	link = &mm->holes_size.rb_node;
+	while (*link) {
+		parent = *link;
+		if (node->hole_size < DRM_MM_HOLE_SIZE(parent)->hole_size)
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&node->rb_hole_size, parent, link);
+	rb_insert_color(&node->rb_hole_size, &mm->holes_size);
+
+	parent = NULL;
+	link = &mm->holes_addr.rb_node;
+	while (*link) {
+		parent = *link;
+		if (hole_start < drm_mm_hole_node_start(DRM_MM_HOLE_ADDR(parent)))
+			link = &parent->rb_left;
+		else
+			link = &parent->rb_right;
+	}
+	rb_link_node(&node->rb_hole_addr, parent, link);
+	rb_insert_color(&node->rb_hole_addr, &mm->holes_addr);
+	rb_augment_insert(&node->rb_hole_addr, drm_mm_hole_augment_cb, NULL);
 
-	return node;
+	node->hole_follows = 1;
 }
-EXPORT_SYMBOL(drm_mm_get_block_generic);
 
-/**
- * Search for free space and insert a preallocated memory node. Returns
- * -ENOSPC if no suitable free area is available. The preallocated memory node
- * must be cleared.
- */
-int drm_mm_insert_node(struct drm_mm *mm, struct drm_mm_node *node,
-		       unsigned long size, unsigned alignment)
+static void drm_mm_rm_hole(struct drm_mm_node *node)
 {
-	struct drm_mm_node *hole_node;
+	struct drm_mm *mm = node->mm;
+	struct rb_node *deepest;
 
-	hole_node = drm_mm_search_free(mm, size, alignment, 0);
-	if (!hole_node)
-		return -ENOSPC;
+	BUG_ON(!node->hole_follows);
 
-	drm_mm_insert_helper(hole_node, node, size, alignment);
+	rb_erase(&node->rb_hole_size, &mm->holes_size);
 
-	return 0;
+	deepest = rb_augment_erase_begin(&node->rb_hole_addr);
+	rb_erase(&node->rb_hole_addr, &mm->holes_addr);
+	rb_augment_erase_end(deepest, drm_mm_hole_augment_cb, NULL);
+
+	node->hole_follows = 0;
+	node->hole_size = 0;
 }
-EXPORT_SYMBOL(drm_mm_insert_node);
 
 static void drm_mm_insert_helper_range(struct drm_mm_node *hole_node,
 				       struct drm_mm_node *node,
 				       unsigned long size, unsigned alignment,
-				       unsigned long start, unsigned long end)
+				       unsigned long start, unsigned long end,
+				       enum drm_mm_search_flags flags)
 {
 	struct drm_mm *mm = hole_node->mm;
-	unsigned long tmp = 0, wasted = 0;
 	unsigned long hole_start = drm_mm_hole_node_start(hole_node);
 	unsigned long hole_end = drm_mm_hole_node_end(hole_node);
+	unsigned long adj_start = hole_start;
+	unsigned long adj_end = hole_end;
+	unsigned long tmp;
 
 	BUG_ON(!hole_node->hole_follows || node->allocated);
 
-	if (hole_start < start)
-		wasted += start - hole_start;
-	if (alignment)
-		tmp = (hole_start + wasted) % alignment;
+	if (adj_start < start)
+		adj_start = start;
+	if (adj_end > end)
+		adj_end = end;
 
-	if (tmp)
-		wasted += alignment - tmp;
+	if (flags & DRM_MM_SEARCH_TOPDOWN)
+		adj_start = adj_end - size;
 
-	if (!wasted) {
-		hole_node->hole_follows = 0;
-		list_del_init(&hole_node->hole_stack);
+	if (alignment) {
+		tmp = adj_start % alignment;
+		if (tmp) {
+			if (flags & DRM_MM_SEARCH_TOPDOWN)
+				adj_start -= tmp;
+			else
+				adj_start += alignment - tmp;
+		}
 	}
 
-	node->start = hole_start + wasted;
+	drm_mm_rm_hole(hole_node);
+
+	node->start = adj_start;
 	node->size = size;
 	node->mm = mm;
 	node->allocated = 1;
+	node->hole_follows = 0;
 
-	INIT_LIST_HEAD(&node->hole_stack);
 	list_add(&node->node_list, &hole_node->node_list);
 
-	BUG_ON(node->start + node->size > hole_end);
-	BUG_ON(node->start + node->size > end);
+	BUG_ON(node->start < hole_start);
+	BUG_ON(node->start + node->size > adj_end);
 
-	if (node->start + node->size < hole_end) {
-		list_add(&node->hole_stack, &mm->hole_stack);
-		node->hole_follows = 1;
-	} else {
-		node->hole_follows = 0;
-	}
+	if (node->start > hole_start)
+		drm_mm_add_hole(hole_node);
+	if (node->start + node->size < hole_end)
+		drm_mm_add_hole(node);
+}
+
+struct drm_mm_node *drm_mm_get_block_generic(struct drm_mm_node *hole_node,
+					     unsigned long size,
+					     unsigned alignment,
+					     int atomic)
+{
+	struct drm_mm_node *node;
+
+	node = drm_mm_kmalloc(hole_node->mm, atomic);
+	if (unlikely(node == NULL))
+		return NULL;
+
+	drm_mm_insert_helper_range(hole_node, node, size, alignment,
+				   0, ~0UL, DRM_MM_SEARCH_DEFAULT);
+
+	return node;
 }
+EXPORT_SYMBOL(drm_mm_get_block_generic);
 
 struct drm_mm_node *drm_mm_get_block_range_generic(struct drm_mm_node *hole_node,
 						unsigned long size,
@@ -248,41 +289,41 @@ struct drm_mm_node *drm_mm_get_block_range_generic(struct drm_mm_node *hole_node
 		return NULL;
 
 	drm_mm_insert_helper_range(hole_node, node, size, alignment,
-				   start, end);
+				   start, end, DRM_MM_SEARCH_DEFAULT);
 
 	return node;
 }
 EXPORT_SYMBOL(drm_mm_get_block_range_generic);
 
 /**
- * Search for free space and insert a preallocated memory node. Returns
- * -ENOSPC if no suitable free area is available. This is for range
- * restricted allocations. The preallocated memory node must be cleared.
+ * Search for free space within [start, end) and insert a preallocated memory
+ * node, placed according to @flags. Returns -ENOSPC if no suitable free area
+ * is available. The preallocated memory node must be cleared.
  */
-int drm_mm_insert_node_in_range(struct drm_mm *mm, struct drm_mm_node *node,
-				unsigned long size, unsigned alignment,
-				unsigned long start, unsigned long end)
+int drm_mm_insert_node_generic(struct drm_mm *mm, struct drm_mm_node *node,
+			       unsigned long size, unsigned alignment,
+			       unsigned long start, unsigned long end,
+			       enum drm_mm_search_flags flags)
 {
 	struct drm_mm_node *hole_node;
 
-	hole_node = drm_mm_search_free_in_range(mm, size, alignment,
-						start, end, 0);
+	hole_node = drm_mm_search_free_generic(mm, size, alignment,
+					       start, end, flags);
 	if (!hole_node)
 		return -ENOSPC;
 
 	drm_mm_insert_helper_range(hole_node, node, size, alignment,
-				   start, end);
+				   start, end, flags);
 
 	return 0;
 }
-EXPORT_SYMBOL(drm_mm_insert_node_in_range);
+EXPORT_SYMBOL(drm_mm_insert_node_generic);
 
 /**
  * Remove a memory node from the allocator.
  */
 void drm_mm_remove_node(struct drm_mm_node *node)
 {
-	struct drm_mm *mm = node->mm;
 	struct drm_mm_node *prev_node;
 
 	BUG_ON(node->scanned_block || node->scanned_prev_free
@@ -294,19 +335,18 @@ void drm_mm_remove_node(struct drm_mm_node *node)
 	if (node->hole_follows) {
 		BUG_ON(drm_mm_hole_node_start(node)
 				== drm_mm_hole_node_end(node));
-		list_del(&node->hole_stack);
+		drm_mm_rm_hole(node);
 	} else
 		BUG_ON(drm_mm_hole_node_start(node)
 				!= drm_mm_hole_node_end(node));
 
-	if (!prev_node->hole_follows) {
-		prev_node->hole_follows = 1;
-		list_add(&prev_node->hole_stack, &mm->hole_stack);
-	} else
-		list_move(&prev_node->hole_stack, &mm->hole_stack);
+	if (prev_node->hole_follows)
+		drm_mm_rm_hole(prev_node);
 
 	list_del(&node->node_list);
 	node->allocated = 0;
+
+	drm_mm_add_hole(prev_node);
 }
 EXPORT_SYMBOL(drm_mm_remove_node);
 
@@ -353,90 +393,190 @@ static int check_free_hole(unsigned long start, unsigned long end,
 	return 0;
 }
 
-struct drm_mm_node *drm_mm_search_free(const struct drm_mm *mm,
-				       unsigned long size,
-				       unsigned alignment, int best_match)
+/*
+ * Check whether the part of the hole after @entry that lies within
+ * [start, end) can hold an aligned block of @size.  If a block fits at the
+ * bottom of that range it also fits at the top, so this is the right check
+ * for both search directions.
+ */
+static int check_free_hole_in_range(struct drm_mm_node *entry,
+				    unsigned long size, unsigned alignment,
+				    unsigned long start, unsigned long end)
 {
-	struct drm_mm_node *entry;
-	struct drm_mm_node *best;
-	unsigned long best_size;
+	unsigned long adj_start = drm_mm_hole_node_start(entry);
+	unsigned long adj_end = drm_mm_hole_node_end(entry);
 
-	BUG_ON(mm->scanned_blocks);
+	if (adj_start < start)
+		adj_start = start;
+	if (adj_end > end)
+		adj_end = end;
 
-	best = NULL;
-	best_size = ~0UL;
+	if (adj_end <= adj_start)
+		return 0;
 
-	list_for_each_entry(entry, &mm->hole_stack, hole_stack) {
-		BUG_ON(!entry->hole_follows);
-		if (!check_free_hole(drm_mm_hole_node_start(entry),
-				     drm_mm_hole_node_end(entry),
-				     size, alignment))
-			continue;
+	return check_free_hole(adj_start, adj_end, size, alignment);
+}
 
-		if (!best_match)
-			return entry;
+/*
+ * Return the lowest (highest if @topdown) addressed hole of at least @size
+ * bytes in the subtree rooted at @rb.
+ */
+static struct drm_mm_node *drm_mm_first_hole(struct rb_node *rb,
+					     unsigned long size, bool topdown)
+{
+	struct rb_node *first, *second;
+
+	while (rb) {
+		first = topdown ? rb->rb_right : rb->rb_left;
+		second = topdown ? rb->rb_left : rb->rb_right;
+
+		if (drm_mm_subtree_max_hole(first) >= size)
+			rb = first;
+		else if (DRM_MM_HOLE_ADDR(rb)->hole_size >= size)
+			return DRM_MM_HOLE_ADDR(rb);
+		else if (drm_mm_subtree_max_hole(second) >= size)
+			rb = second;
+		else
+			break;
+	}
 
-		if (entry->size < best_size) {
-			best = entry;
-			best_size = entry->size;
+	return NULL;
+}
+
+/*
+ * Return the next hole of at least @size bytes after @entry in address order
+ * (before @entry if @topdown).
+ */
+static struct drm_mm_node *drm_mm_next_hole(struct drm_mm_node *entry,
+					    unsigned long size, bool topdown)
+{
+	struct rb_node *rb = &entry->rb_hole_addr;
+	struct rb_node *parent;
+
+	entry = drm_mm_first_hole(topdown ? rb->rb_left : rb->rb_right,
+				  size, topdown);
+	if (entry)
+		return entry;
+
+	while ((parent = rb_parent(rb)) != NULL) {
+		if (rb == (topdown ? parent->rb_right : parent->rb_left)) {
+			if (DRM_MM_HOLE_ADDR(parent)->hole_size >= size)
+				return DRM_MM_HOLE_ADDR(parent);
+
+			entry = drm_mm_first_hole(topdown ? parent->rb_left :
+							    parent->rb_right,
+						  size, topdown);
+			if (entry)
+				return entry;
 		}
+		rb = parent;
 	}
 
-	return best;
+	return NULL;
 }
-EXPORT_SYMBOL(drm_mm_search_free);
 
-struct drm_mm_node *drm_mm_search_free_in_range(const struct drm_mm *mm,
-						unsigned long size,
-						unsigned alignment,
-						unsigned long start,
-						unsigned long end,
-						int best_match)
+static struct drm_mm_node *drm_mm_search_hole_addr(const struct drm_mm *mm,
+						   unsigned long size,
+						   unsigned alignment,
+						   unsigned long start,
+						   unsigned long end,
+						   bool topdown)
 {
 	struct drm_mm_node *entry;
-	struct drm_mm_node *best;
-	unsigned long best_size;
 
-	BUG_ON(mm->scanned_blocks);
+	for (entry = drm_mm_first_hole(mm->holes_addr.rb_node, size, topdown);
+	     entry; entry = drm_mm_next_hole(entry, size, topdown)) {
+		BUG_ON(!entry->hole_follows);
 
-	best = NULL;
-	best_size = ~0UL;
+		/* everything further on lies outside the range */
+		if (topdown ? drm_mm_hole_node_end(entry) <= start :
+			      drm_mm_hole_node_start(entry) >= end)
+			break;
 
-	list_for_each_entry(entry, &mm->hole_stack, hole_stack) {
-		unsigned long adj_start = drm_mm_hole_node_start(entry) < start ?
-			start : drm_mm_hole_node_start(entry);
-		unsigned long adj_end = drm_mm_hole_node_end(entry) > end ?
-			end : drm_mm_hole_node_end(entry);
+		if (check_free_hole_in_range(entry, size, alignment,
+					     start, end))
+			return entry;
+	}
 
+	return NULL;
+}
+
+static struct drm_mm_node *drm_mm_search_hole_size(const struct drm_mm *mm,
+						   unsigned long size,
+						   unsigned alignment,
+						   unsigned long start,
+						   unsigned long end)
+{
+	struct rb_node *rb = mm->holes_size.rb_node;
+	struct drm_mm_node *entry = NULL;
+
+	/* find the smallest hole of at least @size bytes ... */
+	while (rb) {
+		if (DRM_MM_HOLE_SIZE(rb)->hole_size >= size) {
+			entry = DRM_MM_HOLE_SIZE(rb);
+			rb = rb->rb_left;
+		} else
+			rb = rb->rb_right;
+	}
+
+	/* ... and walk up from there until alignment and range fit, too */
+	for (rb = entry ? &entry->rb_hole_size : NULL; rb; rb = rb_next(rb)) {
+		entry = DRM_MM_HOLE_SIZE(rb);
 		BUG_ON(!entry->hole_follows);
-		if (!check_free_hole(adj_start, adj_end, size, alignment))
-			continue;
 
-		if (!best_match)
+		if (check_free_hole_in_range(entry, size, alignment,
+					     start, end))
 			return entry;
-
-		if (entry->size < best_size) {
-			best = entry;
-			best_size = entry->size;
-		}
 	}
 
-	return best;
+	return NULL;
 }
-EXPORT_SYMBOL(drm_mm_search_free_in_range);
+
+/**
+ * Search for a hole that can hold an aligned block of @size within
+ * [start, end). With DRM_MM_SEARCH_BEST the smallest such hole is returned,
+ * otherwise the lowest one (the highest one with DRM_MM_SEARCH_TOPDOWN).
+ */
+struct drm_mm_node *drm_mm_search_free_generic(const struct drm_mm *mm,
+					       unsigned long size,
+					       unsigned alignment,
+					       unsigned long start,
+					       unsigned long end,
+					       enum drm_mm_search_flags flags)
+{
+	BUG_ON(mm->scanned_blocks);
+
+	if (flags & DRM_MM_SEARCH_BEST)
+		return drm_mm_search_hole_size(mm, size, alignment,
+					       start, end);
+
+	return drm_mm_search_hole_addr(mm, size, alignment, start, end,
+				       flags & DRM_MM_SEARCH_TOPDOWN);
+}
+EXPORT_SYMBOL(drm_mm_search_free_generic);
 
 /**
  * Moves an allocation. To be used with embedded struct drm_mm_node.
  */
 void drm_mm_replace_node(struct drm_mm_node *old, struct drm_mm_node *new)
 {
+	struct drm_mm *mm = old->mm;
+
 	list_replace(&old->node_list, &new->node_list);
-	list_replace(&old->hole_stack, &new->hole_stack);
 	new->hole_follows = old->hole_follows;
+	if (old->hole_follows) {
+		rb_replace_node(&old->rb_hole_size, &new->rb_hole_size,
+				&mm->holes_size);
+		rb_replace_node(&old->rb_hole_addr, &new->rb_hole_addr,
+				&mm->holes_addr);
+		new->hole_size = old->hole_size;
+		new->subtree_max_hole = old->subtree_max_hole;
+	}
 	new->mm = old->mm;
 	new->start = old->start;
 	new->size = old->size;
 
+	old->hole_follows = 0;
 	old->allocated = 0;
 	new->allocated = 1;
 }
@@ -458,7 +598,7 @@ void drm_mm_init_scan(struct drm_mm *mm, unsigned long size,
 	mm->scan_size = size;
 	mm->scanned_blocks = 0;
 	mm->scan_hit_start = 0;
-	mm->scan_hit_size = 0;
+	mm->scan_hit_end = 0;
 	mm->scan_check_range = 0;
 	mm->prev_scanned_node = NULL;
 }
@@ -482,7 +622,7 @@ void drm_mm_init_scan_with_range(struct drm_mm *mm, unsigned long size,
 	mm->scan_size = size;
 	mm->scanned_blocks = 0;
 	mm->scan_hit_start = 0;
-	mm->scan_hit_size = 0;
+	mm->scan_hit_end = 0;
 	mm->scan_start = start;
 	mm->scan_end = end;
 	mm->scan_check_range = 1;
@@ -534,7 +674,7 @@ int drm_mm_scan_add_block(struct drm_mm_node *node)
 	if (check_free_hole(adj_start , adj_end,
 			    mm->scan_size, mm->scan_alignment)) {
 		mm->scan_hit_start = hole_start;
-		mm->scan_hit_size = hole_end;
+		mm->scan_hit_end = hole_end;
 
 		return 1;
 	}
@@ -551,8 +691,8 @@ EXPORT_SYMBOL(drm_mm_scan_add_block);
  * corrupted.
  *
  * When the scan list is empty, the selected memory nodes can be freed. An
- * immediately following drm_mm_search_free with best_match = 0 will then return
- * the just freed block (because its at the top of the free_stack list).
+ * immediately following drm_mm_search_free will then find the just freed block
+ * (or another hole that is at least as suitable).
  *
  * Returns one if this block should be evicted, zero otherwise. Will always
  * return zero when no hole has been found.
@@ -574,12 +714,11 @@ int drm_mm_scan_remove_block(struct drm_mm_node *node)
 	INIT_LIST_HEAD(&node->node_list);
 	list_add(&node->node_list, &prev_node->node_list);
 
-	/* Only need to check for containement because start&size for the
+	/* Only need to check for containement because start&end for the
 	 * complete resulting free block (not just the desired part) is
 	 * stored. */
 	if (node->start >= mm->scan_hit_start &&
-	    node->start + node->size
-	    		<= mm->scan_hit_start + mm->scan_hit_size) {
+	    node->start + node->size <= mm->scan_hit_end) {
 		return 1;
 	}
 
@@ -597,7 +736,8 @@ EXPORT_SYMBOL(drm_mm_clean);
 
 int drm_mm_init(struct drm_mm * mm, unsigned long start, unsigned long size)
 {
-	INIT_LIST_HEAD(&mm->hole_stack);
+	mm->holes_size = RB_ROOT;
+	mm->holes_addr = RB_ROOT;
 	INIT_LIST_HEAD(&mm->unused_nodes);
 	mm->num_unused = 0;
 	mm->scanned_blocks = 0;
@@ -605,15 +745,14 @@ int drm_mm_init(struct drm_mm * mm, unsigned long start, unsigned long size)
 
 	/* Clever trick to avoid a special case in the free hole tracking. */
 	INIT_LIST_HEAD(&mm->head_node.node_list);
-	INIT_LIST_HEAD(&mm->head_node.hole_stack);
-	mm->head_node.hole_follows = 1;
+	mm->head_node.hole_follows = 0;
 	mm->head_node.scanned_block = 0;
 	mm->head_node.scanned_prev_free = 0;
 	mm->head_node.scanned_next_free = 0;
 	mm->head_node.mm = mm;
 	mm->head_node.start = start + size;
 	mm->head_node.size = start - mm->head_node.start;
-	list_add_tail(&mm->head_node.hole_stack, &mm->hole_stack);
+	drm_mm_add_hole(&mm->head_node);
 
 	return 0;
 }
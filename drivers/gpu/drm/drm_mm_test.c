@@ -0,0 +1,448 @@
+/*
+ * Runtime test of the drm_mm hole search
+ *
+ * Fragments a drm_mm with random allocations and frees, then checks every
+ * search mode, and the placement done by the insert path, against a plain
+ * walk of all holes in address order.  The walk is what drm_mm_search_free()
+ * did before the holes were indexed by rbtrees, except that it returns the
+ * lowest suitable hole rather than the most recently freed one.
+ *
+ * The eviction scan is checked the same way: nodes are added to the scan in
+ * random order, and the node at which the scan stops and the nodes it selects
+ * for eviction are compared with freeing the same nodes one by one by hand.
+ *
+ * The result is reported in the kernel log.  Loading the module fails if
+ * any check failed; the seed module parameter reproduces a run.
+ */
+
+#define pr_fmt(fmt) "drm_mm_test: " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include "drm_mm.h"
+
+#define TEST_NODES	4096
+#define TEST_MAX_SIZE	64
+#define TEST_MM_SIZE	(TEST_NODES * TEST_MAX_SIZE * 2)
+#define TEST_SEARCHES	8192
+#define TEST_EVICTIONS	1024
+
+static unsigned long seed = 42;
+module_param(seed, ulong, 0444);
+MODULE_PARM_DESC(seed, "random seed for the layout and the requests");
+
+static struct rnd_state rnd __initdata;
+static unsigned int failures __initdata;
+
+#define test_fail(fmt, ...)						\
+do {									\
+	if (failures++ < 10)						\
+		pr_err(fmt "\n", ##__VA_ARGS__);			\
+} while (0)
+
+static unsigned long __init test_rand(unsigned long max)
+{
+	return prandom32(&rnd) % max;
+}
+
+static unsigned long __init test_hole_start(struct drm_mm_node *node)
+{
+	return node->start + node->size;
+}
+
+static unsigned long __init test_hole_end(struct drm_mm_node *node)
+{
+	return list_entry(node->node_list.next, struct drm_mm_node,
+			  node_list)->start;
+}
+
+/*
+ * Return the lowest address an aligned block of @size can start at in the
+ * hole [hole_start, hole_end), clipped to [start, end), or ~0UL if it doesn't
+ * fit.  With @topdown the highest such address is returned.
+ */
+static unsigned long __init test_range_fit(unsigned long hole_start,
+					   unsigned long hole_end,
+					   unsigned long size,
+					   unsigned alignment,
+					   unsigned long start,
+					   unsigned long end, bool topdown)
+{
+	unsigned long adj_start = max(hole_start, start);
+	unsigned long adj_end = min(hole_end, end);
+	unsigned long addr;
+
+	if (adj_end <= adj_start || adj_end - adj_start < size)
+		return ~0UL;
+
+	if (topdown) {
+		addr = adj_end - size;
+		if (alignment)
+			addr -= addr % alignment;
+		return addr >= adj_start ? addr : ~0UL;
+	}
+
+	addr = adj_start;
+	if (alignment && addr % alignment)
+		addr += alignment - addr % alignment;
+	return addr + size <= adj_end ? addr : ~0UL;
+}
+
+/* The same for the hole after @node. */
+static unsigned long __init test_hole_fit(struct drm_mm_node *node,
+					  unsigned long size,
+					  unsigned alignment,
+					  unsigned long start,
+					  unsigned long end, bool topdown)
+{
+	return test_range_fit(test_hole_start(node), test_hole_end(node),
+			      size, alignment, start, end, topdown);
+}
+
+/* Check hole_follows of all nodes. */
+static void __init test_check_holes(struct drm_mm *mm)
+{
+	struct drm_mm_node *node = &mm->head_node;
+
+	do {
+		if (node->hole_follows !=
+		    (test_hole_start(node) < test_hole_end(node)))
+			test_fail("hole_follows %d for hole [%lx, %lx)",
+				  node->hole_follows, test_hole_start(node),
+				  test_hole_end(node));
+
+		node = list_entry(node->node_list.next, struct drm_mm_node,
+				  node_list);
+	} while (node != &mm->head_node);
+}
+
+/* Walk all holes in address order. */
+static struct drm_mm_node * __init test_search_walk(struct drm_mm *mm,
+						    unsigned long size,
+						    unsigned alignment,
+						    unsigned long start,
+						    unsigned long end,
+						    enum drm_mm_search_flags flags)
+{
+	struct drm_mm_node *node = &mm->head_node;
+	struct drm_mm_node *found = NULL;
+
+	do {
+		if (node->hole_follows &&
+		    test_hole_fit(node, size, alignment, start, end,
+				  false) != ~0UL) {
+			if (flags & DRM_MM_SEARCH_BEST) {
+				if (!found || node->hole_size < found->hole_size)
+					found = node;
+			} else if (flags & DRM_MM_SEARCH_TOPDOWN)
+				found = node;
+			else
+				return node;
+		}
+
+		node = list_entry(node->node_list.next, struct drm_mm_node,
+				  node_list);
+	} while (node != &mm->head_node);
+
+	return found;
+}
+
+static void __init test_search(struct drm_mm *mm, unsigned long size,
+			       unsigned alignment, unsigned long start,
+			       unsigned long end, enum drm_mm_search_flags flags)
+{
+	struct drm_mm_node *expected, *found;
+	struct drm_mm_node node;
+	unsigned long addr;
+	bool match;
+	int ret;
+
+	test_check_holes(mm);
+	expected = test_search_walk(mm, size, alignment, start, end, flags);
+	found = drm_mm_search_free_generic(mm, size, alignment, start, end,
+					   flags);
+
+	/* best fit may pick any of several holes of the same size */
+	if (!found || !expected)
+		match = found == expected;
+	else if (flags & DRM_MM_SEARCH_BEST)
+		match = found->hole_size == expected->hole_size;
+	else
+		match = found == expected;
+	if (!match) {
+		test_fail("flags %d size %lu align %u range [%lx, %lx): "
+			  "found hole at %lx, expected %lx", flags, size,
+			  alignment, start, end,
+			  found ? test_hole_start(found) : ~0UL,
+			  expected ? test_hole_start(expected) : ~0UL);
+		return;
+	}
+
+	/* check where the insert path places a node in that hole */
+	memset(&node, 0, sizeof(node));
+	ret = drm_mm_insert_node_generic(mm, &node, size, alignment,
+					 start, end, flags);
+	if (ret != (found ? 0 : -ENOSPC)) {
+		test_fail("flags %d size %lu align %u range [%lx, %lx): "
+			  "insert returned %d", flags, size, alignment,
+			  start, end, ret);
+		if (!ret)
+			drm_mm_remove_node(&node);
+		return;
+	}
+	if (ret)
+		return;
+
+	/* removing the node restores the hole it was placed in */
+	drm_mm_remove_node(&node);
+	if (flags & DRM_MM_SEARCH_BEST)
+		return;
+
+	addr = test_hole_fit(found, size, alignment, start, end,
+			     flags & DRM_MM_SEARCH_TOPDOWN);
+	if (node.start != addr)
+		test_fail("flags %d size %lu align %u range [%lx, %lx): "
+			  "node placed at %lx, expected %lx", flags, size,
+			  alignment, start, end, node.start, addr);
+}
+
+/*
+ * Find the hole @node ends up in if the nodes marked in @freed are removed,
+ * without removing anything.
+ */
+static void __init test_evict_hole(struct drm_mm *mm, struct drm_mm_node *nodes,
+				   const bool *freed, struct drm_mm_node *node,
+				   unsigned long *hole_start,
+				   unsigned long *hole_end)
+{
+	struct drm_mm_node *prev = node, *next = node;
+
+	do {
+		prev = list_entry(prev->node_list.prev, struct drm_mm_node,
+				  node_list);
+	} while (prev != &mm->head_node && freed[prev - nodes]);
+	do {
+		next = list_entry(next->node_list.next, struct drm_mm_node,
+				  node_list);
+	} while (next != &mm->head_node && freed[next - nodes]);
+
+	*hole_start = test_hole_start(prev);
+	*hole_end = next->start;
+}
+
+/*
+ * Run an eviction scan over the allocated nodes in random order and check it
+ * against freeing the same nodes one by one: the scan has to stop at the
+ * first node whose removal opens a suitable hole, and select exactly the
+ * scanned nodes in that hole for eviction.  The selected nodes are then
+ * evicted, the requested node has to fit, and the evicted nodes are inserted
+ * again wherever they fit.
+ */
+static void __init test_evict(struct drm_mm *mm, struct drm_mm_node *nodes,
+			      struct drm_mm_node **lru, bool *freed,
+			      unsigned long size, unsigned alignment,
+			      unsigned long start, unsigned long end, bool range)
+{
+	unsigned long hole_start, hole_end, hit_start = 0, hit_end = 0;
+	struct drm_mm_node *node;
+	int i, j, count = 0, expected = -1, found = -1, scanned;
+	bool evict, in_hit;
+	int ret;
+
+	for (i = 0; i < TEST_NODES; i++)
+		if (drm_mm_node_allocated(&nodes[i]))
+			lru[count++] = &nodes[i];
+	for (i = count - 1; i > 0; i--) {
+		j = test_rand(i + 1);
+		swap(lru[i], lru[j]);
+	}
+
+	memset(freed, 0, TEST_NODES * sizeof(*freed));
+	for (i = 0; i < count; i++) {
+		freed[lru[i] - nodes] = true;
+		test_evict_hole(mm, nodes, freed, lru[i],
+				&hole_start, &hole_end);
+		if (test_range_fit(hole_start, hole_end, size, alignment,
+				   start, end, false) != ~0UL) {
+			expected = i;
+			hit_start = hole_start;
+			hit_end = hole_end;
+			break;
+		}
+	}
+
+	if (range)
+		drm_mm_init_scan_with_range(mm, size, alignment, start, end);
+	else
+		drm_mm_init_scan(mm, size, alignment);
+	for (i = 0; i < count; i++)
+		if (drm_mm_scan_add_block(lru[i])) {
+			found = i;
+			break;
+		}
+	scanned = found < 0 ? count : found + 1;
+
+	if (found != expected)
+		test_fail("evict size %lu align %u range [%lx, %lx): "
+			  "scan stopped after %d nodes, expected %d", size,
+			  alignment, start, end, found + 1, expected + 1);
+
+	/* unwind in reverse order */
+	memset(freed, 0, TEST_NODES * sizeof(*freed));
+	for (i = scanned - 1; i >= 0; i--) {
+		node = lru[i];
+		evict = drm_mm_scan_remove_block(node);
+		in_hit = found >= 0 && found == expected &&
+			 node->start >= hit_start &&
+			 node->start + node->size <= hit_end;
+		if (found == expected && evict != in_hit)
+			test_fail("evict size %lu align %u range [%lx, %lx): "
+				  "node [%lx, %lx) %s, hole [%lx, %lx)", size,
+				  alignment, start, end, node->start,
+				  node->start + node->size,
+				  evict ? "evicted" : "kept", hit_start,
+				  hit_end);
+		freed[node - nodes] = evict;
+	}
+	test_check_holes(mm);
+	if (found < 0)
+		return;
+
+	for (i = 0; i < scanned; i++)
+		if (freed[lru[i] - nodes])
+			drm_mm_remove_node(lru[i]);
+
+	node = kzalloc(sizeof(*node), GFP_KERNEL);
+	if (!node)
+		return;
+	ret = drm_mm_insert_node_generic(mm, node, size, alignment, start, end,
+					 DRM_MM_SEARCH_DEFAULT);
+	if (ret)
+		test_fail("evict size %lu align %u range [%lx, %lx): "
+			  "insert after eviction returned %d", size,
+			  alignment, start, end, ret);
+	else
+		drm_mm_remove_node(node);
+	kfree(node);
+
+	for (i = 0; i < scanned; i++) {
+		node = lru[i];
+		if (!freed[node - nodes])
+			continue;
+		size = node->size;
+		memset(node, 0, sizeof(*node));
+		if (drm_mm_insert_node(mm, node, size, 0))
+			test_fail("evict: reinsert of node %d failed",
+				  (int)(node - nodes));
+	}
+}
+
+static int __init test_drm_mm_init(void)
+{
+	static const enum drm_mm_search_flags modes[] __initconst = {
+		DRM_MM_SEARCH_DEFAULT,
+		DRM_MM_SEARCH_BEST,
+		DRM_MM_SEARCH_TOPDOWN,
+	};
+	struct drm_mm_node *nodes, **lru;
+	struct drm_mm mm;
+	unsigned long size, start, end;
+	unsigned alignment;
+	bool *freed;
+	int i, j;
+
+	nodes = kcalloc(TEST_NODES, sizeof(*nodes), GFP_KERNEL);
+	lru = kcalloc(TEST_NODES, sizeof(*lru), GFP_KERNEL);
+	freed = kcalloc(TEST_NODES, sizeof(*freed), GFP_KERNEL);
+	if (!nodes || !lru || !freed) {
+		kfree(freed);
+		kfree(lru);
+		kfree(nodes);
+		return -ENOMEM;
+	}
+
+	prandom32_seed(&rnd, seed);
+	drm_mm_init(&mm, 0, TEST_MM_SIZE);
+
+	/* fill the space and free about half of it again */
+	for (i = 0; i < TEST_NODES; i++) {
+		size = test_rand(TEST_MAX_SIZE) + 1;
+		alignment = test_rand(4) ? 0 : 1 << test_rand(6);
+		if (drm_mm_insert_node(&mm, &nodes[i], size, alignment))
+			test_fail("setup: insert of node %d failed", i);
+	}
+	for (i = 0; i < TEST_NODES; i++)
+		if (test_rand(2) && drm_mm_node_allocated(&nodes[i]))
+			drm_mm_remove_node(&nodes[i]);
+
+	for (i = 0; i < TEST_SEARCHES; i++) {
+		size = test_rand(4 * TEST_MAX_SIZE) + 1;
+		switch (test_rand(4)) {
+		case 0:
+			alignment = 0;
+			break;
+		case 1:
+			alignment = 1 << test_rand(8);
+			break;
+		default:
+			alignment = test_rand(3 * TEST_MAX_SIZE) + 1;
+			break;
+		}
+		if (test_rand(2)) {
+			start = 0;
+			end = ~0UL;
+		} else {
+			start = test_rand(TEST_MM_SIZE);
+			end = start + test_rand(TEST_MM_SIZE - start) + 1;
+		}
+
+		for (j = 0; j < ARRAY_SIZE(modes); j++)
+			test_search(&mm, size, alignment, start, end, modes[j]);
+	}
+
+	for (i = 0; i < TEST_EVICTIONS; i++) {
+		size = test_rand(8 * TEST_MAX_SIZE) + 1;
+		alignment = test_rand(2) ? 0 : 1 << test_rand(8);
+		if (test_rand(2)) {
+			test_evict(&mm, nodes, lru, freed, size, alignment,
+				   0, ~0UL, false);
+		} else {
+			/* tight enough that the scan fails now and then */
+			start = test_rand(TEST_MM_SIZE);
+			end = min(start + test_rand(2 * size) + 1,
+				  (unsigned long)TEST_MM_SIZE);
+			test_evict(&mm, nodes, lru, freed, size, alignment,
+				   start, end, true);
+		}
+	}
+
+	for (i = 0; i < TEST_NODES; i++)
+		if (drm_mm_node_allocated(&nodes[i]))
+			drm_mm_remove_node(&nodes[i]);
+	if (!drm_mm_clean(&mm))
+		test_fail("nodes left after removing all of them");
+	drm_mm_takedown(&mm);
+	kfree(freed);
+	kfree(lru);
+	kfree(nodes);
+
+	if (failures) {
+		pr_err("%u checks failed, seed %lu\n", failures, seed);
+		return -EINVAL;
+	}
+
+	pr_info("all checks passed, seed %lu\n", seed);
+	return 0;
+}
+module_init(test_drm_mm_init);
+
+static void __exit test_drm_mm_exit(void)
+{
+}
+module_exit(test_drm_mm_exit);
+
+MODULE_DESCRIPTION("drm_mm hole search test");
+MODULE_LICENSE("GPL and additional rights");
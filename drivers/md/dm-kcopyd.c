@@ -22,15 +22,39 @@
 #include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 #include <linux/mutex.h>
+#include <linux/delay.h>
 #include <linux/device-mapper.h>
 #include <linux/dm-kcopyd.h>
 
 #include "dm.h"
 
-#define SUB_JOB_SIZE	128
+#define DEFAULT_SUB_JOB_SIZE_KB	512
+#define MAX_SUB_JOB_SIZE_KB	1024
 #define SPLIT_COUNT	8
 #define MIN_JOBS	8
-#define RESERVE_PAGES	(DIV_ROUND_UP(SUB_JOB_SIZE << SECTOR_SHIFT, PAGE_SIZE))
+
+/*
+ * Large copies are split into SPLIT_COUNT concurrent sub jobs of this
+ * size.  Bigger sub jobs mean fewer, larger ios for resync and merge.
+ */
+static unsigned kcopyd_subjob_size_kb = DEFAULT_SUB_JOB_SIZE_KB;
+module_param(kcopyd_subjob_size_kb, uint, 0644);
+MODULE_PARM_DESC(kcopyd_subjob_size_kb, "Sub-job size for dm-kcopyd clients");
+
+/*
+ * Returns the sub job size in sectors, rounded down to whole pages.  It
+ * is sampled once when a client is created.
+ */
+static unsigned get_sub_job_size(void)
+{
+	unsigned page_kb = PAGE_SIZE >> 10;
+	unsigned kb = ACCESS_ONCE(kcopyd_subjob_size_kb);
+
+	kb = clamp_t(unsigned, kb, page_kb, MAX_SUB_JOB_SIZE_KB);
+	kb -= kb % page_kb;
+
+	return kb << 1;
+}
 
 /*-----------------------------------------------------------------
  * Each kcopyd client has its own little pool of preallocated
@@ -43,6 +67,10 @@ struct dm_kcopyd_client {
 
 	struct dm_io_client *io_client;
 
+	unsigned sub_job_size;	/* In sectors */
+	struct dm_kcopyd_throttle *throttle;
+	atomic64_t nr_copied;	/* In sectors */
+
 	wait_queue_head_t destroyq;
 	atomic_t nr_jobs;
 
@@ -71,6 +99,89 @@ static void wake(struct dm_kcopyd_client *kc)
 	queue_work(kc->kcopyd_wq, &kc->kcopyd_work);
 }
 
+/*-----------------------------------------------------------------
+ * Throttling.
+ *
+ * We track how much of the time a throttle group has io in flight
+ * (io_period) against wall time (total_period), both decaying so only
+ * roughly the last second counts.  Before issuing io we sleep while
+ * the busy fraction is above the limit, but never more than
+ * MAX_SLEEPS times so a copy always makes progress.
+ *---------------------------------------------------------------*/
+static DEFINE_SPINLOCK(throttle_spinlock);
+
+#define ACCOUNT_INTERVAL_SHIFT	SHIFT_HZ
+#define SLEEP_MSEC		100
+#define MAX_SLEEPS		10
+
+static void __account_period(struct dm_kcopyd_throttle *t)
+{
+	unsigned now = jiffies;
+	unsigned difference = now - t->last_jiffies;
+
+	t->last_jiffies = now;
+	if (t->num_io_jobs)
+		t->io_period += difference;
+	t->total_period += difference;
+
+	/*
+	 * Keep sane values after a wrap.
+	 */
+	if (unlikely(t->io_period > t->total_period))
+		t->io_period = t->total_period;
+
+	if (unlikely(t->total_period >= (1 << ACCOUNT_INTERVAL_SHIFT))) {
+		int shift = fls(t->total_period >> ACCOUNT_INTERVAL_SHIFT);
+
+		t->total_period >>= shift;
+		t->io_period >>= shift;
+	}
+}
+
+static void io_job_start(struct dm_kcopyd_throttle *t)
+{
+	unsigned throttle;
+	int slept = 0, skew;
+
+	if (!t)
+		return;
+
+try_again:
+	spin_lock_irq(&throttle_spinlock);
+
+	throttle = ACCESS_ONCE(t->throttle);
+	if (likely(throttle >= 100))
+		goto skip_limit;
+
+	__account_period(t);
+
+	skew = t->io_period - throttle * t->total_period / 100;
+	if (unlikely(skew > 0) && slept < MAX_SLEEPS) {
+		slept++;
+		spin_unlock_irq(&throttle_spinlock);
+		msleep(SLEEP_MSEC);
+		goto try_again;
+	}
+
+skip_limit:
+	t->num_io_jobs++;
+	spin_unlock_irq(&throttle_spinlock);
+}
+
+static void io_job_finish(struct dm_kcopyd_throttle *t)
+{
+	unsigned long flags;
+
+	if (!t)
+		return;
+
+	spin_lock_irqsave(&throttle_spinlock, flags);
+	if (ACCESS_ONCE(t->throttle) < 100)
+		__account_period(t);
+	t->num_io_jobs--;
+	spin_unlock_irqrestore(&throttle_spinlock, flags);
+}
+
 /*
  * Obtain one page for the use of kcopyd.
  */
@@ -345,6 +456,8 @@ static void complete_io(unsigned long error, void *context)
 	struct kcopyd_job *job = (struct kcopyd_job *) context;
 	struct dm_kcopyd_client *kc = job->kc;
 
+	io_job_finish(kc->throttle);
+
 	if (error) {
 		if (job->rw == WRITE)
 			job->write_err |= error;
@@ -358,10 +471,12 @@ static void complete_io(unsigned long error, void *context)
 		}
 	}
 
-	if (job->rw == WRITE)
+	if (job->rw == WRITE) {
+		if (!job->read_err && !job->write_err)
+			atomic64_add(job->source.count, &kc->nr_copied);
 		push(&kc->complete_jobs, job);
 
-	else {
+	} else {
 		job->rw = WRITE;
 		push(&kc->io_jobs, job);
 	}
@@ -386,11 +501,16 @@ static int run_io_job(struct kcopyd_job *job)
 		.client = job->kc->io_client,
 	};
 
+	io_job_start(job->kc->throttle);
+
 	if (job->rw == READ)
 		r = dm_io(&io_req, 1, &job->source, NULL);
 	else
 		r = dm_io(&io_req, job->num_dests, job->dests, NULL);
 
+	if (r < 0)
+		io_job_finish(job->kc->throttle);
+
 	return r;
 }
 
@@ -520,8 +640,8 @@ static void segment_complete(int read_err, unsigned long write_err,
 		progress = job->progress;
 		count = job->source.count - progress;
 		if (count) {
-			if (count > SUB_JOB_SIZE)
-				count = SUB_JOB_SIZE;
+			if (count > kc->sub_job_size)
+				count = kc->sub_job_size;
 
 			job->progress += count;
 		}
@@ -610,7 +730,7 @@ int dm_kcopyd_copy(struct dm_kcopyd_client *kc, struct dm_io_region *from,
 	job->context = context;
 	job->master_job = job;
 
-	if (job->source.count <= SUB_JOB_SIZE)
+	if (job->source.count <= kc->sub_job_size)
 		dispatch_job(job);
 	else {
 		mutex_init(&job->lock);
@@ -634,10 +754,16 @@ int kcopyd_cancel(struct kcopyd_job *job, int block)
 }
 #endif  /*  0  */
 
+uint64_t dm_kcopyd_copied_sectors(struct dm_kcopyd_client *kc)
+{
+	return atomic64_read(&kc->nr_copied);
+}
+EXPORT_SYMBOL(dm_kcopyd_copied_sectors);
+
 /*-----------------------------------------------------------------
  * Client setup
  *---------------------------------------------------------------*/
-struct dm_kcopyd_client *dm_kcopyd_client_create(void)
+struct dm_kcopyd_client *dm_kcopyd_client_create(struct dm_kcopyd_throttle *throttle)
 {
 	int r = -ENOMEM;
 	struct dm_kcopyd_client *kc;
@@ -661,9 +787,14 @@ struct dm_kcopyd_client *dm_kcopyd_client_create(void)
 	if (!kc->kcopyd_wq)
 		goto bad_workqueue;
 
+	kc->sub_job_size = get_sub_job_size();
+	kc->throttle = throttle;
+	atomic64_set(&kc->nr_copied, 0);
+
 	kc->pages = NULL;
 	kc->nr_reserved_pages = kc->nr_free_pages = 0;
-	r = client_reserve_pages(kc, RESERVE_PAGES);
+	r = client_reserve_pages(kc, DIV_ROUND_UP(kc->sub_job_size << SECTOR_SHIFT,
+						  PAGE_SIZE));
 	if (r)
 		goto bad_client_pages;
 
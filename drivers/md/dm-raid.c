@@ -588,7 +588,7 @@ static int raid_status(struct dm_target *ti, status_type_t type,
 
 			/* convert from kiB to sectors */
 			DMEMIT(" stripe_cache %d",
-			       conf ? conf->max_nr_stripes * 2 : 0);
+			       conf ? conf->min_nr_stripes * 2 : 0);
 		}
 
 		DMEMIT(" %d", rs->md.raid_disks);
@@ -26,6 +26,9 @@
 
 static const char dm_snapshot_merge_target_name[] = "snapshot-merge";
 
+DECLARE_DM_KCOPYD_THROTTLE_WITH_MODULE_PARM(snapshot_merge_throttle,
+		"A percentage of time allocated for snapshot merging");
+
 #define dm_target_is_snapshot_merge(ti) \
 	((ti)->type->name == dm_snapshot_merge_target_name)
 
@@ -104,6 +107,10 @@ struct dm_snapshot {
 	chunk_t first_merging_chunk;
 	int num_merging_chunks;
 
+	/* For reporting merge throughput. */
+	unsigned long merge_start_jiffies;
+	uint64_t merge_start_sectors;
+
 	/*
 	 * The merge operation failed if this flag is set.
 	 * Failure modes are handled as follows:
@@ -883,6 +890,17 @@ static void increment_pending_exceptions_done_count(void)
 	wake_up_all(&_pending_exceptions_done);
 }
 
+static void report_merge_throughput(struct dm_snapshot *s)
+{
+	uint64_t sectors = dm_kcopyd_copied_sectors(s->kcopyd_client) -
+			   s->merge_start_sectors;
+	unsigned msecs = jiffies_to_msecs(jiffies - s->merge_start_jiffies);
+
+	DMINFO("Merge complete: %llu sectors in %u.%03us (%llu KiB/s)",
+	       (unsigned long long)sectors, msecs / 1000, msecs % 1000,
+	       (unsigned long long)div_u64(sectors * 500, max(msecs, 1U)));
+}
+
 static void snapshot_merge_next_chunks(struct dm_snapshot *s)
 {
 	int i, linear_chunks;
@@ -912,7 +930,8 @@ static void snapshot_merge_next_chunks(struct dm_snapshot *s)
 			down_write(&s->lock);
 			s->merge_failed = 1;
 			up_write(&s->lock);
-		}
+		} else
+			report_merge_throughput(s);
 		goto shut;
 	}
 
@@ -1008,8 +1027,11 @@ shut:
 
 static void start_merge(struct dm_snapshot *s)
 {
-	if (!test_and_set_bit(RUNNING_MERGE, &s->state_bits))
+	if (!test_and_set_bit(RUNNING_MERGE, &s->state_bits)) {
+		s->merge_start_jiffies = jiffies;
+		s->merge_start_sectors = dm_kcopyd_copied_sectors(s->kcopyd_client);
 		snapshot_merge_next_chunks(s);
+	}
 }
 
 static int wait_schedule(void *ptr)
@@ -1111,7 +1133,12 @@ static int snapshot_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad_hash_tables;
 	}
 
-	s->kcopyd_client = dm_kcopyd_client_create();
+	/*
+	 * Only merging is background work.  Exception copies hold up
+	 * origin writes so they are never throttled.
+	 */
+	s->kcopyd_client = dm_kcopyd_client_create(dm_target_is_snapshot_merge(ti) ?
+						   &dm_kcopyd_throttle : NULL);
 	if (IS_ERR(s->kcopyd_client)) {
 		r = PTR_ERR(s->kcopyd_client);
 		ti->error = "Could not create kcopyd client";
@@ -13,6 +13,7 @@
 #include <linux/list.h>
 #include <linux/device-mapper.h>
 #include <linux/workqueue.h>
+#include <linux/ktime.h>
 
 /*--------------------------------------------------------------------------
  * As far as the metadata goes, there is:
@@ -78,7 +79,12 @@
 #define THIN_SUPERBLOCK_LOCATION 0
 #define THIN_VERSION 1
 #define THIN_METADATA_BLOCK_SIZE 4096
-#define THIN_METADATA_CACHE_SIZE 64
+
+/*
+ * Enough to keep every internal node of a multi-terabyte mapping tree
+ * cached, so a lookup costs at most one leaf read.
+ */
+#define THIN_METADATA_CACHE_SIZE 1024
 #define SECTOR_TO_BLOCK_SHIFT 3
 
 /* This should be plenty */
@@ -181,6 +187,13 @@ struct dm_pool_metadata {
 	uint64_t trans_id;
 	unsigned long flags;
 	sector_t data_block_size;
+
+	/*
+	 * Commit statistics, protected by root_lock.
+	 */
+	uint64_t nr_commits;
+	uint64_t commit_us;
+	uint64_t max_commit_us;
 };
 
 struct dm_thin_device {
@@ -483,6 +496,9 @@ static struct dm_pool_metadata *alloc_pmd(struct dm_block_manager *bm,
 	pmd->need_commit = 0;
 	pmd->details_root = 0;
 	INIT_LIST_HEAD(&pmd->thin_devices);
+	pmd->nr_commits = 0;
+	pmd->commit_us = 0;
+	pmd->max_commit_us = 0;
 
 	return pmd;
 
@@ -1202,6 +1218,8 @@ int dm_pool_commit_metadata(struct dm_pool_metadata *pmd)
 	int r;
 	size_t len;
 	struct thin_disk_superblock *disk_super;
+	ktime_t start;
+	uint64_t us;
 
 	/*
 	 * We need to know if the thin_disk_superblock exceeds a 512-byte sector.
@@ -1216,6 +1234,7 @@ int dm_pool_commit_metadata(struct dm_pool_metadata *pmd)
 	if (!pmd->need_commit)
 		goto out;
 
+	start = ktime_get();
 	r = dm_tm_pre_commit(pmd->tm);
 	if (r < 0)
 		goto out;
@@ -1243,6 +1262,11 @@ int dm_pool_commit_metadata(struct dm_pool_metadata *pmd)
 	if (r < 0)
 		goto out;
 
+	us = ktime_us_delta(ktime_get(), start);
+	pmd->nr_commits++;
+	pmd->commit_us += us;
+	pmd->max_commit_us = max(pmd->max_commit_us, us);
+
 	/*
 	 * Open the next transaction.
 	 */
@@ -1254,6 +1278,22 @@ out:
 	return r;
 }
 
+void dm_pool_get_metadata_stats(struct dm_pool_metadata *pmd,
+				struct dm_pool_metadata_stats *result)
+{
+	struct dm_bm_stats bm_stats;
+
+	dm_bm_get_stats(pmd->bm, &bm_stats);
+	result->lookup_hits = bm_stats.hits;
+	result->lookup_misses = bm_stats.misses;
+
+	down_read(&pmd->root_lock);
+	result->nr_commits = pmd->nr_commits;
+	result->commit_us = pmd->commit_us;
+	result->max_commit_us = pmd->max_commit_us;
+	up_read(&pmd->root_lock);
+}
+
 int dm_pool_get_free_block_count(struct dm_pool_metadata *pmd, dm_block_t *result)
 {
 	int r;
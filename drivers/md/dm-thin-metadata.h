@@ -154,6 +154,21 @@ int dm_pool_get_data_block_size(struct dm_pool_metadata *pmd, sector_t *result);
 
 int dm_pool_get_data_dev_size(struct dm_pool_metadata *pmd, dm_block_t *result);
 
+/*
+ * Metadata cache and commit statistics since the pool was opened.
+ * Commit times are in microseconds.
+ */
+struct dm_pool_metadata_stats {
+	uint64_t lookup_hits;
+	uint64_t lookup_misses;
+	uint64_t nr_commits;
+	uint64_t commit_us;
+	uint64_t max_commit_us;
+};
+
+void dm_pool_get_metadata_stats(struct dm_pool_metadata *pmd,
+				struct dm_pool_metadata_stats *result);
+
 /*
  * Returns -ENOSPC if the new size is too small and already allocated
  * blocks would be lost.
@@ -473,6 +473,7 @@ struct pool {
 
 	spinlock_t lock;
 	struct bio_list deferred_bios;
+	struct bio_list deferred_flush_bios;
 	struct list_head prepared_mappings;
 
 	int low_water_triggered;	/* A dm event has been sent */
@@ -585,17 +586,23 @@ static void remap(struct thin_c *tc, struct bio *bio, dm_block_t block)
 static void remap_and_issue(struct thin_c *tc, struct bio *bio,
 			    dm_block_t block)
 {
+	struct pool *pool = tc->pool;
+	unsigned long flags;
+
+	remap(tc, bio, block);
+
+	/*
+	 * FLUSH and FUA bios can't be issued until the metadata has been
+	 * committed.  Rather than commit once per bio, collect them and let
+	 * the worker issue the whole batch after a single commit.
+	 */
 	if (bio->bi_rw & (REQ_FLUSH | REQ_FUA)) {
-		int r = dm_pool_commit_metadata(tc->pool->pmd);
-		if (r) {
-			DMERR("%s: dm_pool_commit_metadata() failed, error = %d",
-			      __func__, r);
-			bio_io_error(bio);
-			return;
-		}
+		spin_lock_irqsave(&pool->lock, flags);
+		bio_list_add(&pool->deferred_flush_bios, bio);
+		spin_unlock_irqrestore(&pool->lock, flags);
+		return;
 	}
 
-	remap(tc, bio, block);
 	generic_make_request(bio);
 }
 
@@ -1124,12 +1131,43 @@ static void process_prepared_mappings(struct pool *pool)
 		process_prepared_mapping(m);
 }
 
+static void process_deferred_flush_bios(struct pool *pool)
+{
+	int r;
+	unsigned long flags;
+	struct bio *bio;
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_merge(&bios, &pool->deferred_flush_bios);
+	bio_list_init(&pool->deferred_flush_bios);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	if (bio_list_empty(&bios))
+		return;
+
+	r = dm_pool_commit_metadata(pool->pmd);
+	if (r) {
+		DMERR("%s: dm_pool_commit_metadata() failed, error = %d",
+		      __func__, r);
+		while ((bio = bio_list_pop(&bios)))
+			bio_io_error(bio);
+		return;
+	}
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+}
+
 static void do_worker(struct work_struct *ws)
 {
 	struct pool *pool = container_of(ws, struct pool, worker);
 
 	process_prepared_mappings(pool);
 	process_deferred_bios(pool);
+	process_deferred_flush_bios(pool);
 }
 
 /*----------------------------------------------------------------*/
@@ -1312,7 +1350,7 @@ static struct pool *pool_create(struct block_device *metadata_dev,
 		goto bad_prison;
 	}
 
-	pool->copier = dm_kcopyd_client_create();
+	pool->copier = dm_kcopyd_client_create(NULL);
 	if (IS_ERR(pool->copier)) {
 		r = PTR_ERR(pool->copier);
 		*error = "Error creating pool's kcopyd client";
@@ -1334,6 +1372,7 @@ static struct pool *pool_create(struct block_device *metadata_dev,
 	INIT_WORK(&pool->worker, do_worker);
 	spin_lock_init(&pool->lock);
 	bio_list_init(&pool->deferred_bios);
+	bio_list_init(&pool->deferred_flush_bios);
 	INIT_LIST_HEAD(&pool->prepared_mappings);
 	pool->low_water_triggered = 0;
 	bio_list_init(&pool->retry_list);
@@ -1879,6 +1918,8 @@ static int pool_message(struct dm_target *ti, unsigned argc, char **argv)
  * Status line is:
  *    <transaction id> <free metadata space in sectors>
  *    <free data space in sectors> <held metadata root>
+ *    <metadata cache hits> <metadata cache misses>
+ *    <nr commits> <mean commit time (us)> <max commit time (us)>
  */
 static int pool_status(struct dm_target *ti, status_type_t type,
 		       char *result, unsigned maxlen)
@@ -1889,6 +1930,7 @@ static int pool_status(struct dm_target *ti, status_type_t type,
 	dm_block_t nr_free_blocks_data;
 	dm_block_t nr_free_blocks_metadata;
 	dm_block_t held_root;
+	struct dm_pool_metadata_stats stats;
 	char buf[BDEVNAME_SIZE];
 	char buf2[BDEVNAME_SIZE];
 	struct pool_c *pt = ti->private;
@@ -1924,6 +1966,15 @@ static int pool_status(struct dm_target *ti, status_type_t type,
 		else
 			DMEMIT("-");
 
+		dm_pool_get_metadata_stats(pool->pmd, &stats);
+		DMEMIT(" %llu %llu %llu %llu %llu",
+		       (unsigned long long)stats.lookup_hits,
+		       (unsigned long long)stats.lookup_misses,
+		       (unsigned long long)stats.nr_commits,
+		       (unsigned long long)(stats.nr_commits ?
+					    div64_u64(stats.commit_us, stats.nr_commits) : 0),
+		       (unsigned long long)stats.max_commit_us);
+
 		break;
 
 	case STATUSTYPE_TABLE:
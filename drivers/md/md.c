@@ -2333,26 +2333,6 @@ repeat:
 
 }
 
-/* words written to sysfs files may, or may not, be \n terminated.
- * We want to accept with case. For this we use cmd_match.
- */
-static int cmd_match(const char *cmd, const char *str)
-{
-	/* See if cmd, written into a sysfs file, matches
-	 * str.  They must either be the same, or cmd can
-	 * have a trailing newline
-	 */
-	while (*cmd && *str && *cmd == *str) {
-		cmd++;
-		str++;
-	}
-	if (*cmd == '\n')
-		cmd++;
-	if (*str || *cmd)
-		return 0;
-	return 1;
-}
-
 struct rdev_sysfs_entry {
 	struct attribute attr;
 	ssize_t (*show)(mdk_rdev_t *, char *);
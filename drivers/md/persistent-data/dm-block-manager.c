@@ -78,6 +78,13 @@ struct dm_block_manager {
 	unsigned reading_count;
 	unsigned writing_count;
 
+	/*
+	 * Lookup statistics, protected by the lock above.
+	 */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t prefetches;
+
 	struct list_head empty_list;	/* No block assigned */
 	struct list_head clean_list;	/* Unlocked and clean */
 	struct list_head dirty_list;	/* Unlocked and dirty */
@@ -244,6 +251,10 @@ static void __transition(struct dm_block *b, enum dm_block_state new_state)
 		/* DOT: reading -> error */
 		BUG_ON(!((b->state == BS_WRITING) ||
 			 (b->state == BS_READING)));
+		if (b->state == BS_READING) {
+			BUG_ON(!bm->reading_count);
+			bm->reading_count--;
+		}
 		list_add_tail(&b->list, &bm->error_list);
 		break;
 	}
@@ -314,6 +325,28 @@ static void read_block(struct dm_block *b)
 	submit_io(b, READ, complete_io);
 }
 
+/*
+ * Nobody owns a prefetched block, so a failed read is simply dropped.
+ * The next lock of that location will reread it synchronously and
+ * report the error to the caller.
+ */
+static void complete_prefetch(unsigned long error, struct dm_block *b)
+{
+	struct dm_block_manager *bm = b->bm;
+	unsigned long flags;
+
+	spin_lock_irqsave(&bm->lock, flags);
+	if (error) {
+		__transition(b, BS_ERROR);
+		__transition(b, BS_EMPTY);
+	} else
+		__transition(b, BS_CLEAN);
+
+	wake_up(&b->io_q);
+	wake_up(&bm->io_q);
+	spin_unlock_irqrestore(&bm->lock, flags);
+}
+
 static void write_block(struct dm_block *b)
 {
 	if (b->validator)
@@ -630,6 +663,9 @@ struct dm_block_manager *dm_block_manager_create(struct block_device *bdev,
 	bm->available_count = 0;
 	bm->reading_count = 0;
 	bm->writing_count = 0;
+	bm->hits = 0;
+	bm->misses = 0;
+	bm->prefetches = 0;
 
 	sprintf(bm->buffer_cache_name, "dm_block_buffer-%d-%d",
 		MAJOR(disk_devt(bdev->bd_disk)),
@@ -711,9 +747,31 @@ static int lock_internal(struct dm_block_manager *bm, dm_block_t block,
 retry:
 	b = __find_block(bm, block);
 	if (b) {
+		/*
+		 * A prefetched block may still be in flight.  Wait for it
+		 * before the validator gets a look at the data.
+		 */
+		if (b->state == BS_READING) {
+			if (!can_block) {
+				spin_unlock_irqrestore(&bm->lock, flags);
+				return -EWOULDBLOCK;
+			}
+
+			__wait_io(b, &flags);
+			if (b->state == BS_ERROR) {
+				spin_unlock_irqrestore(&bm->lock, flags);
+				return -EIO;
+			}
+
+			if (b->where != block || b->state == BS_EMPTY)
+				goto retry;
+		}
+
 		if (!need_read)
 			b->validator = v;
 		else {
+			bm->hits++;
+
 			if (b->validator && (v != b->validator)) {
 				DMERR("validator mismatch (old=%s vs new=%s) for block %llu",
 				      b->validator->name, v ? v->name : "NULL",
@@ -729,6 +787,12 @@ retry:
 					DMERR("%s validator check failed for block %llu",
 					      b->validator->name,
 					      (unsigned long long)b->where);
+					/*
+					 * Don't let unchecked data stay cached.
+					 */
+					b->validator = NULL;
+					if (b->state == BS_CLEAN)
+						__transition(b, BS_EMPTY);
 					spin_unlock_irqrestore(&bm->lock, flags);
 					return r;
 				}
@@ -773,6 +837,8 @@ retry:
 		goto out;
 
 	} else {
+		if (need_read)
+			bm->misses++;
 		spin_unlock_irqrestore(&bm->lock, flags);
 		r = recycle_block(bm, block, need_read, v, &b);
 		spin_lock_irqsave(&bm->lock, flags);
@@ -838,6 +904,65 @@ int dm_bm_write_lock_zero(struct dm_block_manager *bm,
 	return r;
 }
 
+void dm_bm_prefetch(struct dm_block_manager *bm, dm_block_t b)
+{
+	struct dm_block *blk = NULL;
+	unsigned long flags;
+
+	if (b >= bm->nr_blocks)
+		return;
+
+	spin_lock_irqsave(&bm->lock, flags);
+	if (__find_block(bm, b))
+		goto out;
+
+	/*
+	 * Prefetching must never stall the caller, nor push out useful
+	 * blocks when the cache is under pressure.  So only empty blocks
+	 * are taken, or the least recently used clean one while at least
+	 * half the cache is unlocked, and in-flight reads are bounded.
+	 */
+	if (bm->reading_count >= bm->cache_size / 4)
+		goto out;
+
+	if (!list_empty(&bm->empty_list))
+		blk = list_first_entry(&bm->empty_list, struct dm_block, list);
+
+	else if (bm->available_count > bm->cache_size / 2 &&
+		 !list_empty(&bm->clean_list)) {
+		blk = list_first_entry(&bm->clean_list, struct dm_block, list);
+		__transition(blk, BS_EMPTY);
+	}
+
+	if (blk) {
+		/*
+		 * The validator is run when the block is first locked.
+		 */
+		blk->where = b;
+		blk->validator = NULL;
+		__transition(blk, BS_READING);
+		bm->prefetches++;
+	}
+out:
+	spin_unlock_irqrestore(&bm->lock, flags);
+
+	if (blk)
+		submit_io(blk, READ, complete_prefetch);
+}
+EXPORT_SYMBOL_GPL(dm_bm_prefetch);
+
+void dm_bm_get_stats(struct dm_block_manager *bm, struct dm_bm_stats *stats)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bm->lock, flags);
+	stats->hits = bm->hits;
+	stats->misses = bm->misses;
+	stats->prefetches = bm->prefetches;
+	spin_unlock_irqrestore(&bm->lock, flags);
+}
+EXPORT_SYMBOL_GPL(dm_bm_get_stats);
+
 int dm_bm_unlock(struct dm_block *b)
 {
 	int r = 0;
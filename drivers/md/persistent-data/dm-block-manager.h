@@ -100,6 +100,25 @@ int dm_bm_write_lock_zero(struct dm_block_manager *bm, dm_block_t b,
 
 int dm_bm_unlock(struct dm_block *b);
 
+/*
+ * Request data be read into the cache in the background, so a later lock
+ * of that block doesn't have to wait for the disk.  This is only a hint:
+ * it never blocks and is silently ignored when the cache is busy.
+ */
+void dm_bm_prefetch(struct dm_block_manager *bm, dm_block_t b);
+
+/*
+ * Lookup statistics since the block manager was created.  Hits and
+ * misses count only locks that need the block's contents.
+ */
+struct dm_bm_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t prefetches;
+};
+
+void dm_bm_get_stats(struct dm_block_manager *bm, struct dm_bm_stats *stats);
+
 /*
  * It's a common idiom to have a superblock that should be committed last.
  *
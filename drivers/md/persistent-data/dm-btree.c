@@ -302,6 +302,25 @@ EXPORT_SYMBOL_GPL(dm_btree_del_gt);
 
 /*----------------------------------------------------------------*/
 
+/*
+ * Sequential lookups walk off the end of one child and into the next.
+ * Once the key is in the last quarter of child @i's range, start reading
+ * the following child so it's cached by the time we get there.
+ */
+static void prefetch_sibling(struct ro_spine *s, int i, uint64_t key)
+{
+	struct node *n = ro_node(s);
+	uint64_t lo, hi;
+
+	if (i + 1 >= le32_to_cpu(n->header.nr_entries))
+		return;
+
+	lo = le64_to_cpu(n->keys[i]);
+	hi = le64_to_cpu(n->keys[i + 1]);
+	if (key >= lo && hi - key <= (hi - lo) / 4)
+		dm_tm_prefetch(s->info->tm, value64(n, i + 1));
+}
+
 static int btree_lookup_raw(struct ro_spine *s, dm_block_t block, uint64_t key,
 			    int (*search_fn)(struct node *, uint64_t),
 			    uint64_t *result_key, void *v, size_t value_size)
@@ -321,8 +340,10 @@ static int btree_lookup_raw(struct ro_spine *s, dm_block_t block, uint64_t key,
 		if (i < 0 || i >= nr_entries)
 			return -ENODATA;
 
-		if (flags & INTERNAL_NODE)
+		if (flags & INTERNAL_NODE) {
 			block = value64(ro_node(s), i);
+			prefetch_sibling(s, i, key);
+		}
 
 	} while (!(flags & LEAF_NODE));
 
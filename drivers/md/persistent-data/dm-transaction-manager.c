@@ -286,6 +286,18 @@ int dm_tm_read_lock(struct dm_transaction_manager *tm, dm_block_t b,
 	return dm_bm_read_lock(tm->bm, b, v, blk);
 }
 
+void dm_tm_prefetch(struct dm_transaction_manager *tm, dm_block_t b)
+{
+	/*
+	 * The non-blocking clone is used from contexts that shouldn't
+	 * submit io.
+	 */
+	if (tm->is_clone)
+		return;
+
+	dm_bm_prefetch(tm->bm, b);
+}
+
 int dm_tm_unlock(struct dm_transaction_manager *tm, struct dm_block *b)
 {
 	return dm_bm_unlock(b);
@@ -416,6 +416,8 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 	int best_disk;
 	int i;
 	sector_t best_dist;
+	int best_pending;
+	int idle_disk;
 	mdk_rdev_t *rdev;
 	int choose_first;
 
@@ -428,6 +430,8 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
  retry:
 	best_disk = -1;
 	best_dist = MaxSector;
+	best_pending = INT_MAX;
+	idle_disk = -1;
 	if (conf->mddev->recovery_cp < MaxSector &&
 	    (this_sector + sectors >= conf->next_resync)) {
 		choose_first = 1;
@@ -461,6 +465,31 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 		/* This is a reasonable device to use.  It might
 		 * even be best.
 		 */
+		if (conf->read_policy == R1_BALANCE_QUEUE) {
+			/* Head position means nothing for devices without
+			 * seek cost: continue a sequential stream on the
+			 * mirror already serving it, wherever it is in the
+			 * scan.  Otherwise pick an idle mirror, or the one
+			 * with the fewest requests in flight.
+			 */
+			int pending = atomic_read(&rdev->nr_pending);
+
+			if (choose_first
+			    || conf->mirrors[disk].next_seq_sect == this_sector) {
+				best_disk = disk;
+				break;
+			}
+			if (pending == 0) {
+				if (idle_disk < 0)
+					idle_disk = disk;
+				continue;
+			}
+			if (pending < best_pending) {
+				best_pending = pending;
+				best_disk = disk;
+			}
+			continue;
+		}
 		dist = abs(this_sector - conf->mirrors[disk].head_position);
 		if (choose_first
 		    /* Don't change to another disk for sequential reads */
@@ -476,6 +505,9 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 			best_disk = disk;
 		}
 	}
+	/* no sequential match, prefer an idle mirror */
+	if (i == conf->raid_disks && idle_disk >= 0)
+		best_disk = idle_disk;
 
 	if (best_disk >= 0) {
 		rdev = rcu_dereference(conf->mirrors[best_disk].rdev);
@@ -490,6 +522,7 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 			goto retry;
 		}
 		conf->next_seq_sect = this_sector + sectors;
+		conf->mirrors[best_disk].next_seq_sect = this_sector + sectors;
 		conf->last_used = best_disk;
 	}
 	rcu_read_unlock();
@@ -1948,11 +1981,53 @@ static conf_t *setup_conf(mddev_t *mddev)
 	return ERR_PTR(err);
 }
 
+static ssize_t
+raid1_show_read_balance(mddev_t *mddev, char *page)
+{
+	conf_t *conf = mddev->private;
+	if (!conf)
+		return 0;
+	if (conf->read_policy == R1_BALANCE_QUEUE)
+		return sprintf(page, "queue\n");
+	return sprintf(page, "distance\n");
+}
+
+static ssize_t
+raid1_store_read_balance(mddev_t *mddev, const char *page, size_t len)
+{
+	conf_t *conf = mddev->private;
+
+	if (!conf)
+		return -ENODEV;
+	if (cmd_match(page, "distance"))
+		conf->read_policy = R1_BALANCE_DISTANCE;
+	else if (cmd_match(page, "queue"))
+		conf->read_policy = R1_BALANCE_QUEUE;
+	else
+		return -EINVAL;
+	return len;
+}
+
+static struct md_sysfs_entry
+raid1_read_balance = __ATTR(read_balance, S_IRUGO | S_IWUSR,
+			    raid1_show_read_balance,
+			    raid1_store_read_balance);
+
+static struct attribute *raid1_attrs[] =  {
+	&raid1_read_balance.attr,
+	NULL,
+};
+static struct attribute_group raid1_attrs_group = {
+	.name = NULL,
+	.attrs = raid1_attrs,
+};
+
 static int run(mddev_t *mddev)
 {
 	conf_t *conf;
 	int i;
 	mdk_rdev_t *rdev;
+	int nonrot = 1;
 
 	if (mddev->level != 1) {
 		printk(KERN_ERR "md/raid1:%s: raid level not set to mirroring (%d)\n",
@@ -1978,6 +2053,8 @@ static int run(mddev_t *mddev)
 		return PTR_ERR(conf);
 
 	list_for_each_entry(rdev, &mddev->disks, same_set) {
+		if (!blk_queue_nonrot(bdev_get_queue(rdev->bdev)))
+			nonrot = 0;
 		if (!mddev->gendisk)
 			continue;
 		disk_stack_limits(mddev->gendisk, rdev->bdev,
@@ -1992,6 +2069,9 @@ static int run(mddev_t *mddev)
 						   PAGE_CACHE_SIZE - 1);
 		}
 	}
+	/* seek distance is meaningless if no member rotates */
+	if (nonrot)
+		conf->read_policy = R1_BALANCE_QUEUE;
 
 	mddev->degraded = 0;
 	for (i=0; i < conf->raid_disks; i++)
@@ -2021,6 +2101,14 @@ static int run(mddev_t *mddev)
 
 	md_set_array_sectors(mddev, raid1_size(mddev, 0, 0));
 
+	if (mddev->to_remove == &raid1_attrs_group)
+		mddev->to_remove = NULL;
+	else if (mddev->kobj.sd &&
+	    sysfs_create_group(&mddev->kobj, &raid1_attrs_group))
+		printk(KERN_WARNING
+		       "md/raid1:%s: failed to create sysfs attributes\n",
+		       mdname(mddev));
+
 	if (mddev->queue) {
 		mddev->queue->backing_dev_info.congested_fn = raid1_congested;
 		mddev->queue->backing_dev_info.congested_data = mddev;
@@ -2052,6 +2140,7 @@ static int stop(mddev_t *mddev)
 	kfree(conf->poolinfo);
 	kfree(conf);
 	mddev->private = NULL;
+	mddev->to_remove = &raid1_attrs_group;
 	return 0;
 }
 
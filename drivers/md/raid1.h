@@ -6,8 +6,17 @@ typedef struct mirror_info mirror_info_t;
 struct mirror_info {
 	mdk_rdev_t	*rdev;
 	sector_t	head_position;
+	sector_t	next_seq_sect;	/* sector after the last read sent
+					 * here, to keep a sequential
+					 * stream on one mirror */
 };
 
+/* read balancing policies, selected with the 'read_balance'
+ * sysfs attribute
+ */
+#define	R1_BALANCE_DISTANCE	0 /* nearest head position */
+#define	R1_BALANCE_QUEUE	1 /* fewest requests in flight */
+
 /*
  * memory pools need a pointer to the mddev, so they can force an unplug
  * when memory is tight, and a count of the number of drives that the
@@ -30,6 +39,7 @@ struct r1_private_data_s {
 	int			raid_disks;
 	int			last_used;
 	sector_t		next_seq_sect;
+	int			read_policy;
 	spinlock_t		device_lock;
 
 	struct list_head	retry_list;
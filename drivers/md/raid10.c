@@ -493,12 +493,16 @@ static int read_balance(conf_t *conf, r10bio_t *r10_bio)
 	mdk_rdev_t *rdev;
 	int do_balance;
 	int best_slot;
+	int best_pending;
+	int idle_slot;
 
 	raid10_find_phys(conf, r10_bio);
 	rcu_read_lock();
 retry:
 	best_slot = -1;
 	best_dist = MaxSector;
+	best_pending = INT_MAX;
+	idle_slot = -1;
 	do_balance = 1;
 	/*
 	 * Check if we can balance. We can balance on the whole
@@ -523,6 +527,29 @@ retry:
 		if (!do_balance)
 			break;
 
+		if (conf->read_policy == R10_BALANCE_QUEUE) {
+			/* Continue a sequential stream on the mirror
+			 * already serving it, wherever it is in the scan.
+			 * Otherwise pick an idle mirror, or the one with
+			 * the fewest requests in flight.
+			 */
+			int pending = atomic_read(&rdev->nr_pending);
+
+			if (conf->mirrors[disk].next_seq_sect ==
+			    r10_bio->devs[slot].addr)
+				break;
+			if (pending == 0) {
+				if (idle_slot < 0)
+					idle_slot = slot;
+				continue;
+			}
+			if (pending < best_pending) {
+				best_pending = pending;
+				best_slot = slot;
+			}
+			continue;
+		}
+
 		/* This optimisation is debatable, and completely destroys
 		 * sequential read speed for 'far copies' arrays.  So only
 		 * keep it for 'near' arrays, and review those later.
@@ -542,7 +569,7 @@ retry:
 		}
 	}
 	if (slot == conf->copies)
-		slot = best_slot;
+		slot = idle_slot >= 0 ? idle_slot : best_slot;
 
 	if (slot >= 0) {
 		disk = r10_bio->devs[slot].devnum;
@@ -557,6 +584,8 @@ retry:
 			rdev_dec_pending(rdev, conf->mddev);
 			goto retry;
 		}
+		conf->mirrors[disk].next_seq_sect =
+			r10_bio->devs[slot].addr + sectors;
 		r10_bio->read_slot = slot;
 	} else
 		disk = -1;
@@ -2213,6 +2242,47 @@ static conf_t *setup_conf(mddev_t *mddev)
 	return ERR_PTR(err);
 }
 
+static ssize_t
+raid10_show_read_balance(mddev_t *mddev, char *page)
+{
+	conf_t *conf = mddev->private;
+	if (!conf)
+		return 0;
+	if (conf->read_policy == R10_BALANCE_QUEUE)
+		return sprintf(page, "queue\n");
+	return sprintf(page, "distance\n");
+}
+
+static ssize_t
+raid10_store_read_balance(mddev_t *mddev, const char *page, size_t len)
+{
+	conf_t *conf = mddev->private;
+
+	if (!conf)
+		return -ENODEV;
+	if (cmd_match(page, "distance"))
+		conf->read_policy = R10_BALANCE_DISTANCE;
+	else if (cmd_match(page, "queue"))
+		conf->read_policy = R10_BALANCE_QUEUE;
+	else
+		return -EINVAL;
+	return len;
+}
+
+static struct md_sysfs_entry
+raid10_read_balance = __ATTR(read_balance, S_IRUGO | S_IWUSR,
+			     raid10_show_read_balance,
+			     raid10_store_read_balance);
+
+static struct attribute *raid10_attrs[] =  {
+	&raid10_read_balance.attr,
+	NULL,
+};
+static struct attribute_group raid10_attrs_group = {
+	.name = NULL,
+	.attrs = raid10_attrs,
+};
+
 static int run(mddev_t *mddev)
 {
 	conf_t *conf;
@@ -2220,6 +2290,7 @@ static int run(mddev_t *mddev)
 	mirror_info_t *disk;
 	mdk_rdev_t *rdev;
 	sector_t size;
+	int nonrot = 1;
 
 	/*
 	 * copy the already verified devices into our private RAID10
@@ -2267,9 +2338,15 @@ static int run(mddev_t *mddev)
 			blk_queue_segment_boundary(mddev->queue,
 						   PAGE_CACHE_SIZE - 1);
 		}
+		if (!blk_queue_nonrot(bdev_get_queue(rdev->bdev)))
+			nonrot = 0;
 
 		disk->head_position = 0;
 	}
+	/* seek distance is meaningless if no member rotates */
+	if (nonrot)
+		conf->read_policy = R10_BALANCE_QUEUE;
+
 	/* need to check that every block has at least one working mirror */
 	if (!enough(conf)) {
 		printk(KERN_ERR "md/raid10:%s: not enough operational mirrors.\n",
@@ -2328,6 +2405,14 @@ static int run(mddev_t *mddev)
 	if (md_integrity_register(mddev))
 		goto out_free_conf;
 
+	if (mddev->to_remove == &raid10_attrs_group)
+		mddev->to_remove = NULL;
+	else if (mddev->kobj.sd &&
+	    sysfs_create_group(&mddev->kobj, &raid10_attrs_group))
+		printk(KERN_WARNING
+		       "md/raid10:%s: failed to create sysfs attributes\n",
+		       mdname(mddev));
+
 	return 0;
 
 out_free_conf:
@@ -2356,6 +2441,7 @@ static int stop(mddev_t *mddev)
 	kfree(conf->mirrors);
 	kfree(conf);
 	mddev->private = NULL;
+	mddev->to_remove = &raid10_attrs_group;
 	return 0;
 }
 
@@ -6,14 +6,24 @@ typedef struct mirror_info mirror_info_t;
 struct mirror_info {
 	mdk_rdev_t	*rdev;
 	sector_t	head_position;
+	sector_t	next_seq_sect;	/* device sector after the last read
+					 * sent here, to keep a sequential
+					 * stream on one mirror */
 };
 
+/* read balancing policies, selected with the 'read_balance'
+ * sysfs attribute
+ */
+#define	R10_BALANCE_DISTANCE	0 /* nearest head position */
+#define	R10_BALANCE_QUEUE	1 /* fewest requests in flight */
+
 typedef struct r10bio_s r10bio_t;
 
 struct r10_private_data_s {
 	mddev_t			*mddev;
 	mirror_info_t		*mirrors;
 	int			raid_disks;
+	int			read_policy;
 	spinlock_t		device_lock;
 
 	/* geometry */
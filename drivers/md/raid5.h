@@ -204,6 +204,11 @@ struct stripe_head {
 	short			generation;	/* increments with every
 						 * reshape */
 	sector_t		sector;		/* sector of this row */
+	int			hash_lock_index; /* which hash lock/inactive
+						  * list this stripe uses */
+	int			cpu;		/* cpu that queued it, selects
+						 * the worker group */
+	struct r5worker_group	*group;		/* group handle_list we are on */
 	short			pd_idx;		/* parity disk index */
 	short			qd_idx;		/* 'Q' disk index for raid6 */
 	short			ddf_layout;/* use DDF ordering to calculate Q */
@@ -344,6 +349,43 @@ struct disk_info {
 	mdk_rdev_t	*rdev;
 };
 
+/* The stripe hash table and the inactive lists are protected by
+ * NR_STRIPE_HASH_LOCKS locks rather than by device_lock, so that
+ * get_active_stripe() on different stripes does not serialise.
+ * A stripe with sector 's' always uses hash lock
+ * (s >> STRIPE_SHIFT) & STRIPE_HASH_LOCKS_MASK.
+ * Lock ordering is hash_lock -> device_lock.
+ */
+#define NR_STRIPE_HASH_LOCKS	8
+#define STRIPE_HASH_LOCKS_MASK	(NR_STRIPE_HASH_LOCKS - 1)
+
+/* Stripe handling can be spread over a pool of worker threads.
+ * Workers are grouped per NUMA node, and a stripe is queued on the
+ * group of the cpu which submitted it.  raid5d still handles
+ * any stripe that is left over.
+ */
+struct r5worker {
+	struct work_struct	work;
+	struct r5worker_group	*group;
+	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	bool			working;
+};
+
+struct r5worker_group {
+	struct list_head	handle_list;
+	struct raid5_private_data *conf;
+	struct r5worker		*workers;
+	int			stripes_cnt;
+};
+
+/* cache_state bits */
+enum r5_cache_state {
+	R5_ALLOC_MORE,		/* It might help to allocate another
+				 * stripe. */
+	R5_DID_ALLOC,		/* A stripe was allocated, don't allocate
+				 * more until it has been used */
+};
+
 struct raid5_private_data {
 	struct hlist_head	*stripe_hashtbl;
 	mddev_t			*mddev;
@@ -352,7 +394,8 @@ struct raid5_private_data {
 	int			level, algorithm;
 	int			max_degraded;
 	int			raid_disks;
-	int			max_nr_stripes;
+	int			max_nr_stripes; /* stripes currently allocated */
+	int			min_nr_stripes; /* configured stripe_cache_size */
 
 	/* reshape_progress is the leading edge of a 'reshape'
 	 * It has value MaxSector when no reshape is happening
@@ -420,7 +463,13 @@ struct raid5_private_data {
 	 * Free stripes pool
 	 */
 	atomic_t		active_stripes;
-	struct list_head	inactive_list;
+	struct list_head	inactive_list[NR_STRIPE_HASH_LOCKS];
+	atomic_t		empty_inactive_list_nr;
+	/* stripes released by raid5d under device_lock are collected
+	 * here and moved to inactive_list once device_lock is dropped.
+	 */
+	struct list_head	temp_inactive_list[NR_STRIPE_HASH_LOCKS];
+	spinlock_t		hash_locks[NR_STRIPE_HASH_LOCKS];
 	wait_queue_head_t	wait_for_stripe;
 	wait_queue_head_t	wait_for_overlap;
 	int			inactive_blocked;	/* release of inactive stripes blocked,
@@ -430,6 +479,18 @@ struct raid5_private_data {
 	spinlock_t		device_lock;
 	struct disk_info	*disks;
 
+	/* The stripe cache grows on demand (up to MAX_NR_STRIPES) when
+	 * get_active_stripe() finds no free stripe, and is trimmed back
+	 * to min_nr_stripes by the shrinker under memory pressure.
+	 */
+	unsigned long		cache_state;
+	struct mutex		cache_size_mutex; /* protects max_nr_stripes */
+	struct shrinker		shrinker;
+
+	struct r5worker_group	*worker_groups;
+	int			group_cnt;
+	int			worker_cnt_per_group;
+
 	/* When taking over an array from a different personality, we store
 	 * the new thread here until we fully activate the array.
 	 */
@@ -1347,6 +1347,7 @@ static int mmc_blk_resume(struct mmc_card *card)
 static struct mmc_driver mmc_driver = {
 	.drv		= {
 		.name	= "mmcblk",
+		.async_probe = true,
 	},
 	.probe		= mmc_blk_probe,
 	.remove		= mmc_blk_remove,
@@ -28,9 +28,10 @@
  * specified, UBI does not attach any MTD device, but it is possible to do
  * later using the "UBI control device".
  *
- * At the moment we only attach UBI devices by scanning, which will become a
- * bottleneck when flashes reach certain large size. Then one may improve UBI
- * and add other methods, although it does not seem to be easy to do.
+ * UBI devices are attached by scanning, which becomes a bottleneck when
+ * flashes reach certain large size. If fastmap is enabled, scanning first
+ * looks for a fastmap and only scans the PEBs it does not describe (see
+ * fastmap.c).
  */
 
 #include <linux/err.h>
@@ -575,10 +576,9 @@ static void free_internal_volumes(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * Note, if there is a fastmap on the flash, 'ubi_scan()' uses it and avoids
+ * full media scanning. Full scanning is still the fall-back attaching method
+ * if the fastmap is missing or corrupted.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
@@ -935,6 +935,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->ckvol_mutex);
 	mutex_init(&ubi->device_mutex);
 	spin_lock_init(&ubi->volumes_lock);
+	init_rwsem(&ubi->fm_sem);
+	INIT_LIST_HEAD(&ubi->fm_deferred);
 
 	ubi_msg("attaching mtd%d to ubi%d", mtd->index, ubi_num);
 	dbg_msg("sizeof(struct ubi_scan_leb) %zu", sizeof(struct ubi_scan_leb));
@@ -944,19 +946,23 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	if (err)
 		goto out_free;
 
+	err = ubi_fastmap_init(ubi);
+	if (err)
+		goto out_free;
+
 	err = -ENOMEM;
 	ubi->peb_buf1 = vmalloc(ubi->peb_size);
 	if (!ubi->peb_buf1)
-		goto out_free;
+		goto out_fm;
 
 	ubi->peb_buf2 = vmalloc(ubi->peb_size);
 	if (!ubi->peb_buf2)
-		goto out_free;
+		goto out_fm;
 
 	err = attach_by_scanning(ubi);
 	if (err) {
 		dbg_err("failed to attach by scanning, error %d", err);
-		goto out_free;
+		goto out_fm;
 	}
 
 	if (ubi->autoresize_vol_id != -1) {
@@ -1004,6 +1010,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	wake_up_process(ubi->bgt_thread);
 	spin_unlock(&ubi->wl_lock);
 
+	/* Make sure the next attach does not have to scan the whole device */
+	if (!ubi->fm && !ubi->fm_disabled)
+		schedule_work(&ubi->fm_work);
+
 	ubi_devices[ubi_num] = ubi;
 	ubi_notify_all(ubi, UBI_VOLUME_ADDED, NULL);
 	return ubi_num;
@@ -1011,9 +1021,13 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 out_uif:
 	uif_close(ubi);
 out_detach:
+	ubi_fastmap_close(ubi);
 	ubi_wl_close(ubi);
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
+	goto out_free;
+out_fm:
+	ubi_fastmap_close(ubi);
 out_free:
 	vfree(ubi->peb_buf1);
 	vfree(ubi->peb_buf2);
@@ -1074,6 +1088,13 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	if (ubi->bgt_thread)
 		kthread_stop(ubi->bgt_thread);
 
+	spin_lock(&ubi->wl_lock);
+	ubi->thread_enabled = 0;
+	spin_unlock(&ubi->wl_lock);
+
+	/* Leave an up-to-date fastmap for the next attach */
+	ubi_update_fastmap(ubi);
+
 	/*
 	 * Get a reference to the device in order to prevent 'dev_release()'
 	 * from freeing the @ubi object.
@@ -1081,6 +1102,7 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	get_device(&ubi->dev);
 
 	uif_close(ubi);
+	ubi_fastmap_close(ubi);
 	ubi_wl_close(ubi);
 	free_internal_volumes(ubi);
 	vfree(ubi->vtbl);
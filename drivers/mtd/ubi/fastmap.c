@@ -0,0 +1,1046 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap.
+ *
+ * Attaching an UBI device by scanning requires reading the headers of every
+ * physical eraseblock, which takes time proportional to the flash size. The
+ * fastmap is a checkpoint of what scanning would find: the LEB to PEB mapping
+ * of all volumes, the erase counters, and the lists of free and "to be
+ * erased" PEBs. It is stored in the fastmap internal volumes, and its first
+ * PEB (the anchor) is always one of the first %UBI_FM_MAX_START PEBs, so the
+ * attach code only has to look at these PEBs to find it.
+ *
+ * The fastmap is only usable if it stays in sync with the flash contents, so
+ * while there is a fastmap on the flash UBI works as follows.
+ *
+ * o New PEBs are only taken from the fastmap pool - free PEBs which are
+ *   recorded in the fastmap and scanned on attach. This way the attach code
+ *   finds all the LEBs which were written after the fastmap.
+ * o Wear-leveling and scrubbing move data only to PEBs of a second, smaller
+ *   pool, which is recorded and scanned the same way. The copy has a higher
+ *   sequence number than the LEB recorded in the fastmap, so it wins on
+ *   attach.
+ * o PEBs which are put are not erased, because the fastmap still refers to
+ *   them. They are erased after the next fastmap was written.
+ * o PEBs only go bad while being erased, and all these are recorded as "to be
+ *   erased" or scanned on attach. The attach code checks the "to be erased"
+ *   PEBs for being bad, so new bad PEBs do not make the fastmap stale either.
+ * o Whatever cannot be described this way (e.g. the pool was exhausted and
+ *   no new fastmap could be written) invalidates the fastmap: its anchor PEB
+ *   is synchronously erased, and a new fastmap is written in background.
+ *
+ * A new fastmap is written when the pool is exhausted, when the device is
+ * detached, and after the fastmap was invalidated. The wear-leveling pool is
+ * refilled along the way; while it is empty, wear-leveling waits. PEBs the
+ * fastmap does not account for (bad or corrupted PEBs, PEBs which were being
+ * erased or moved while the fastmap was written) are scanned on attach. If the
+ * fastmap turns out to be corrupted or inconsistent, UBI falls back to full
+ * scanning.
+ */
+
+#include <linux/crc32.h>
+#include "ubi.h"
+
+/* Special values in the @ubi->fm_peb_ec array */
+#define FM_PEB_UNUSED -1
+#define FM_PEB_SCAN   -2
+
+/**
+ * fastmap_work - write a new fastmap in background.
+ * @work: the work object
+ */
+static void fastmap_work(struct work_struct *work)
+{
+	struct ubi_device *ubi = container_of(work, struct ubi_device, fm_work);
+
+	ubi_update_fastmap(ubi);
+}
+
+/**
+ * ubi_fastmap_init - initialize fastmap for an UBI device.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called after the I/O sub-system was initialized and
+ * before the device is scanned. If the device is too large for fastmap,
+ * fastmap is just disabled. Returns zero in case of success and %-ENOMEM in
+ * case of failure.
+ */
+int ubi_fastmap_init(struct ubi_device *ubi)
+{
+	int size;
+
+	INIT_WORK(&ubi->fm_work, fastmap_work);
+
+	/* Each PEB is described by at most one record */
+	size = sizeof(struct ubi_fm_sb) + sizeof(struct ubi_fm_hdr) +
+	       (UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT) *
+			sizeof(struct ubi_fm_volhdr) +
+	       ubi->peb_count * sizeof(struct ubi_fm_leb);
+	ubi->fm_blocks = DIV_ROUND_UP(size, ubi->leb_size);
+	if (ubi->fm_blocks > UBI_FM_MAX_BLOCKS) {
+		ubi_warn("too many PEBs for fastmap, disable it");
+		ubi->fm_disabled = 1;
+		return 0;
+	}
+
+	ubi->fm_size = ubi->fm_blocks * ubi->leb_size;
+	ubi->fm_pool_max = clamp_t(int, ubi->peb_count / 20,
+				   UBI_FM_MIN_POOL_SIZE, UBI_FM_MAX_POOL_SIZE);
+	ubi->fm_wl_pool_max = ubi->fm_pool_max / 2;
+
+	ubi->fm_buf = vmalloc(ubi->fm_size);
+	ubi->fm_peb_ec = vmalloc(ubi->peb_count * sizeof(int));
+	ubi->fm_pool = kmalloc(ubi->fm_pool_max * sizeof(void *), GFP_KERNEL);
+	ubi->fm_wl_pool = kmalloc(ubi->fm_wl_pool_max * sizeof(void *),
+				  GFP_KERNEL);
+	if (!ubi->fm_buf || !ubi->fm_peb_ec || !ubi->fm_pool ||
+	    !ubi->fm_wl_pool) {
+		kfree(ubi->fm_wl_pool);
+		kfree(ubi->fm_pool);
+		vfree(ubi->fm_peb_ec);
+		vfree(ubi->fm_buf);
+		return -ENOMEM;
+	}
+
+	dbg_msg("fastmap: %d PEBs, pool size %d, WL pool size %d",
+		ubi->fm_blocks, ubi->fm_pool_max, ubi->fm_wl_pool_max);
+	return 0;
+}
+
+/**
+ * ubi_fastmap_close - close fastmap for an UBI device.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called before the WL sub-system is closed. It frees
+ * the WL entries which are only referred to by the fastmap code.
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	struct ubi_wl_entry *e, *tmp;
+	int i;
+
+	cancel_work_sync(&ubi->fm_work);
+
+	for (i = ubi->fm_pool_used; i < ubi->fm_pool_size; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_pool[i]);
+	ubi->fm_pool_size = ubi->fm_pool_used = 0;
+	for (i = ubi->fm_wl_pool_used; i < ubi->fm_wl_pool_size; i++)
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_wl_pool[i]);
+	ubi->fm_wl_pool_size = ubi->fm_wl_pool_used = 0;
+
+	list_for_each_entry_safe(e, tmp, &ubi->fm_deferred, u.list) {
+		list_del(&e->u.list);
+		kmem_cache_free(ubi_wl_entry_slab, e);
+	}
+
+	if (ubi->fm) {
+		for (i = 0; i < ubi->fm->used_blocks; i++)
+			kmem_cache_free(ubi_wl_entry_slab, ubi->fm->e[i]);
+		kfree(ubi->fm);
+		ubi->fm = NULL;
+	}
+
+	kfree(ubi->fm_wl_pool);
+	kfree(ubi->fm_pool);
+	vfree(ubi->fm_peb_ec);
+	vfree(ubi->fm_buf);
+}
+
+/**
+ * find_anchor - find the fastmap anchor PEB.
+ * @ubi: UBI device description object
+ * @vh: a buffer for VID headers
+ * @dirty: bit mask of the PEBs in the anchor area which are not empty is
+ *         returned here
+ *
+ * If there are several anchor PEBs, the newest one is picked. Returns the
+ * anchor PEB number, %-ENOENT if there is no anchor PEB, or another negative
+ * error code in case of failure.
+ */
+static int find_anchor(struct ubi_device *ubi, struct ubi_vid_hdr *vh,
+		       u64 *dirty)
+{
+	int pnum, err, anchor = -ENOENT;
+	unsigned long long sqnum, max_sqnum = 0;
+
+	*dirty = 0;
+	for (pnum = 0; pnum < UBI_FM_MAX_START && pnum < ubi->peb_count;
+	     pnum++) {
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		else if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vh, 0);
+		if (err < 0)
+			return err;
+		if (err == UBI_IO_FF)
+			continue;
+
+		*dirty |= 1ULL << pnum;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+		if (be32_to_cpu(vh->vol_id) != UBI_FM_SB_VOLUME_ID)
+			continue;
+
+		sqnum = be64_to_cpu(vh->sqnum);
+		if (anchor < 0 || sqnum > max_sqnum) {
+			anchor = pnum;
+			max_sqnum = sqnum;
+		}
+	}
+
+	return anchor;
+}
+
+/**
+ * read_fastmap - read the fastmap into @ubi->fm_buf.
+ * @ubi: UBI device description object
+ * @anchor: the anchor PEB
+ * @vh: a buffer for VID headers
+ *
+ * This function reads the fastmap super block from the anchor PEB, then the
+ * rest of the fastmap from the other fastmap PEBs, and checks the CRCs.
+ * Returns zero in case of success, %UBI_BAD_FASTMAP if the fastmap is corrupted
+ * or cannot be read.
+ */
+static int read_fastmap(struct ubi_device *ubi, int anchor,
+			struct ubi_vid_hdr *vh)
+{
+	struct ubi_fm_sb *sb = ubi->fm_buf;
+	int i, err, pnum, used_blocks, data_size, len;
+	uint32_t crc;
+
+	err = ubi_io_read_data(ubi, ubi->fm_buf, anchor, 0, ubi->leb_size);
+	if (err && err != UBI_IO_BITFLIPS)
+		return UBI_BAD_FASTMAP;
+
+	if (be32_to_cpu(sb->magic) != UBI_FM_SB_MAGIC ||
+	    sb->version != UBI_FM_FMT_VERSION) {
+		dbg_bld("bad fastmap super block magic or version");
+		return UBI_BAD_FASTMAP;
+	}
+
+	crc = crc32(UBI_CRC32_INIT, sb, sizeof(*sb) - sizeof(__be32));
+	if (crc != be32_to_cpu(sb->sb_crc)) {
+		dbg_bld("bad fastmap super block CRC %#08x", crc);
+		return UBI_BAD_FASTMAP;
+	}
+
+	used_blocks = be32_to_cpu(sb->used_blocks);
+	data_size = be32_to_cpu(sb->data_size);
+	if (used_blocks < 1 || used_blocks > ubi->fm_blocks ||
+	    data_size < sizeof(struct ubi_fm_hdr) ||
+	    data_size + sizeof(*sb) > used_blocks * ubi->leb_size ||
+	    be32_to_cpu(sb->block_loc[0]) != anchor) {
+		dbg_bld("inconsistent fastmap super block");
+		return UBI_BAD_FASTMAP;
+	}
+
+	for (i = 1; i < used_blocks; i++) {
+		pnum = be32_to_cpu(sb->block_loc[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			return UBI_BAD_FASTMAP;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vh, 0);
+		if (err && err != UBI_IO_BITFLIPS)
+			return UBI_BAD_FASTMAP;
+		if (be32_to_cpu(vh->vol_id) != UBI_FM_DATA_VOLUME_ID ||
+		    be32_to_cpu(vh->lnum) != i) {
+			dbg_bld("PEB %d is not fastmap block %d", pnum, i);
+			return UBI_BAD_FASTMAP;
+		}
+
+		len = min_t(int, ubi->leb_size,
+			    data_size + sizeof(*sb) - i * ubi->leb_size);
+		if (len <= 0)
+			continue;
+		len = ALIGN(len, ubi->min_io_size);
+		err = ubi_io_read_data(ubi, ubi->fm_buf + i * ubi->leb_size,
+				       pnum, 0, len);
+		if (err && err != UBI_IO_BITFLIPS)
+			return UBI_BAD_FASTMAP;
+	}
+
+	crc = crc32(UBI_CRC32_INIT, ubi->fm_buf + sizeof(*sb), data_size);
+	if (crc != be32_to_cpu(sb->data_crc)) {
+		dbg_bld("bad fastmap data CRC %#08x", crc);
+		return UBI_BAD_FASTMAP;
+	}
+
+	return 0;
+}
+
+/**
+ * fm_pull - get the next record from the fastmap data.
+ * @ubi: UBI device description object
+ * @pos: current position in the fastmap data
+ * @len: length of the record
+ *
+ * Returns a pointer to the record or %NULL if the fastmap data is too short.
+ */
+static void *fm_pull(struct ubi_device *ubi, int *pos, int len)
+{
+	struct ubi_fm_sb *sb = ubi->fm_buf;
+	void *p;
+
+	if (*pos + len > be32_to_cpu(sb->data_size))
+		return NULL;
+
+	p = ubi->fm_buf + sizeof(*sb) + *pos;
+	*pos += len;
+	return p;
+}
+
+/**
+ * claim_peb - check a PEB number found in the fastmap.
+ * @ubi: UBI device description object
+ * @seen: bitmap of the PEBs which were already found in the fastmap
+ * @pnum: the PEB number
+ * @ec: erase counter of the PEB
+ *
+ * Returns zero if @pnum and @ec are sane and @pnum is met for the first time,
+ * and %UBI_BAD_FASTMAP otherwise.
+ */
+static int claim_peb(struct ubi_device *ubi, unsigned long *seen, int pnum,
+		     int ec)
+{
+	if (pnum < 0 || pnum >= ubi->peb_count || ec < 0 ||
+	    ec > UBI_MAX_ERASECOUNTER) {
+		dbg_bld("bad PEB %d, EC %d in fastmap", pnum, ec);
+		return UBI_BAD_FASTMAP;
+	}
+
+	if (__test_and_set_bit(pnum, seen)) {
+		dbg_bld("PEB %d is referred to twice in fastmap", pnum);
+		return UBI_BAD_FASTMAP;
+	}
+
+	return 0;
+}
+
+/**
+ * add_ec - account an erase counter found in the fastmap.
+ * @si: scanning information
+ * @ec: the erase counter
+ */
+static void add_ec(struct ubi_scan_info *si, int ec)
+{
+	si->ec_sum += ec;
+	si->ec_count += 1;
+	if (ec > si->max_ec)
+		si->max_ec = ec;
+	if (ec < si->min_ec)
+		si->min_ec = ec;
+}
+
+/**
+ * attach_fastmap - build scanning information from the fastmap.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ * @dirty: bit mask of the non-empty PEBs in the anchor area
+ * @vh: a buffer for VID headers
+ *
+ * This function parses the fastmap in @ubi->fm_buf and fills @si the same way
+ * scanning would. The pool PEBs and the PEBs the fastmap does not know about
+ * are scanned. Returns zero in case of success, %UBI_BAD_FASTMAP if the
+ * fastmap is inconsistent, and a negative error code in case of failure.
+ */
+static int attach_fastmap(struct ubi_device *ubi, struct ubi_scan_info *si,
+			  u64 dirty, struct ubi_vid_hdr *vh)
+{
+	struct ubi_fm_sb *sb = ubi->fm_buf;
+	struct ubi_fm_hdr *fmh;
+	struct ubi_fm_ec *fmec;
+	struct ubi_fm_volhdr *fmvh;
+	struct ubi_fm_leb *fml;
+	struct ubi_fastmap_layout *fm;
+	struct ubi_wl_entry *e;
+	unsigned long *seen;
+	__be32 *scan;
+	int i, j, err, pnum, ec, vol_id, free_count, erase_count, erase;
+	int pos = 0;
+
+	seen = kzalloc(BITS_TO_LONGS(ubi->peb_count) * sizeof(long),
+		       GFP_KERNEL);
+	if (!seen)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	fm = kzalloc(sizeof(struct ubi_fastmap_layout), GFP_KERNEL);
+	if (!fm)
+		goto out_free;
+
+	/* The fastmap PEBs themselves */
+	for (i = 0; i < be32_to_cpu(sb->used_blocks); i++) {
+		pnum = be32_to_cpu(sb->block_loc[i]);
+		ec = be32_to_cpu(sb->block_ec[i]);
+		err = claim_peb(ubi, seen, pnum, ec);
+		if (err)
+			goto out_free;
+
+		err = -ENOMEM;
+		e = kmem_cache_alloc(ubi_wl_entry_slab, GFP_KERNEL);
+		if (!e)
+			goto out_free;
+		e->pnum = pnum;
+		e->ec = ec;
+		fm->e[fm->used_blocks++] = e;
+		add_ec(si, ec);
+	}
+
+	err = UBI_BAD_FASTMAP;
+	fmh = fm_pull(ubi, &pos, sizeof(struct ubi_fm_hdr));
+	if (!fmh || be32_to_cpu(fmh->magic) != UBI_FM_HDR_MAGIC)
+		goto out_free;
+
+	/*
+	 * Free and "to be erased" PEBs. A free PEB in the anchor area which is
+	 * not empty is most probably a left-over of an interrupted fastmap
+	 * write, so it is erased. A "to be erased" PEB may have gone bad after
+	 * the fastmap was written, in which case it is scanned to be accounted
+	 * as bad.
+	 */
+	free_count = be32_to_cpu(fmh->free_peb_count);
+	erase_count = be32_to_cpu(fmh->erase_peb_count);
+	for (i = 0; i < free_count + erase_count; i++) {
+		err = UBI_BAD_FASTMAP;
+		fmec = fm_pull(ubi, &pos, sizeof(struct ubi_fm_ec));
+		if (!fmec)
+			goto out_free;
+
+		pnum = be32_to_cpu(fmec->pnum);
+		ec = be32_to_cpu(fmec->ec);
+		err = claim_peb(ubi, seen, pnum, ec);
+		if (err)
+			goto out_free;
+
+		erase = i >= free_count;
+		if (erase) {
+			err = ubi_io_is_bad(ubi, pnum);
+			if (err < 0)
+				goto out_bad;
+			if (err) {
+				err = ubi_scan_peb(ubi, si, pnum);
+				if (err)
+					goto out_bad;
+				continue;
+			}
+		}
+		if (pnum < UBI_FM_MAX_START && (dirty & (1ULL << pnum)))
+			erase = 1;
+		err = ubi_scan_add_peb(si, pnum, ec, erase);
+		if (err)
+			goto out_free;
+		add_ec(si, ec);
+	}
+
+	/* Volumes and their mapped LEBs */
+	for (i = 0; i < be32_to_cpu(fmh->vol_count); i++) {
+		err = UBI_BAD_FASTMAP;
+		fmvh = fm_pull(ubi, &pos, sizeof(struct ubi_fm_volhdr));
+		if (!fmvh || be32_to_cpu(fmvh->magic) != UBI_FM_VHDR_MAGIC)
+			goto out_free;
+
+		vol_id = be32_to_cpu(fmvh->vol_id);
+		if ((vol_id < 0 || vol_id >= UBI_MAX_VOLUMES) &&
+		    vol_id != UBI_LAYOUT_VOLUME_ID)
+			goto out_free;
+		if (fmvh->vol_type != UBI_VID_DYNAMIC &&
+		    fmvh->vol_type != UBI_VID_STATIC)
+			goto out_free;
+
+		/* Make up the VID header scanning would have found */
+		memset(vh, 0, sizeof(struct ubi_vid_hdr));
+		vh->vol_type = fmvh->vol_type;
+		vh->vol_id = fmvh->vol_id;
+		vh->data_pad = fmvh->data_pad;
+		vh->used_ebs = fmvh->used_ebs;
+		vh->data_size = fmvh->last_eb_bytes;
+		if (vol_id == UBI_LAYOUT_VOLUME_ID)
+			vh->compat = UBI_LAYOUT_VOLUME_COMPAT;
+
+		for (j = 0; j < be32_to_cpu(fmvh->leb_count); j++) {
+			err = UBI_BAD_FASTMAP;
+			fml = fm_pull(ubi, &pos, sizeof(struct ubi_fm_leb));
+			if (!fml)
+				goto out_free;
+
+			pnum = be32_to_cpu(fml->pnum);
+			ec = be32_to_cpu(fml->ec);
+			err = claim_peb(ubi, seen, pnum, ec);
+			if (err)
+				goto out_free;
+
+			vh->lnum = fml->lnum;
+			err = ubi_scan_add_used(ubi, si, pnum, ec, vh, 0);
+			if (err)
+				goto out_bad;
+			add_ec(si, ec);
+		}
+	}
+
+	/*
+	 * The PEBs of both pools and the PEBs which were in use, but not mapped
+	 * when the fastmap was written. These may contain LEBs newer than the
+	 * ones recorded in the fastmap.
+	 */
+	for (i = 0; i < be32_to_cpu(fmh->scan_peb_count); i++) {
+		err = UBI_BAD_FASTMAP;
+		scan = fm_pull(ubi, &pos, sizeof(__be32));
+		if (!scan)
+			goto out_free;
+
+		pnum = be32_to_cpu(*scan);
+		err = claim_peb(ubi, seen, pnum, 0);
+		if (err)
+			goto out_free;
+
+		err = ubi_scan_peb(ubi, si, pnum);
+		if (err)
+			goto out_bad;
+	}
+
+	err = UBI_BAD_FASTMAP;
+	if (pos != be32_to_cpu(sb->data_size))
+		goto out_free;
+
+	/* Bad, corrupted and other PEBs the fastmap does not know about */
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (test_bit(pnum, seen))
+			continue;
+
+		cond_resched();
+		err = ubi_scan_peb(ubi, si, pnum);
+		if (err)
+			goto out_bad;
+	}
+
+	if (si->max_sqnum < be64_to_cpu(sb->sqnum))
+		si->max_sqnum = be64_to_cpu(sb->sqnum);
+
+	ubi->fm = fm;
+	kfree(seen);
+	return 0;
+
+out_bad:
+	/* Let scanning report real errors, unless we are out of memory */
+	if (err != -ENOMEM)
+		err = UBI_BAD_FASTMAP;
+out_free:
+	if (fm) {
+		for (i = 0; i < fm->used_blocks; i++)
+			kmem_cache_free(ubi_wl_entry_slab, fm->e[i]);
+		kfree(fm);
+	}
+	kfree(seen);
+	return err;
+}
+
+/**
+ * ubi_scan_fastmap - attach an UBI device using the fastmap.
+ * @ubi: UBI device description object
+ * @si: scanning information to fill
+ *
+ * This function is called from 'ubi_scan()' before anything is scanned.
+ * Returns zero if @si was filled using the fastmap, %UBI_NO_FASTMAP if there
+ * is no fastmap, %UBI_BAD_FASTMAP if the fastmap cannot be used and @si has to
+ * be thrown away, and a negative error code in case of failure.
+ */
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int err, anchor;
+	u64 dirty;
+	struct ubi_ec_hdr *ech;
+	struct ubi_vid_hdr *vh;
+
+	if (ubi->fm_disabled)
+		return UBI_NO_FASTMAP;
+
+	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ech)
+		return -ENOMEM;
+
+	err = -ENOMEM;
+	vh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vh)
+		goto out_ech;
+
+	anchor = find_anchor(ubi, vh, &dirty);
+	if (anchor == -ENOENT) {
+		err = UBI_NO_FASTMAP;
+		goto out_vh;
+	} else if (anchor < 0) {
+		err = anchor;
+		goto out_vh;
+	}
+
+	/* The pool PEBs have to have the same image sequence number */
+	err = ubi_io_read_ec_hdr(ubi, anchor, ech, 0);
+	if (err && err != UBI_IO_BITFLIPS) {
+		err = UBI_BAD_FASTMAP;
+		goto out_bad;
+	}
+	if (ech->version != UBI_VERSION) {
+		err = UBI_BAD_FASTMAP;
+		goto out_bad;
+	}
+	ubi->image_seq = be32_to_cpu(ech->image_seq);
+
+	err = read_fastmap(ubi, anchor, vh);
+	if (!err)
+		err = attach_fastmap(ubi, si, dirty, vh);
+
+out_bad:
+	if (err == UBI_BAD_FASTMAP)
+		ubi_warn("fastmap at PEB %d cannot be used, scan the device",
+			 anchor);
+	else if (!err)
+		ubi_msg("attached using fastmap at PEB %d", anchor);
+out_vh:
+	ubi_free_vid_hdr(ubi, vh);
+out_ech:
+	kfree(ech);
+	return err;
+}
+
+/**
+ * fm_push - reserve room for a record in @ubi->fm_buf.
+ * @ubi: UBI device description object
+ * @pos: current position in @ubi->fm_buf
+ * @len: length of the record
+ *
+ * Returns a pointer to the record or %NULL if there is no room.
+ */
+static void *fm_push(struct ubi_device *ubi, int *pos, int len)
+{
+	void *p;
+
+	if (*pos + len > ubi->fm_size)
+		return NULL;
+
+	p = ubi->fm_buf + *pos;
+	*pos += len;
+	return p;
+}
+
+/**
+ * push_ec - add a free or "to be erased" PEB record to the fastmap.
+ * @ubi: UBI device description object
+ * @pos: current position in @ubi->fm_buf
+ * @e: the WL entry of the PEB
+ *
+ * Returns zero in case of success and %-ENOSPC if there is no room.
+ */
+static int push_ec(struct ubi_device *ubi, int *pos, struct ubi_wl_entry *e)
+{
+	struct ubi_fm_ec *fmec;
+
+	fmec = fm_push(ubi, pos, sizeof(struct ubi_fm_ec));
+	if (!fmec)
+		return -ENOSPC;
+
+	fmec->pnum = cpu_to_be32(e->pnum);
+	fmec->ec = cpu_to_be32(e->ec);
+	return 0;
+}
+
+/**
+ * write_fastmap - serialize the current state and write it to the flash.
+ * @ubi: UBI device description object
+ * @new: the PEBs to write the fastmap to
+ * @released: the PEBs put since the last fastmap are returned here
+ *
+ * This function has to be called with @ubi->fm_sem held for writing, so no PEBs
+ * can be taken from the free tree or the pool meanwhile. The deferred PEBs and
+ * the PEBs of the previous fastmap are recorded as "to be erased", and the
+ * caller has to schedule them for erasure once the new fastmap is on the
+ * flash. Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int write_fastmap(struct ubi_device *ubi,
+			 struct ubi_fastmap_layout *new,
+			 struct list_head *released)
+{
+	struct ubi_fm_sb *sb = ubi->fm_buf;
+	struct ubi_fm_hdr *fmh;
+	struct ubi_fm_volhdr *fmvh;
+	struct ubi_fm_leb *fml;
+	struct ubi_wl_entry *e;
+	struct ubi_work *wrk;
+	struct ubi_vid_hdr *vh;
+	struct rb_node *rb;
+	unsigned long long sqnum[UBI_FM_MAX_BLOCKS];
+	int *peb_ec = ubi->fm_peb_ec;
+	int i, j, err, pnum, len, leb_count, pos = sizeof(struct ubi_fm_sb);
+	int free_count = 0, erase_count = 0, vol_count = 0, scan_count = 0;
+	__be32 *scan;
+
+	vh = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vh)
+		return -ENOMEM;
+
+	memset(ubi->fm_buf, 0, ubi->fm_size);
+	for (i = 0; i < ubi->peb_count; i++)
+		peb_ec[i] = FM_PEB_UNUSED;
+	fmh = fm_push(ubi, &pos, sizeof(struct ubi_fm_hdr));
+
+	err = -ENOSPC;
+	spin_lock(&ubi->wl_lock);
+
+	/* From now on put PEBs have to stay until the next fastmap is written */
+	ubi->fm_defer = 1;
+	list_splice_init(&ubi->fm_deferred, released);
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, u.rb) {
+		if (push_ec(ubi, &pos, e))
+			goto out_unlock;
+		free_count += 1;
+	}
+
+	list_for_each_entry(wrk, &ubi->works, list) {
+		if (!ubi_is_erase_work(wrk))
+			continue;
+		if (push_ec(ubi, &pos, wrk->e))
+			goto out_unlock;
+		erase_count += 1;
+	}
+	list_for_each_entry(e, released, u.list) {
+		if (push_ec(ubi, &pos, e))
+			goto out_unlock;
+		erase_count += 1;
+	}
+	if (ubi->fm)
+		for (i = 0; i < ubi->fm->used_blocks; i++) {
+			if (push_ec(ubi, &pos, ubi->fm->e[i]))
+				goto out_unlock;
+			erase_count += 1;
+		}
+
+	/*
+	 * Used PEBs are recorded below, when we walk the EBA tables. PEBs
+	 * which need scrubbing are just scanned on attach, as well as the
+	 * PEBs of both pools.
+	 */
+	ubi_rb_for_each_entry(rb, e, &ubi->used, u.rb)
+		peb_ec[e->pnum] = e->ec;
+	for (i = 0; i < UBI_PROT_QUEUE_LEN; i++)
+		list_for_each_entry(e, &ubi->pq[i], u.list)
+			peb_ec[e->pnum] = e->ec;
+	ubi_rb_for_each_entry(rb, e, &ubi->scrub, u.rb)
+		peb_ec[e->pnum] = FM_PEB_SCAN;
+	ubi_rb_for_each_entry(rb, e, &ubi->erroneous, u.rb)
+		peb_ec[e->pnum] = FM_PEB_SCAN;
+	for (i = ubi->fm_pool_used; i < ubi->fm_pool_size; i++)
+		peb_ec[ubi->fm_pool[i]->pnum] = FM_PEB_SCAN;
+	for (i = ubi->fm_wl_pool_used; i < ubi->fm_wl_pool_size; i++)
+		peb_ec[ubi->fm_wl_pool[i]->pnum] = FM_PEB_SCAN;
+	spin_unlock(&ubi->wl_lock);
+
+	spin_lock(&ubi->volumes_lock);
+	for (i = 0; i < UBI_MAX_VOLUMES + UBI_INT_VOL_COUNT; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+
+		if (!vol || !vol->eba_tbl)
+			continue;
+
+		fmvh = fm_push(ubi, &pos, sizeof(struct ubi_fm_volhdr));
+		if (!fmvh)
+			goto out_unlock_vol;
+
+		fmvh->magic = cpu_to_be32(UBI_FM_VHDR_MAGIC);
+		fmvh->vol_id = cpu_to_be32(vol->vol_id);
+		fmvh->data_pad = cpu_to_be32(vol->data_pad);
+		if (vol->vol_type == UBI_STATIC_VOLUME) {
+			fmvh->vol_type = UBI_VID_STATIC;
+			fmvh->used_ebs = cpu_to_be32(vol->used_ebs);
+			fmvh->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		} else
+			fmvh->vol_type = UBI_VID_DYNAMIC;
+
+		leb_count = 0;
+		for (j = 0; j < vol->reserved_pebs; j++) {
+			pnum = vol->eba_tbl[j];
+			if (pnum < 0 || peb_ec[pnum] < 0)
+				continue;
+
+			fml = fm_push(ubi, &pos, sizeof(struct ubi_fm_leb));
+			if (!fml)
+				goto out_unlock_vol;
+
+			fml->lnum = cpu_to_be32(j);
+			fml->pnum = cpu_to_be32(pnum);
+			fml->ec = cpu_to_be32(peb_ec[pnum]);
+			peb_ec[pnum] = FM_PEB_UNUSED;
+			leb_count += 1;
+		}
+		fmvh->leb_count = cpu_to_be32(leb_count);
+		vol_count += 1;
+	}
+	spin_unlock(&ubi->volumes_lock);
+
+	/* Whatever is left has to be scanned on attach */
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (peb_ec[pnum] == FM_PEB_UNUSED)
+			continue;
+
+		scan = fm_push(ubi, &pos, sizeof(__be32));
+		if (!scan)
+			goto out_free;
+		*scan = cpu_to_be32(pnum);
+		scan_count += 1;
+	}
+
+	fmh->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+	fmh->free_peb_count = cpu_to_be32(free_count);
+	fmh->erase_peb_count = cpu_to_be32(erase_count);
+	fmh->vol_count = cpu_to_be32(vol_count);
+	fmh->scan_peb_count = cpu_to_be32(scan_count);
+
+	for (i = 0; i < new->used_blocks; i++)
+		sqnum[i] = ubi_next_sqnum(ubi);
+
+	sb->magic = cpu_to_be32(UBI_FM_SB_MAGIC);
+	sb->version = UBI_FM_FMT_VERSION;
+	sb->used_blocks = cpu_to_be32(new->used_blocks);
+	for (i = 0; i < new->used_blocks; i++) {
+		sb->block_loc[i] = cpu_to_be32(new->e[i]->pnum);
+		sb->block_ec[i] = cpu_to_be32(new->e[i]->ec);
+	}
+	sb->sqnum = cpu_to_be64(sqnum[new->used_blocks - 1]);
+	sb->data_size = cpu_to_be32(pos - sizeof(struct ubi_fm_sb));
+	sb->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT,
+					 ubi->fm_buf + sizeof(struct ubi_fm_sb),
+					 pos - sizeof(struct ubi_fm_sb)));
+	sb->sb_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, sb,
+				       sizeof(struct ubi_fm_sb) -
+				       sizeof(__be32)));
+
+	/*
+	 * The anchor goes first. Once it is on the flash, the previous
+	 * fastmap is not used anymore, even if we fail to write the rest.
+	 */
+	for (i = 0; i < new->used_blocks; i++) {
+		pnum = new->e[i]->pnum;
+
+		memset(vh, 0, sizeof(struct ubi_vid_hdr));
+		vh->vol_type = UBI_FM_VOLUME_TYPE;
+		vh->vol_id = cpu_to_be32(i ? UBI_FM_DATA_VOLUME_ID :
+					     UBI_FM_SB_VOLUME_ID);
+		vh->compat = UBI_FM_VOLUME_COMPAT;
+		vh->lnum = cpu_to_be32(i);
+		vh->sqnum = cpu_to_be64(sqnum[i]);
+
+		err = ubi_io_write_vid_hdr(ubi, pnum, vh);
+		if (err)
+			goto out_free;
+
+		len = min_t(int, ubi->leb_size, pos - i * ubi->leb_size);
+		if (len <= 0)
+			continue;
+		len = ALIGN(len, ubi->min_io_size);
+		err = ubi_io_write_data(ubi, ubi->fm_buf + i * ubi->leb_size,
+					pnum, 0, len);
+		if (err)
+			goto out_free;
+	}
+
+	dbg_msg("fastmap written: %d free, %d to erase, %d volumes, %d to scan",
+		free_count, erase_count, vol_count, scan_count);
+	ubi_free_vid_hdr(ubi, vh);
+	return 0;
+
+out_unlock_vol:
+	spin_unlock(&ubi->volumes_lock);
+	goto out_free;
+out_unlock:
+	spin_unlock(&ubi->wl_lock);
+out_free:
+	ubi_free_vid_hdr(ubi, vh);
+	return err;
+}
+
+/**
+ * invalidate_fastmap - make sure the fastmap on the flash is not used.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called with @ubi->fm_sem held for writing. The
+ * anchor PEB of the fastmap is erased synchronously, the deferred PEBs and the
+ * unused pool PEBs are returned to the WL sub-system. Returns non-zero if
+ * there was something to invalidate.
+ */
+static int invalidate_fastmap(struct ubi_device *ubi)
+{
+	struct ubi_fastmap_layout *fm;
+	LIST_HEAD(deferred);
+	int i, err;
+
+	spin_lock(&ubi->wl_lock);
+	fm = ubi->fm;
+	if (!fm && !ubi->fm_defer) {
+		spin_unlock(&ubi->wl_lock);
+		return 0;
+	}
+	ubi->fm = NULL;
+	ubi->fm_defer = 0;
+	list_splice_init(&ubi->fm_deferred, &deferred);
+	spin_unlock(&ubi->wl_lock);
+
+	dbg_msg("invalidate fastmap");
+	ubi_wl_return_fm_pool(ubi);
+
+	if (fm) {
+		/* The deferred PEBs may only be erased once the anchor is gone */
+		err = ubi_wl_put_fm_peb(ubi, fm->e[0], 1);
+		if (err) {
+			ubi_err("cannot erase fastmap anchor PEB %d, error %d",
+				fm->e[0]->pnum, err);
+			ubi_ro_mode(ubi);
+			spin_lock(&ubi->wl_lock);
+			list_splice(&deferred, &ubi->fm_deferred);
+			spin_unlock(&ubi->wl_lock);
+			kfree(fm);
+			return 1;
+		}
+
+		for (i = 1; i < fm->used_blocks; i++)
+			ubi_wl_put_fm_peb(ubi, fm->e[i], 0);
+		kfree(fm);
+	}
+
+	ubi_wl_release_deferred(ubi, &deferred);
+	return 1;
+}
+
+/**
+ * update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ * @refill: if the fastmap has to be written only if the pool is exhausted
+ *
+ * If the new fastmap cannot be written, the old one is invalidated and UBI
+ * continues without fastmap. Returns zero in case of success and a negative
+ * error code in case of failure.
+ */
+static int update_fastmap(struct ubi_device *ubi, int refill)
+{
+	struct ubi_fastmap_layout *new, *old;
+	LIST_HEAD(released);
+	int i, err = 0;
+
+	down_write(&ubi->fm_sem);
+	if (ubi->fm_disabled || ubi->ro_mode)
+		goto out_unlock;
+
+	/* Somebody could have refilled the pool while we were waiting */
+	if (refill && ubi->fm && ubi->fm_pool_used < ubi->fm_pool_size)
+		goto out_unlock;
+
+	err = -ENOMEM;
+	new = kzalloc(sizeof(struct ubi_fastmap_layout), GFP_NOFS);
+	if (!new)
+		goto out_invalidate;
+
+	err = -ENOSPC;
+	for (i = 0; i < ubi->fm_blocks; i++) {
+		new->e[i] = ubi_wl_get_fm_peb(ubi, i == 0);
+		if (!new->e[i])
+			goto out_put;
+		new->used_blocks += 1;
+	}
+
+	ubi_wl_refill_fm_pool(ubi);
+	err = write_fastmap(ubi, new, &released);
+	if (err)
+		goto out_put;
+
+	spin_lock(&ubi->wl_lock);
+	old = ubi->fm;
+	ubi->fm = new;
+	spin_unlock(&ubi->wl_lock);
+
+	/* These are recorded as "to be erased" in the new fastmap */
+	if (old) {
+		for (i = 0; i < old->used_blocks; i++)
+			ubi_wl_put_fm_peb(ubi, old->e[i], 0);
+		kfree(old);
+	}
+	ubi_wl_release_deferred(ubi, &released);
+
+	up_write(&ubi->fm_sem);
+	return 0;
+
+out_put:
+	for (i = 0; i < new->used_blocks; i++)
+		ubi_wl_put_fm_peb(ubi, new->e[i], 0);
+	kfree(new);
+out_invalidate:
+	ubi_warn("cannot write fastmap, error %d", err);
+	invalidate_fastmap(ubi);
+	ubi_wl_release_deferred(ubi, &released);
+out_unlock:
+	up_write(&ubi->fm_sem);
+	return err;
+}
+
+/**
+ * ubi_update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure. Might sleep.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	return update_fastmap(ubi, 0);
+}
+
+/**
+ * ubi_refill_fastmap_pool - write a new fastmap if the pool is exhausted.
+ * @ubi: UBI device description object
+ *
+ * Returns zero in case of success and a negative error code in case of
+ * failure. Might sleep.
+ */
+int ubi_refill_fastmap_pool(struct ubi_device *ubi)
+{
+	return update_fastmap(ubi, 1);
+}
+
+/**
+ * ubi_fastmap_invalidate - invalidate the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function has to be called before UBI does anything the fastmap on the
+ * flash cannot describe. A new fastmap is written in background later. Might
+ * sleep.
+ */
+void ubi_fastmap_invalidate(struct ubi_device *ubi)
+{
+	int invalidated;
+
+	if (ubi->fm_disabled && !ubi->fm)
+		return;
+
+	down_write(&ubi->fm_sem);
+	invalidated = invalidate_fastmap(ubi);
+	up_write(&ubi->fm_sem);
+
+	if (invalidated && !ubi->fm_disabled)
+		schedule_work(&ubi->fm_work);
+}
@@ -1011,6 +1011,26 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
 	}
 
 	vol_id = be32_to_cpu(vidh->vol_id);
+	if (vol_id == UBI_FM_SB_VOLUME_ID || vol_id == UBI_FM_DATA_VOLUME_ID) {
+		/*
+		 * A fastmap PEB met by scanning belongs to a fastmap which is
+		 * not used, so it is just erased. The anchor PEB is erased
+		 * right away - the fastmap must not be used by the next
+		 * attach, because we are about to change the flash contents.
+		 */
+		dbg_bld("fastmap PEB %d (volume %d) found", pnum, vol_id);
+		if (vol_id == UBI_FM_SB_VOLUME_ID && !ec_err) {
+			err = ubi_scan_erase_peb(ubi, si, pnum, ec + 1);
+			if (err)
+				return err;
+			err = add_to_list(si, pnum, ec + 1, 0, &si->free);
+		} else
+			err = add_to_list(si, pnum, ec, 1, &si->erase);
+		if (err)
+			return err;
+		goto adjust_mean_ec;
+	}
+
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
 		int lnum = be32_to_cpu(vidh->lnum);
 
@@ -1141,23 +1161,49 @@ static int check_what_we_have(struct ubi_device *ubi, struct ubi_scan_info *si)
 }
 
 /**
- * ubi_scan - scan an MTD device.
+ * ubi_scan_peb - scan a physical eraseblock.
  * @ubi: UBI device description object
+ * @si: scanning information
+ * @pnum: the physical eraseblock number
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * This function is used by the fastmap code to scan the physical eraseblocks
+ * which are not described by the fastmap. It may only be called from within
+ * 'ubi_scan()'. Returns zero in case of success and a negative error code in
+ * case of failure.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+int ubi_scan_peb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum)
+{
+	return process_eb(ubi, si, pnum);
+}
+
+/**
+ * ubi_scan_add_peb - add a free or "to be erased" physical eraseblock.
+ * @si: scanning information
+ * @pnum: physical eraseblock number to add
+ * @ec: erase counter of the physical eraseblock
+ * @erase: if the physical eraseblock has to be erased
+ *
+ * This function is used by the fastmap code to add the free and "to be erased"
+ * physical eraseblocks recorded in the fastmap. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_scan_add_peb(struct ubi_scan_info *si, int pnum, int ec, int erase)
+{
+	return add_to_list(si, pnum, ec, 0, erase ? &si->erase : &si->free);
+}
+
+/**
+ * alloc_si - allocate scanning information.
+ *
+ * Returns the new scanning information object or %NULL if there is no memory.
+ */
+static struct ubi_scan_info *alloc_si(void)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
 	if (!si)
-		return ERR_PTR(-ENOMEM);
+		return NULL;
 
 	INIT_LIST_HEAD(&si->corr);
 	INIT_LIST_HEAD(&si->free);
@@ -1165,28 +1211,70 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	INIT_LIST_HEAD(&si->alien);
 	si->volumes = RB_ROOT;
 
-	err = -ENOMEM;
 	si->scan_leb_slab = kmem_cache_create("ubi_scan_leb_slab",
 					      sizeof(struct ubi_scan_leb),
 					      0, 0, NULL);
-	if (!si->scan_leb_slab)
-		goto out_si;
+	if (!si->scan_leb_slab) {
+		kfree(si);
+		return NULL;
+	}
 
+	return si;
+}
+
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function returns complete information about an MTD device. If the
+ * device has a valid fastmap, the information is mostly taken from there and
+ * only few PEBs are actually scanned. Otherwise this function does full
+ * scanning of the device. In case of failure, an error code is returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+{
+	int err, pnum;
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
+	struct ubi_scan_info *si;
+
+	si = alloc_si();
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+
+	err = -ENOMEM;
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
-		goto out_slab;
+		goto out_si;
 
 	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
 	if (!vidh)
 		goto out_ech;
 
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
-		cond_resched();
+	err = ubi_scan_fastmap(ubi, si);
+	if (err < 0)
+		goto out_vidh;
 
-		dbg_gen("process PEB %d", pnum);
-		err = process_eb(ubi, si, pnum);
-		if (err < 0)
-			goto out_vidh;
+	if (err == UBI_BAD_FASTMAP) {
+		/* Start over with clean scanning information */
+		ubi_scan_destroy_si(si);
+		si = alloc_si();
+		if (!si) {
+			err = -ENOMEM;
+			goto out_vidh_nosi;
+		}
+	}
+
+	if (err) {
+		for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+			cond_resched();
+
+			dbg_gen("process PEB %d", pnum);
+			err = process_eb(ubi, si, pnum);
+			if (err < 0)
+				goto out_vidh;
+		}
 	}
 
 	dbg_msg("scanning is finished");
@@ -1235,11 +1323,14 @@ out_vidh:
 	ubi_free_vid_hdr(ubi, vidh);
 out_ech:
 	kfree(ech);
-out_slab:
-	kmem_cache_destroy(si->scan_leb_slab);
 out_si:
 	ubi_scan_destroy_si(si);
 	return ERR_PTR(err);
+
+out_vidh_nosi:
+	ubi_free_vid_hdr(ubi, vidh);
+	kfree(ech);
+	return ERR_PTR(err);
 }
 
 /**
@@ -166,6 +166,8 @@ struct ubi_scan_leb *ubi_scan_find_seb(const struct ubi_scan_volume *sv,
 void ubi_scan_rm_volume(struct ubi_scan_info *si, struct ubi_scan_volume *sv);
 struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 					   struct ubi_scan_info *si);
+int ubi_scan_peb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum);
+int ubi_scan_add_peb(struct ubi_scan_info *si, int pnum, int ec, int erase);
 int ubi_scan_erase_peb(struct ubi_device *ubi, const struct ubi_scan_info *si,
 		       int pnum, int ec);
 struct ubi_scan_info *ubi_scan(struct ubi_device *ubi);
@@ -312,6 +312,17 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The fastmap internal volumes. The fastmap super block (the anchor) lives in
+ * the %UBI_FM_SB_VOLUME_ID volume, the rest of the fastmap data in the
+ * %UBI_FM_DATA_VOLUME_ID volume. Both have "delete" compatibility, so UBI
+ * implementations which do not know about fastmap simply erase them.
+ */
+#define UBI_FM_SB_VOLUME_ID      (UBI_INTERNAL_VOL_START + 1)
+#define UBI_FM_DATA_VOLUME_ID    (UBI_INTERNAL_VOL_START + 2)
+#define UBI_FM_VOLUME_TYPE       UBI_VID_DYNAMIC
+#define UBI_FM_VOLUME_COMPAT     UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -375,4 +386,127 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __packed;
 
+/* Fastmap on-flash data structures */
+
+#define UBI_FM_SB_MAGIC      0x7B11D69F
+#define UBI_FM_HDR_MAGIC     0xD4B82EF7
+#define UBI_FM_VHDR_MAGIC    0xFA370ED1
+#define UBI_FM_FMT_VERSION   1
+
+/* The fastmap super block has to be in one of the first 64 PEBs */
+#define UBI_FM_MAX_START     64
+
+/* The maximum number of PEBs the fastmap may occupy */
+#define UBI_FM_MAX_BLOCKS    32
+
+/* The maximum number of PEBs in the fastmap pool */
+#define UBI_FM_MAX_POOL_SIZE 256
+
+/**
+ * struct ubi_fm_sb - UBI fastmap super block.
+ * @magic: fastmap super block magic number (%UBI_FM_SB_MAGIC)
+ * @version: format version of this fastmap
+ * @padding1: reserved for future, zeroes
+ * @data_crc: CRC32 checksum of the fastmap data following the super block
+ * @used_blocks: number of PEBs used by this fastmap
+ * @block_loc: an array containing the location of all PEBs of the fastmap
+ * @block_ec: the erase counter of each used PEB
+ * @sqnum: highest sequence number value at the time the fastmap was written
+ * @data_size: size of the fastmap data following the super block in bytes
+ * @padding2: reserved for future, zeroes
+ * @sb_crc: CRC32 checksum of the super block
+ *
+ * The super block is stored at the beginning of the data area of the first
+ * fastmap PEB (the anchor PEB), which has to be one of the first
+ * %UBI_FM_MAX_START PEBs of the device. The fastmap data directly follows the
+ * super block and continues in the data areas of the other fastmap PEBs, in
+ * the order they are listed in @block_loc (@block_loc[0] is the anchor).
+ */
+struct ubi_fm_sb {
+	__be32 magic;
+	__u8   version;
+	__u8   padding1[3];
+	__be32 data_crc;
+	__be32 used_blocks;
+	__be32 block_loc[UBI_FM_MAX_BLOCKS];
+	__be32 block_ec[UBI_FM_MAX_BLOCKS];
+	__be64 sqnum;
+	__be32 data_size;
+	__u8   padding2[28];
+	__be32 sb_crc;
+} __packed;
+
+/**
+ * struct ubi_fm_hdr - header of the fastmap data.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @free_peb_count: number of free PEBs known by this fastmap
+ * @erase_peb_count: number of PEBs which have to be erased
+ * @vol_count: number of UBI volumes known by this fastmap
+ * @scan_peb_count: number of PEBs which have to be scanned on attach
+ * @padding: reserved for future, zeroes
+ *
+ * The header is followed by @free_peb_count free and @erase_peb_count "to be
+ * erased" &struct ubi_fm_ec records, then by @vol_count volume headers, each
+ * of them followed by the &struct ubi_fm_leb records of the volume, and
+ * finally by @scan_peb_count 32-bit big-endian PEB numbers. The latter are
+ * the pool PEBs and the PEBs which were in use but were not mapped when the
+ * fastmap was written.
+ */
+struct ubi_fm_hdr {
+	__be32 magic;
+	__be32 free_peb_count;
+	__be32 erase_peb_count;
+	__be32 vol_count;
+	__be32 scan_peb_count;
+	__u8   padding[12];
+} __packed;
+
+/**
+ * struct ubi_fm_ec - a free or "to be erased" PEB record.
+ * @pnum: PEB number
+ * @ec: erase counter of the PEB
+ */
+struct ubi_fm_ec {
+	__be32 pnum;
+	__be32 ec;
+} __packed;
+
+/**
+ * struct ubi_fm_volhdr - fastmap volume header.
+ * @magic: fastmap volume header magic number (%UBI_FM_VHDR_MAGIC)
+ * @vol_id: volume ID
+ * @vol_type: type of the volume (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @padding1: reserved for future, zeroes
+ * @data_pad: data padding value of the volume
+ * @used_ebs: number of used LEBs of a static volume
+ * @last_eb_bytes: number of bytes used in the last LEB of a static volume
+ * @leb_count: number of &struct ubi_fm_leb records following this header
+ * @padding2: reserved for future, zeroes
+ */
+struct ubi_fm_volhdr {
+	__be32 magic;
+	__be32 vol_id;
+	__u8   vol_type;
+	__u8   padding1[3];
+	__be32 data_pad;
+	__be32 used_ebs;
+	__be32 last_eb_bytes;
+	__be32 leb_count;
+	__u8   padding2[4];
+} __packed;
+
+/**
+ * struct ubi_fm_leb - a mapped LEB record.
+ * @lnum: logical eraseblock number
+ * @pnum: physical eraseblock the LEB is mapped to
+ * @ec: erase counter of the PEB
+ * @padding: reserved for future, zeroes
+ */
+struct ubi_fm_leb {
+	__be32 lnum;
+	__be32 pnum;
+	__be32 ec;
+	__u8   padding[4];
+} __packed;
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -38,6 +38,8 @@
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/notifier.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/ubi.h>
 #include <asm/pgtable.h>
@@ -108,6 +110,25 @@ enum {
 	UBI_IO_BITFLIPS,
 };
 
+/*
+ * Return codes of the 'ubi_scan_fastmap()' function.
+ *
+ * UBI_NO_FASTMAP: there is no fastmap on the flash
+ * UBI_BAD_FASTMAP: the fastmap is corrupted or inconsistent and the device has
+ *                  to be fully scanned
+ */
+enum {
+	UBI_NO_FASTMAP = 1,
+	UBI_BAD_FASTMAP,
+};
+
+/*
+ * The minimum number of PEBs in the fastmap pool. The pool is normally sized
+ * to 5% of the PEBs, but not more than %UBI_FM_MAX_POOL_SIZE. The pool of
+ * wear-leveling targets is half as large.
+ */
+#define UBI_FM_MIN_POOL_SIZE 8
+
 /*
  * Return codes of the 'ubi_eba_copy_leb()' function.
  *
@@ -150,6 +171,38 @@ struct ubi_wl_entry {
 	int pnum;
 };
 
+struct ubi_device;
+
+/**
+ * struct ubi_work - UBI work description data structure.
+ * @list: a link in the list of pending works
+ * @func: worker function
+ * @e: physical eraseblock to erase
+ * @torture: if the physical eraseblock has to be tortured
+ *
+ * The @func pointer points to the worker function. If the @cancel argument is
+ * not zero, the worker has to free the resources and exit immediately. The
+ * worker has to return zero in case of success and a negative error code in
+ * case of failure.
+ */
+struct ubi_work {
+	struct list_head list;
+	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
+	/* The below fields are only relevant to erasure works */
+	struct ubi_wl_entry *e;
+	int torture;
+};
+
+/**
+ * struct ubi_fastmap_layout - in-memory description of an on-flash fastmap.
+ * @e: PEBs used by the fastmap, @e[0] is the anchor PEB
+ * @used_blocks: number of used PEBs
+ */
+struct ubi_fastmap_layout {
+	struct ubi_wl_entry *e[UBI_FM_MAX_BLOCKS];
+	int used_blocks;
+};
+
 /**
  * struct ubi_ltree_entry - an entry in the lock tree.
  * @rb: links RB-tree nodes
@@ -342,7 +395,9 @@ struct ubi_wl_entry;
  * @pq_head: protection queue head
  * @wl_lock: protects the @used, @free, @pq, @pq_head, @lookuptbl, @move_from,
  *	     @move_to, @move_to_put @erase_pending, @wl_scheduled, @works,
- *	     @erroneous, and @erroneous_peb_count fields
+ *	     @erroneous, @erroneous_peb_count, @fm, @fm_pool, @fm_pool_size,
+ *	     @fm_pool_used, @fm_wl_pool, @fm_wl_pool_size, @fm_wl_pool_used,
+ *	     @fm_defer and @fm_deferred fields
  * @move_mutex: serializes eraseblock moves
  * @work_sem: synchronizes the WL worker with use tasks
  * @wl_scheduled: non-zero if the wear-leveling was scheduled
@@ -357,6 +412,31 @@ struct ubi_wl_entry;
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
  *
+ * @fm: the fastmap which is currently on the flash, %NULL if there is none
+ * @fm_pool: PEBs recorded in the fastmap, new PEBs are only taken from here
+ *           while there is a fastmap on the flash
+ * @fm_pool_size: number of PEBs in @fm_pool
+ * @fm_pool_used: number of PEBs in @fm_pool which were already handed out
+ * @fm_pool_max: maximum number of PEBs in @fm_pool
+ * @fm_wl_pool: PEBs recorded in the fastmap, the targets of wear-leveling and
+ *              scrubbing are only taken from here while there is a fastmap on
+ *              the flash
+ * @fm_wl_pool_size: number of PEBs in @fm_wl_pool
+ * @fm_wl_pool_used: number of PEBs in @fm_wl_pool which were already used
+ * @fm_wl_pool_max: maximum number of PEBs in @fm_wl_pool
+ * @fm_defer: if PEBs which are put have to be kept in @fm_deferred instead of
+ *            being erased
+ * @fm_deferred: PEBs which were put while @fm_defer was set, they are erased
+ *               when the next fastmap is written
+ * @fm_sem: serializes fastmap writing and invalidation with taking PEBs from
+ *          the free tree or the pools
+ * @fm_work: work which writes a new fastmap in background
+ * @fm_disabled: if fastmap is not used for this device
+ * @fm_blocks: how many PEBs a fastmap of this device occupies
+ * @fm_size: size of @fm_buf
+ * @fm_buf: buffer used for reading and writing fastmaps
+ * @fm_peb_ec: per-PEB scratch array used while writing a fastmap
+ *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
  * @peb_size: physical eraseblock size
@@ -444,6 +524,26 @@ struct ubi_device {
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
 
+	/* Fastmap stuff */
+	struct ubi_fastmap_layout *fm;
+	struct ubi_wl_entry **fm_pool;
+	int fm_pool_size;
+	int fm_pool_used;
+	int fm_pool_max;
+	struct ubi_wl_entry **fm_wl_pool;
+	int fm_wl_pool_size;
+	int fm_wl_pool_used;
+	int fm_wl_pool_max;
+	int fm_defer;
+	struct list_head fm_deferred;
+	struct rw_semaphore fm_sem;
+	struct work_struct fm_work;
+	int fm_disabled;
+	int fm_blocks;
+	int fm_size;
+	void *fm_buf;
+	int *fm_peb_ec;
+
 	/* I/O sub-system's stuff */
 	long long flash_size;
 	int peb_count;
@@ -529,6 +629,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		     struct ubi_vid_hdr *vid_hdr);
 int ubi_eba_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
 
 /* wl.c */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype);
@@ -538,6 +639,13 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+int ubi_is_erase_work(struct ubi_work *wrk);
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor);
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int sync);
+void ubi_wl_refill_fm_pool(struct ubi_device *ubi);
+void ubi_wl_return_fm_pool(struct ubi_device *ubi);
+void ubi_wl_release_deferred(struct ubi_device *ubi, struct list_head *list);
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -556,6 +664,31 @@ int ubi_io_read_vid_hdr(struct ubi_device *ubi, int pnum,
 int ubi_io_write_vid_hdr(struct ubi_device *ubi, int pnum,
 			 struct ubi_vid_hdr *vid_hdr);
 
+/* fastmap.c */
+#ifdef CONFIG_MTD_UBI_FASTMAP
+int ubi_fastmap_init(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+int ubi_scan_fastmap(struct ubi_device *ubi, struct ubi_scan_info *si);
+int ubi_update_fastmap(struct ubi_device *ubi);
+int ubi_refill_fastmap_pool(struct ubi_device *ubi);
+void ubi_fastmap_invalidate(struct ubi_device *ubi);
+#else
+static inline int ubi_fastmap_init(struct ubi_device *ubi)
+{
+	ubi->fm_disabled = 1;
+	return 0;
+}
+static inline void ubi_fastmap_close(struct ubi_device *ubi) {}
+static inline int ubi_scan_fastmap(struct ubi_device *ubi,
+				   struct ubi_scan_info *si)
+{
+	return UBI_NO_FASTMAP;
+}
+static inline int ubi_update_fastmap(struct ubi_device *ubi) { return 0; }
+static inline int ubi_refill_fastmap_pool(struct ubi_device *ubi) { return 0; }
+static inline void ubi_fastmap_invalidate(struct ubi_device *ubi) {}
+#endif
+
 /* build.c */
 int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset);
 int ubi_detach_mtd_dev(int ubi_num, int anyway);
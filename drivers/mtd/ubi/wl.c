@@ -141,26 +141,6 @@
  */
 #define WL_MAX_FAILURES 32
 
-/**
- * struct ubi_work - UBI work description data structure.
- * @list: a link in the list of pending works
- * @func: worker function
- * @e: physical eraseblock to erase
- * @torture: if the physical eraseblock has to be tortured
- *
- * The @func pointer points to the worker function. If the @cancel argument is
- * not zero, the worker has to free the resources and exit immediately. The
- * worker has to return zero in case of success and a negative error code in
- * case of failure.
- */
-struct ubi_work {
-	struct list_head list;
-	int (*func)(struct ubi_device *ubi, struct ubi_work *wrk, int cancel);
-	/* The below fields are only relevant to erasure works */
-	struct ubi_wl_entry *e;
-	int torture;
-};
-
 #ifdef CONFIG_MTD_UBI_DEBUG
 static int paranoid_check_ec(struct ubi_device *ubi, int pnum, int ec);
 static int paranoid_check_in_wl_tree(struct ubi_wl_entry *e,
@@ -376,6 +356,53 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
 	return e;
 }
 
+/**
+ * find_wl_target - find the target physical eraseblock for a move.
+ * @ubi: UBI device description object
+ * @scrubbing: if the data is moved for scrubbing
+ *
+ * While there is a fastmap on the flash, the attach code has to find the
+ * moved data, so the target is taken from the wear-leveling pool, or from the
+ * fastmap pool if the data has to be scrubbed. Otherwise a highly worn-out free
+ * physical eraseblock is picked. The eraseblock is not removed from where it
+ * was found, which is done by 'take_wl_target()'. Returns %NULL if there is no
+ * suitable eraseblock. This function has to be called with @ubi->wl_lock held.
+ */
+static struct ubi_wl_entry *find_wl_target(struct ubi_device *ubi,
+					   int scrubbing)
+{
+	if (ubi->fm) {
+		if (ubi->fm_wl_pool_used < ubi->fm_wl_pool_size)
+			return ubi->fm_wl_pool[ubi->fm_wl_pool_used];
+		if (scrubbing && ubi->fm_pool_used < ubi->fm_pool_size)
+			return ubi->fm_pool[ubi->fm_pool_used];
+		return NULL;
+	}
+
+	if (!ubi->free.rb_node)
+		return NULL;
+	return find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
+}
+
+/**
+ * take_wl_target - take the target physical eraseblock for a move.
+ * @ubi: UBI device description object
+ * @e: the eraseblock returned by 'find_wl_target()'
+ *
+ * This function has to be called with @ubi->wl_lock held, which must not have
+ * been released since @e was found.
+ */
+static void take_wl_target(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	if (!ubi->fm) {
+		paranoid_check_in_wl_tree(e, &ubi->free);
+		rb_erase(&e->u.rb, &ubi->free);
+	} else if (ubi->fm_wl_pool_used < ubi->fm_wl_pool_size)
+		ubi->fm_wl_pool_used += 1;
+	else
+		ubi->fm_pool_used += 1;
+}
+
 /**
  * ubi_wl_get_peb - get a physical eraseblock.
  * @ubi: UBI device description object
@@ -383,25 +410,52 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
  *
  * This function returns a physical eraseblock in case of success and a
  * negative error code in case of failure. Might sleep.
+ *
+ * While there is a fastmap on the flash, physical eraseblocks are taken from
+ * the fastmap pool and @dtype is ignored. When the pool is exhausted, a new
+ * fastmap with a fresh pool is written.
  */
 int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 {
-	int err, medium_ec;
+	int err, medium_ec, refilled = 0;
 	struct ubi_wl_entry *e, *first, *last;
 
 	ubi_assert(dtype == UBI_LONGTERM || dtype == UBI_SHORTTERM ||
 		   dtype == UBI_UNKNOWN);
 
 retry:
+	down_read(&ubi->fm_sem);
 	spin_lock(&ubi->wl_lock);
+	if (ubi->fm) {
+		if (ubi->fm_pool_used < ubi->fm_pool_size) {
+			e = ubi->fm_pool[ubi->fm_pool_used++];
+			goto out_protect;
+		}
+		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->fm_sem);
+
+		/*
+		 * The pool is exhausted. Write a new fastmap with a fresh pool,
+		 * and if this does not help, stop using fastmap for a while
+		 * and take PEBs from the free tree.
+		 */
+		if (!refilled++)
+			ubi_refill_fastmap_pool(ubi);
+		else
+			ubi_fastmap_invalidate(ubi);
+		goto retry;
+	}
+
 	if (!ubi->free.rb_node) {
 		if (ubi->works_count == 0) {
 			ubi_assert(list_empty(&ubi->works));
 			ubi_err("no free eraseblocks");
 			spin_unlock(&ubi->wl_lock);
+			up_read(&ubi->fm_sem);
 			return -ENOSPC;
 		}
 		spin_unlock(&ubi->wl_lock);
+		up_read(&ubi->fm_sem);
 
 		err = produce_free_peb(ubi);
 		if (err < 0)
@@ -450,15 +504,17 @@ retry:
 	}
 
 	paranoid_check_in_wl_tree(e, &ubi->free);
+	rb_erase(&e->u.rb, &ubi->free);
 
+out_protect:
 	/*
 	 * Move the physical eraseblock to the protection queue where it will
 	 * be protected from being moved for some time.
 	 */
-	rb_erase(&e->u.rb, &ubi->free);
 	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
 	prot_queue_add(ubi, e);
 	spin_unlock(&ubi->wl_lock);
+	up_read(&ubi->fm_sem);
 
 	err = ubi_dbg_check_all_ff(ubi, e->pnum, ubi->vid_hdr_aloffset,
 				   ubi->peb_size - ubi->vid_hdr_aloffset);
@@ -677,16 +733,20 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		return -ENOMEM;
 
 	mutex_lock(&ubi->move_mutex);
+	/* Make sure no fastmap is written while we pick the target PEB */
+	down_read(&ubi->fm_sem);
 	spin_lock(&ubi->wl_lock);
 	ubi_assert(!ubi->move_from && !ubi->move_to);
 	ubi_assert(!ubi->move_to_put);
 
-	if (!ubi->free.rb_node ||
-	    (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
+	e2 = find_wl_target(ubi, !!ubi->scrub.rb_node);
+	if (!e2 || (!ubi->used.rb_node && !ubi->scrub.rb_node)) {
 		/*
 		 * No free physical eraseblocks? Well, they must be waiting in
 		 * the queue to be erased. Cancel movement - it will be
 		 * triggered again when a free physical eraseblock appears.
+		 * With fastmap, the pools are refilled when the next fastmap
+		 * is written.
 		 *
 		 * No used physical eraseblocks? They must be temporarily
 		 * protected from being moved. They will be moved to the
@@ -694,7 +754,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * triggered again.
 		 */
 		dbg_wl("cancel WL, a list is empty: free %d, used %d",
-		       !ubi->free.rb_node, !ubi->used.rb_node);
+		       !e2, !ubi->used.rb_node);
 		goto out_cancel;
 	}
 
@@ -705,7 +765,6 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		 * counters differ much enough, start wear-leveling.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD)) {
 			dbg_wl("no WL needed: min used EC %d, max free EC %d",
@@ -720,17 +779,16 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		/* Perform scrubbing */
 		scrubbing = 1;
 		e1 = rb_entry(rb_first(&ubi->scrub), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 		paranoid_check_in_wl_tree(e1, &ubi->scrub);
 		rb_erase(&e1->u.rb, &ubi->scrub);
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
-	paranoid_check_in_wl_tree(e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	take_wl_target(ubi, e2);
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
+	up_read(&ubi->fm_sem);
 
 	/*
 	 * Now we are going to copy physical eraseblock @e1->pnum to @e2->pnum.
@@ -839,14 +897,24 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	}
 	ubi->move_from = ubi->move_to = NULL;
 	ubi->move_to_put = ubi->wl_scheduled = 0;
+	if (ubi->fm_defer) {
+		/*
+		 * The fastmap on the flash still maps the LEB to @e1, see
+		 * 'ubi_wl_put_peb()'.
+		 */
+		list_add_tail(&e1->u.list, &ubi->fm_deferred);
+		e1 = NULL;
+	}
 	spin_unlock(&ubi->wl_lock);
 
-	err = schedule_erase(ubi, e1, 0);
-	if (err) {
-		kmem_cache_free(ubi_wl_entry_slab, e1);
-		if (e2)
-			kmem_cache_free(ubi_wl_entry_slab, e2);
-		goto out_ro;
+	if (e1) {
+		err = schedule_erase(ubi, e1, 0);
+		if (err) {
+			kmem_cache_free(ubi_wl_entry_slab, e1);
+			if (e2)
+				kmem_cache_free(ubi_wl_entry_slab, e2);
+			goto out_ro;
+		}
 	}
 
 	if (e2) {
@@ -928,6 +996,7 @@ out_ro:
 out_cancel:
 	ubi->wl_scheduled = 0;
 	spin_unlock(&ubi->wl_lock);
+	up_read(&ubi->fm_sem);
 	mutex_unlock(&ubi->move_mutex);
 	ubi_free_vid_hdr(ubi, vid_hdr);
 	return 0;
@@ -958,7 +1027,8 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 	 * the WL worker has to be scheduled anyway.
 	 */
 	if (!ubi->scrub.rb_node) {
-		if (!ubi->used.rb_node || !ubi->free.rb_node)
+		e2 = find_wl_target(ubi, 0);
+		if (!ubi->used.rb_node || !e2)
 			/* No physical eraseblocks - no deal */
 			goto out_unlock;
 
@@ -969,7 +1039,6 @@ static int ensure_wear_leveling(struct ubi_device *ubi)
 		 * %UBI_WL_THRESHOLD.
 		 */
 		e1 = rb_entry(rb_first(&ubi->used), struct ubi_wl_entry, u.rb);
-		e2 = find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF);
 
 		if (!(e2->ec - e1->ec >= UBI_WL_THRESHOLD))
 			goto out_unlock;
@@ -1093,6 +1162,10 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 	}
 	spin_unlock(&ubi->volumes_lock);
 
+	/*
+	 * No need to invalidate the fastmap: it records this PEB as "to be
+	 * erased" or as one to scan, and the attach code notices it is bad.
+	 */
 	ubi_msg("mark PEB %d as bad", pnum);
 	err = ubi_io_mark_bad(ubi, pnum);
 	if (err)
@@ -1191,6 +1264,17 @@ retry:
 			}
 		}
 	}
+
+	if (ubi->fm_defer) {
+		/*
+		 * The fastmap on the flash may still refer to this PEB, so it
+		 * must not be erased before the next fastmap is written. Note,
+		 * deferred PEBs are not tortured.
+		 */
+		list_add_tail(&e->u.list, &ubi->fm_deferred);
+		spin_unlock(&ubi->wl_lock);
+		return 0;
+	}
 	spin_unlock(&ubi->wl_lock);
 
 	err = schedule_erase(ubi, e, torture);
@@ -1309,6 +1393,189 @@ int ubi_wl_flush(struct ubi_device *ubi)
 	return 0;
 }
 
+/**
+ * ubi_is_erase_work - check if a work is an erase work.
+ * @wrk: the work object
+ *
+ * The fastmap code uses this function to find out which PEBs are waiting for
+ * erasure.
+ */
+int ubi_is_erase_work(struct ubi_work *wrk)
+{
+	return wrk->func == erase_worker;
+}
+
+/**
+ * ubi_wl_get_fm_peb - get a physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @anchor: if the PEB is going to be the fastmap anchor
+ *
+ * This function takes a free physical eraseblock with low erase counter out
+ * of the free tree without adding it to the protection queue. Anchor PEBs are
+ * picked among the first %UBI_FM_MAX_START PEBs, the other fastmap PEBs
+ * preferably among the rest. Returns %NULL if there is no suitable PEB.
+ */
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor)
+{
+	struct rb_node *p;
+	struct ubi_wl_entry *e, *victim = NULL;
+
+	spin_lock(&ubi->wl_lock);
+	for (p = rb_first(&ubi->free); p; p = rb_next(p)) {
+		e = rb_entry(p, struct ubi_wl_entry, u.rb);
+		if (anchor) {
+			if (e->pnum < UBI_FM_MAX_START) {
+				victim = e;
+				break;
+			}
+		} else {
+			if (!victim)
+				victim = e;
+			if (e->pnum >= UBI_FM_MAX_START) {
+				victim = e;
+				break;
+			}
+		}
+	}
+
+	if (victim) {
+		rb_erase(&victim->u.rb, &ubi->free);
+		dbg_wl("PEB %d EC %d, anchor %d", victim->pnum, victim->ec,
+		       anchor);
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	return victim;
+}
+
+/**
+ * ubi_wl_put_fm_peb - return a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the WL entry of the physical eraseblock
+ * @sync: if the physical eraseblock has to be erased synchronously
+ *
+ * This function returns a physical eraseblock which was taken by
+ * 'ubi_wl_get_fm_peb()'. If @sync is not zero, it is erased before this
+ * function returns, which is used to make sure an outdated fastmap anchor is
+ * gone. This function returns zero in case of success and a negative error
+ * code in case of failure.
+ */
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int sync)
+{
+	int err;
+
+	dbg_wl("PEB %d EC %d, sync %d", e->pnum, e->ec, sync);
+
+	if (!sync)
+		return schedule_erase(ubi, e, 0);
+
+	err = sync_erase(ubi, e, 0);
+	if (err)
+		return err;
+
+	spin_lock(&ubi->wl_lock);
+	wl_tree_add(e, &ubi->free);
+	spin_unlock(&ubi->wl_lock);
+	return 0;
+}
+
+/**
+ * return_fm_pool - return unused PEBs of both pools to the free tree.
+ * @ubi: UBI device description object
+ *
+ * This is a helper for 'ubi_wl_return_fm_pool()' and
+ * 'ubi_wl_refill_fm_pool()' which has to be called with @ubi->wl_lock held.
+ */
+static void return_fm_pool(struct ubi_device *ubi)
+{
+	while (ubi->fm_pool_used < ubi->fm_pool_size)
+		wl_tree_add(ubi->fm_pool[ubi->fm_pool_used++], &ubi->free);
+	ubi->fm_pool_size = ubi->fm_pool_used = 0;
+	while (ubi->fm_wl_pool_used < ubi->fm_wl_pool_size)
+		wl_tree_add(ubi->fm_wl_pool[ubi->fm_wl_pool_used++],
+			    &ubi->free);
+	ubi->fm_wl_pool_size = ubi->fm_wl_pool_used = 0;
+}
+
+/**
+ * ubi_wl_return_fm_pool - return unused PEBs of both pools to the free tree.
+ * @ubi: UBI device description object
+ */
+void ubi_wl_return_fm_pool(struct ubi_device *ubi)
+{
+	spin_lock(&ubi->wl_lock);
+	return_fm_pool(ubi);
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_refill_fm_pool - refill the fastmap and wear-leveling pools.
+ * @ubi: UBI device description object
+ *
+ * This function returns the unused PEBs of both pools to the free tree and
+ * fills the fastmap pool again with up to @ubi->fm_pool_max free PEBs with the
+ * lowest erase counters. The wear-leveling pool gets up to
+ * @ubi->fm_wl_pool_max of the remaining free PEBs, starting with the one
+ * wear-leveling would pick from the free tree and going down in erase
+ * counters. PEBs which may serve as fastmap anchor are left in the free tree.
+ */
+void ubi_wl_refill_fm_pool(struct ubi_device *ubi)
+{
+	struct rb_node *p, *next;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	return_fm_pool(ubi);
+	for (p = rb_first(&ubi->free);
+	     p && ubi->fm_pool_size < ubi->fm_pool_max; p = next) {
+		next = rb_next(p);
+		e = rb_entry(p, struct ubi_wl_entry, u.rb);
+		if (e->pnum < UBI_FM_MAX_START)
+			continue;
+		rb_erase(&e->u.rb, &ubi->free);
+		ubi->fm_pool[ubi->fm_pool_size++] = e;
+	}
+
+	p = NULL;
+	if (ubi->free.rb_node)
+		p = &find_wl_entry(&ubi->free, WL_FREE_MAX_DIFF)->u.rb;
+	for (; p && ubi->fm_wl_pool_size < ubi->fm_wl_pool_max; p = next) {
+		next = rb_prev(p);
+		e = rb_entry(p, struct ubi_wl_entry, u.rb);
+		if (e->pnum < UBI_FM_MAX_START)
+			continue;
+		rb_erase(&e->u.rb, &ubi->free);
+		ubi->fm_wl_pool[ubi->fm_wl_pool_size++] = e;
+	}
+	dbg_wl("%d PEBs in the pool, %d in the WL pool", ubi->fm_pool_size,
+	       ubi->fm_wl_pool_size);
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_release_deferred - schedule erasure of deferred PEBs.
+ * @ubi: UBI device description object
+ * @list: list of PEBs which were put while erasure was deferred
+ *
+ * This function schedules all the physical eraseblocks in @list for erasure.
+ * If a work cannot be allocated, the PEB is moved back to the used tree, the
+ * same way 'ubi_wl_put_peb()' does.
+ */
+void ubi_wl_release_deferred(struct ubi_device *ubi, struct list_head *list)
+{
+	struct ubi_wl_entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, list, u.list) {
+		list_del(&e->u.list);
+		if (schedule_erase(ubi, e, 0)) {
+			spin_lock(&ubi->wl_lock);
+			wl_tree_add(e, &ubi->used);
+			spin_unlock(&ubi->wl_lock);
+		}
+	}
+}
+
 /**
  * tree_destroy - destroy an RB-tree.
  * @root: the root of the tree to destroy
@@ -1429,6 +1696,7 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	struct ubi_scan_volume *sv;
 	struct ubi_scan_leb *seb, *tmp;
 	struct ubi_wl_entry *e;
+	int reserved_pebs = WL_RESERVED_PEBS;
 
 	ubi->used = ubi->erroneous = ubi->free = ubi->scrub = RB_ROOT;
 	spin_lock_init(&ubi->wl_lock);
@@ -1501,16 +1769,45 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		}
 	}
 
-	if (ubi->avail_pebs < WL_RESERVED_PEBS) {
+	if (ubi->fm) {
+		/* The PEBs of the fastmap we have attached from */
+		for (i = 0; i < ubi->fm->used_blocks; i++) {
+			e = ubi->fm->e[i];
+			ubi->lookuptbl[e->pnum] = e;
+		}
+		ubi->fm_defer = 1;
+	}
+
+	if (!ubi->fm_disabled) {
+		/*
+		 * Reserve room for the current and the next fastmap, unless
+		 * there is not enough PEBs - then just do not use fastmap.
+		 */
+		if (ubi->avail_pebs >= reserved_pebs + 2 * ubi->fm_blocks)
+			reserved_pebs += 2 * ubi->fm_blocks;
+		else {
+			ubi_warn("not enough PEBs for fastmap, disable it");
+			ubi->fm_disabled = 1;
+		}
+	}
+
+	if (ubi->avail_pebs < reserved_pebs) {
 		ubi_err("no enough physical eraseblocks (%d, need %d)",
-			ubi->avail_pebs, WL_RESERVED_PEBS);
+			ubi->avail_pebs, reserved_pebs);
 		if (ubi->corr_peb_count)
 			ubi_err("%d PEBs are corrupted and not used",
 				ubi->corr_peb_count);
 		goto out_free;
 	}
-	ubi->avail_pebs -= WL_RESERVED_PEBS;
-	ubi->rsvd_pebs += WL_RESERVED_PEBS;
+	ubi->avail_pebs -= reserved_pebs;
+	ubi->rsvd_pebs += reserved_pebs;
+
+	/*
+	 * If fastmap had to be disabled, make sure the fastmap we have
+	 * attached from cannot be used any longer.
+	 */
+	if (ubi->fm_disabled && ubi->fm)
+		ubi_fastmap_invalidate(ubi);
 
 	/* Schedule wear-leveling if needed */
 	err = ensure_wear_leveling(ubi);
@@ -40,6 +40,9 @@ module_param(gso, bool, 0444);
 
 #define VIRTNET_SEND_COMMAND_SG_MAX    2
 
+/* Number of sent skbs reclaimed per virtqueue_get_bufs call */
+#define VIRTNET_XMIT_RECLAIM_BATCH     16
+
 struct virtnet_info {
 	struct virtio_device *vdev;
 	struct virtqueue *rvq, *svq, *cvq;
@@ -511,15 +514,21 @@ again:
 
 static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
+	void *skbs[VIRTNET_XMIT_RECLAIM_BATCH];
+	unsigned int lens[VIRTNET_XMIT_RECLAIM_BATCH];
 	struct sk_buff *skb;
-	unsigned int len, tot_sgs = 0;
-
-	while ((skb = virtqueue_get_buf(vi->svq, &len)) != NULL) {
-		pr_debug("Sent skb %p\n", skb);
-		vi->dev->stats.tx_bytes += skb->len;
-		vi->dev->stats.tx_packets++;
-		tot_sgs += skb_vnet_hdr(skb)->num_sg;
-		dev_kfree_skb_any(skb);
+	unsigned int i, n, tot_sgs = 0;
+
+	while ((n = virtqueue_get_bufs(vi->svq, skbs, lens,
+				       VIRTNET_XMIT_RECLAIM_BATCH)) != 0) {
+		for (i = 0; i < n; i++) {
+			skb = skbs[i];
+			pr_debug("Sent skb %p\n", skb);
+			vi->dev->stats.tx_bytes += skb->len;
+			vi->dev->stats.tx_packets++;
+			tot_sgs += skb_vnet_hdr(skb)->num_sg;
+			dev_kfree_skb_any(skb);
+		}
 	}
 	return tot_sgs;
 }
@@ -1347,6 +1347,42 @@ static void n_tty_write_wakeup(struct tty_struct *tty)
 		kill_fasync(&tty->fasync, SIGIO, POLL_OUT);
 }
 
+/**
+ *	n_tty_receive_raw	-	queue a run of raw characters
+ *	@tty: terminal device
+ *	@cp: characters
+ *	@count: number of characters
+ *
+ *	Copy characters which need no input processing straight into the
+ *	read buffer, dropping whatever does not fit, as put_tty_queue()
+ *	would.  The whole run is added under a single read_lock hold.
+ */
+
+static void n_tty_receive_raw(struct tty_struct *tty,
+			      const unsigned char *cp, int count)
+{
+	unsigned long cpuflags;
+	int i;
+
+	spin_lock_irqsave(&tty->read_lock, cpuflags);
+	i = min(N_TTY_BUF_SIZE - tty->read_cnt,
+		N_TTY_BUF_SIZE - tty->read_head);
+	i = min(count, i);
+	memcpy(tty->read_buf + tty->read_head, cp, i);
+	tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
+	tty->read_cnt += i;
+	cp += i;
+	count -= i;
+
+	i = min(N_TTY_BUF_SIZE - tty->read_cnt,
+		N_TTY_BUF_SIZE - tty->read_head);
+	i = min(count, i);
+	memcpy(tty->read_buf + tty->read_head, cp, i);
+	tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
+	tty->read_cnt += i;
+	spin_unlock_irqrestore(&tty->read_lock, cpuflags);
+}
+
 /**
  *	n_tty_receive_buf	-	data receive
  *	@tty: terminal device
@@ -1365,35 +1401,37 @@ static void n_tty_receive_buf(struct tty_struct *tty, const unsigned char *cp,
 {
 	const unsigned char *p;
 	char *f, flags = TTY_NORMAL;
-	int	i;
+	int	i, n;
 	char	buf[64];
-	unsigned long cpuflags;
 
 	if (!tty->read_buf)
 		return;
 
-	if (tty->real_raw) {
-		spin_lock_irqsave(&tty->read_lock, cpuflags);
-		i = min(N_TTY_BUF_SIZE - tty->read_cnt,
-			N_TTY_BUF_SIZE - tty->read_head);
-		i = min(count, i);
-		memcpy(tty->read_buf + tty->read_head, cp, i);
-		tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
-		tty->read_cnt += i;
-		cp += i;
-		count -= i;
-
-		i = min(N_TTY_BUF_SIZE - tty->read_cnt,
-			N_TTY_BUF_SIZE - tty->read_head);
-		i = min(count, i);
-		memcpy(tty->read_buf + tty->read_head, cp, i);
-		tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
-		tty->read_cnt += i;
-		spin_unlock_irqrestore(&tty->read_lock, cpuflags);
-	} else {
+	if (tty->real_raw)
+		n_tty_receive_raw(tty, cp, count);
+	else {
 		for (i = count, p = cp, f = fp; i; i--, p++) {
 			if (f)
 				flags = *f++;
+			/*
+			 * In raw mode normal characters are queued as they
+			 * are, so hand over the whole run of them at once
+			 * rather than taking the read_lock for each one.
+			 * This is the common case for ptys driven by ssh or
+			 * screen, which leave BRKINT set and so never get
+			 * real_raw.
+			 */
+			if (tty->raw && flags == TTY_NORMAL) {
+				for (n = 1; n < i; n++)
+					if (f && f[n - 1] != TTY_NORMAL)
+						break;
+				n_tty_receive_raw(tty, p, n);
+				p += n - 1;
+				i -= n - 1;
+				if (f)
+					f += n - 1;
+				continue;
+			}
 			switch (flags) {
 			case TTY_NORMAL:
 				n_tty_receive_char(tty, *p);
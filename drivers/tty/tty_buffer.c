@@ -17,6 +17,9 @@
 #include <linux/delay.h>
 #include <linux/module.h>
 
+/* Upper bound on the memory kept in a tty's free buffer queue */
+#define TTY_BUFFER_FREE_MAX	(4 * TTY_BUFFER_PAGE)
+
 /**
  *	tty_buffer_free_all		-	free buffers used by a tty
  *	@tty: tty to free from
@@ -40,6 +43,7 @@ void tty_buffer_free_all(struct tty_struct *tty)
 	}
 	tty->buf.tail = NULL;
 	tty->buf.memory_used = 0;
+	tty->buf.memory_free = 0;
 }
 
 /**
@@ -87,15 +91,22 @@ static struct tty_buffer *tty_buffer_alloc(struct tty_struct *tty, size_t size)
 
 static void tty_buffer_free(struct tty_struct *tty, struct tty_buffer *b)
 {
-	/* Dumb strategy for now - should keep some stats */
 	tty->buf.memory_used -= b->size;
 	WARN_ON(tty->buf.memory_used < 0);
 
-	if (b->size >= 512)
+	/*
+	 * Keep up to TTY_BUFFER_FREE_MAX bytes of buffers around for reuse,
+	 * including the page sized ones bulk writers (ptys in particular)
+	 * go through, so a steady stream of data does not have to kmalloc
+	 * and kfree every chunk.
+	 */
+	if (b->size > TTY_BUFFER_PAGE ||
+	    tty->buf.memory_free + b->size > TTY_BUFFER_FREE_MAX)
 		kfree(b);
 	else {
 		b->next = tty->buf.free;
 		tty->buf.free = b;
+		tty->buf.memory_free += b->size;
 	}
 }
 
@@ -175,6 +186,7 @@ static struct tty_buffer *tty_buffer_find(struct tty_struct *tty, size_t size)
 			t->commit = 0;
 			t->read = 0;
 			tty->buf.memory_used += t->size;
+			tty->buf.memory_free -= t->size;
 			return t;
 		}
 		tbh = &((*tbh)->next);
@@ -517,6 +529,7 @@ void tty_buffer_init(struct tty_struct *tty)
 	tty->buf.tail = NULL;
 	tty->buf.free = NULL;
 	tty->buf.memory_used = 0;
+	tty->buf.memory_free = 0;
 	INIT_WORK(&tty->buf.work, flush_to_ldisc);
 }
 
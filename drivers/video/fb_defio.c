@@ -150,6 +150,167 @@ static const struct address_space_operations fb_deferred_io_aops = {
 	.set_page_dirty = fb_deferred_io_set_page_dirty,
 };
 
+static u64 fb_damage_area(const struct fb_damage_rect *r)
+{
+	return (u64)(r->x2 - r->x1) * (r->y2 - r->y1);
+}
+
+static void fb_damage_union(struct fb_damage_rect *r,
+			    const struct fb_damage_rect *s)
+{
+	r->x1 = min(r->x1, s->x1);
+	r->y1 = min(r->y1, s->y1);
+	r->x2 = max(r->x2, s->x2);
+	r->y2 = max(r->y2, s->y2);
+}
+
+/* overlapping or adjacent rectangles are always merged */
+static bool fb_damage_touch(const struct fb_damage_rect *a,
+			    const struct fb_damage_rect *b)
+{
+	return a->x1 <= b->x2 && b->x1 <= a->x2 &&
+	       a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+/*
+ * Add a rectangle to the damage set, keeping the rectangles disjoint.
+ * Once all slots are in use the new rectangle is folded into the one
+ * whose bounding box grows the least. Called with damage_lock held.
+ */
+static void fb_deferred_io_add_damage(struct fb_deferred_io *fbdefio,
+				      struct fb_damage_rect r)
+{
+	struct fb_damage_rect u;
+	u64 cost, best_cost;
+	int i, best;
+
+again:
+	for (i = 0; i < fbdefio->damage_count; i++)
+		if (fb_damage_touch(&fbdefio->damage[i], &r))
+			goto merge;
+
+	if (fbdefio->damage_count < FB_DEFERRED_IO_MAX_DAMAGE) {
+		fbdefio->damage[fbdefio->damage_count++] = r;
+		return;
+	}
+
+	best = 0;
+	best_cost = ~0ULL;
+	for (i = 0; i < fbdefio->damage_count; i++) {
+		u = fbdefio->damage[i];
+		fb_damage_union(&u, &r);
+		cost = fb_damage_area(&u) - fb_damage_area(&fbdefio->damage[i]);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = i;
+		}
+	}
+	i = best;
+
+merge:
+	/* the grown rectangle may now touch others, so insert it again */
+	fb_damage_union(&r, &fbdefio->damage[i]);
+	fbdefio->damage[i] = fbdefio->damage[--fbdefio->damage_count];
+	goto again;
+}
+
+/*
+ * Convert a byte range of the framebuffer into the rectangle of pixels
+ * it covers. A range that stays within one line keeps its horizontal
+ * extent, anything larger covers whole lines.
+ */
+static bool fb_deferred_io_range_rect(struct fb_info *info,
+				      unsigned long offset, size_t len,
+				      struct fb_damage_rect *r)
+{
+	u32 line_length = info->fix.line_length;
+	u32 bpp = info->var.bits_per_pixel;
+	unsigned long end;
+
+	if (!len || !line_length || !bpp || offset >= info->fix.smem_len)
+		return false;
+
+	end = min_t(unsigned long, offset + len, info->fix.smem_len) - 1;
+	r->y1 = offset / line_length;
+	r->y2 = end / line_length + 1;
+	if (r->y1 >= info->var.yres_virtual)
+		return false;
+	r->y2 = min(r->y2, info->var.yres_virtual);
+
+	if (r->y2 - r->y1 == 1) {
+		r->x1 = (offset % line_length) * 8 / bpp;
+		r->x2 = (end % line_length) * 8 / bpp + 1;
+	} else {
+		r->x1 = 0;
+		r->x2 = info->var.xres_virtual;
+	}
+	r->x2 = min(r->x2, info->var.xres_virtual);
+
+	return r->x1 < r->x2;
+}
+
+static void fb_deferred_io_queue_damage(struct fb_info *info,
+					struct fb_damage_rect *r)
+{
+	struct fb_deferred_io *fbdefio = info->fbdefio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&fbdefio->damage_lock, flags);
+	fb_deferred_io_add_damage(fbdefio, *r);
+	spin_unlock_irqrestore(&fbdefio->damage_lock, flags);
+
+	schedule_delayed_work(&info->deferred_work, fbdefio->delay);
+}
+
+/**
+ *	fb_deferred_io_damage - mark a rectangle of the screen as changed
+ *	@info: frame buffer info structure
+ *	@x: left edge in pixels
+ *	@y: top edge in pixels
+ *	@width: width in pixels
+ *	@height: height in pixels
+ *
+ *	Drivers call this from their drawing operations (fillrect,
+ *	copyarea, imageblit, ...) so that the change is flushed by the
+ *	deferred I/O worker together with any dirtied mmap pages.
+ *	May be called from atomic context.
+ */
+void fb_deferred_io_damage(struct fb_info *info, u32 x, u32 y,
+			   u32 width, u32 height)
+{
+	struct fb_damage_rect r;
+
+	if (x >= info->var.xres_virtual || y >= info->var.yres_virtual ||
+	    !width || !height)
+		return;
+
+	r.x1 = x;
+	r.y1 = y;
+	r.x2 = x + min(width, info->var.xres_virtual - x);
+	r.y2 = y + min(height, info->var.yres_virtual - y);
+	fb_deferred_io_queue_damage(info, &r);
+}
+EXPORT_SYMBOL_GPL(fb_deferred_io_damage);
+
+/**
+ *	fb_deferred_io_damage_range - mark a byte range as changed
+ *	@info: frame buffer info structure
+ *	@offset: offset into the framebuffer memory
+ *	@len: length of the changed range in bytes
+ *
+ *	Like fb_deferred_io_damage() but for writes that are expressed
+ *	as a byte range, e.g. from the fb_write path.
+ */
+void fb_deferred_io_damage_range(struct fb_info *info,
+				 unsigned long offset, size_t len)
+{
+	struct fb_damage_rect r;
+
+	if (fb_deferred_io_range_rect(info, offset, len, &r))
+		fb_deferred_io_queue_damage(info, &r);
+}
+EXPORT_SYMBOL_GPL(fb_deferred_io_damage_range);
+
 static int fb_deferred_io_mmap(struct fb_info *info, struct vm_area_struct *vma)
 {
 	vma->vm_ops = &fb_deferred_io_vm_ops;
@@ -168,6 +329,11 @@ static void fb_deferred_io_work(struct work_struct *work)
 	struct list_head *node, *next;
 	struct page *cur;
 	struct fb_deferred_io *fbdefio = info->fbdefio;
+	struct fb_damage_rect damage[FB_DEFERRED_IO_MAX_DAMAGE];
+	struct fb_damage_rect r;
+	unsigned long flags;
+	unsigned long bytes = 0;
+	int count, i;
 
 	/* here we mkclean the pages, then do all deferred IO */
 	mutex_lock(&fbdefio->lock);
@@ -178,7 +344,34 @@ static void fb_deferred_io_work(struct work_struct *work)
 	}
 
 	/* driver's callback with pagelist */
-	fbdefio->deferred_io(info, &fbdefio->pagelist);
+	if (fbdefio->deferred_io) {
+		fbdefio->deferred_io(info, &fbdefio->pagelist);
+		if (!fbdefio->deferred_io_damage)
+			list_for_each(node, &fbdefio->pagelist)
+				bytes += PAGE_SIZE;
+	}
+
+	if (fbdefio->deferred_io_damage) {
+		/* fold the touched pages into the drawing damage */
+		spin_lock_irqsave(&fbdefio->damage_lock, flags);
+		list_for_each_entry(cur, &fbdefio->pagelist, lru) {
+			if (fb_deferred_io_range_rect(info,
+					cur->index << PAGE_SHIFT, PAGE_SIZE, &r))
+				fb_deferred_io_add_damage(fbdefio, r);
+		}
+		count = fbdefio->damage_count;
+		memcpy(damage, fbdefio->damage, count * sizeof(*damage));
+		fbdefio->damage_count = 0;
+		spin_unlock_irqrestore(&fbdefio->damage_lock, flags);
+
+		if (count) {
+			fbdefio->deferred_io_damage(info, damage, count);
+			for (i = 0; i < count; i++)
+				bytes += (fb_damage_area(&damage[i]) *
+					  info->var.bits_per_pixel + 7) >> 3;
+		}
+	}
+	fbdefio->flushed_bytes += bytes;
 
 	/* clear the list */
 	list_for_each_safe(node, next, &fbdefio->pagelist) {
@@ -193,6 +386,9 @@ void fb_deferred_io_init(struct fb_info *info)
 
 	BUG_ON(!fbdefio);
 	mutex_init(&fbdefio->lock);
+	spin_lock_init(&fbdefio->damage_lock);
+	fbdefio->damage_count = 0;
+	fbdefio->flushed_bytes = 0;
 	info->fbops->fb_mmap = fb_deferred_io_mmap;
 	INIT_DELAYED_WORK(&info->deferred_work, fb_deferred_io_work);
 	INIT_LIST_HEAD(&fbdefio->pagelist);
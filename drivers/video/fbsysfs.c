@@ -293,6 +293,19 @@ static ssize_t show_stride(struct device *device,
 	return snprintf(buf, PAGE_SIZE, "%d\n", fb_info->fix.line_length);
 }
 
+#ifdef CONFIG_FB_DEFERRED_IO
+static ssize_t show_defio_bytes(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	unsigned long bytes = 0;
+
+	if (fb_info->fbdefio)
+		bytes = fb_info->fbdefio->flushed_bytes;
+	return snprintf(buf, PAGE_SIZE, "%lu\n", bytes);
+}
+#endif
+
 static ssize_t store_blank(struct device *device,
 			   struct device_attribute *attr,
 			   const char *buf, size_t count)
@@ -505,6 +518,9 @@ static struct device_attribute device_attrs[] = {
 #ifdef CONFIG_FB_BACKLIGHT
 	__ATTR(bl_curve, S_IRUGO|S_IWUSR, show_bl_curve, store_bl_curve),
 #endif
+#ifdef CONFIG_FB_DEFERRED_IO
+	__ATTR(defio_bytes, S_IRUGO, show_defio_bytes, NULL),
+#endif
 };
 
 int fb_init_device(struct fb_info *fb_info)
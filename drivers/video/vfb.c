@@ -113,6 +113,13 @@ static struct fb_fix_screeninfo vfb_fix __devinitdata = {
 static int vfb_enable __initdata = 0;	/* disabled by default */
 module_param(vfb_enable, bool, 0);
 
+/*
+ * Route all updates through deferred I/O damage tracking, for testing
+ * the damage coalescing. See the defio_bytes sysfs attribute.
+ */
+static int vfb_defio;
+module_param(vfb_defio, bool, 0);
+
 static int vfb_check_var(struct fb_var_screeninfo *var,
 			 struct fb_info *info);
 static int vfb_set_par(struct fb_info *info);
@@ -122,17 +129,22 @@ static int vfb_pan_display(struct fb_var_screeninfo *var,
 			   struct fb_info *info);
 static int vfb_mmap(struct fb_info *info,
 		    struct vm_area_struct *vma);
+static ssize_t vfb_write(struct fb_info *info, const char __user *buf,
+			 size_t count, loff_t *ppos);
+static void vfb_fillrect(struct fb_info *info, const struct fb_fillrect *rect);
+static void vfb_copyarea(struct fb_info *info, const struct fb_copyarea *area);
+static void vfb_imageblit(struct fb_info *info, const struct fb_image *image);
 
 static struct fb_ops vfb_ops = {
 	.fb_read        = fb_sys_read,
-	.fb_write       = fb_sys_write,
+	.fb_write       = vfb_write,
 	.fb_check_var	= vfb_check_var,
 	.fb_set_par	= vfb_set_par,
 	.fb_setcolreg	= vfb_setcolreg,
 	.fb_pan_display	= vfb_pan_display,
-	.fb_fillrect	= sys_fillrect,
-	.fb_copyarea	= sys_copyarea,
-	.fb_imageblit	= sys_imageblit,
+	.fb_fillrect	= vfb_fillrect,
+	.fb_copyarea	= vfb_copyarea,
+	.fb_imageblit	= vfb_imageblit,
 	.fb_mmap	= vfb_mmap,
 };
 
@@ -444,6 +456,69 @@ static int vfb_mmap(struct fb_info *info,
 
 }
 
+    /*
+     *  Drawing operations, reporting damage when deferred I/O is used
+     */
+
+static ssize_t vfb_write(struct fb_info *info, const char __user *buf,
+			 size_t count, loff_t *ppos)
+{
+	loff_t pos = *ppos;
+	ssize_t ret;
+
+	ret = fb_sys_write(info, buf, count, ppos);
+	if (ret > 0 && info->fbdefio)
+		fb_deferred_io_damage_range(info, pos, ret);
+	return ret;
+}
+
+static void vfb_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
+{
+	sys_fillrect(info, rect);
+	if (info->fbdefio)
+		fb_deferred_io_damage(info, rect->dx, rect->dy,
+				      rect->width, rect->height);
+}
+
+static void vfb_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+{
+	sys_copyarea(info, area);
+	if (info->fbdefio)
+		fb_deferred_io_damage(info, area->dx, area->dy,
+				      area->width, area->height);
+}
+
+static void vfb_imageblit(struct fb_info *info, const struct fb_image *image)
+{
+	sys_imageblit(info, image);
+	if (info->fbdefio)
+		fb_deferred_io_damage(info, image->dx, image->dy,
+				      image->width, image->height);
+}
+
+    /*
+     *  There is no device behind vfb, so flushing the damage is free. The
+     *  deferred I/O core still accounts the bytes a real device would have
+     *  been sent.
+     */
+
+static void vfb_deferred_io_damage(struct fb_info *info,
+				   const struct fb_damage_rect *rects,
+				   int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		dev_dbg(info->dev, "damage %ux%u+%u+%u\n",
+			rects[i].x2 - rects[i].x1, rects[i].y2 - rects[i].y1,
+			rects[i].x1, rects[i].y1);
+}
+
+static struct fb_deferred_io vfb_defio_ops = {
+	.delay			= HZ / 20,
+	.deferred_io_damage	= vfb_deferred_io_damage,
+};
+
 #ifndef MODULE
 /*
  * The virtual framebuffer driver is only enabled if explicitly
@@ -520,6 +595,12 @@ static int __devinit vfb_probe(struct platform_device *dev)
 	if (retval < 0)
 		goto err1;
 
+	if (vfb_defio) {
+		info->flags |= FBINFO_VIRTFB;
+		info->fbdefio = &vfb_defio_ops;
+		fb_deferred_io_init(info);
+	}
+
 	retval = register_framebuffer(info);
 	if (retval < 0)
 		goto err2;
@@ -530,6 +611,8 @@ static int __devinit vfb_probe(struct platform_device *dev)
 	       info->node, videomemorysize >> 10);
 	return 0;
 err2:
+	if (info->fbdefio)
+		fb_deferred_io_cleanup(info);
 	fb_dealloc_cmap(&info->cmap);
 err1:
 	framebuffer_release(info);
@@ -544,6 +627,8 @@ static int vfb_remove(struct platform_device *dev)
 
 	if (info) {
 		unregister_framebuffer(info);
+		if (info->fbdefio)
+			fb_deferred_io_cleanup(info);
 		rvfree(videomemory, videomemorysize);
 		fb_dealloc_cmap(&info->cmap);
 		framebuffer_release(info);
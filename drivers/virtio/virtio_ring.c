@@ -85,6 +85,9 @@ struct vring_virtqueue
 	/* Host publishes avail event idx */
 	bool event;
 
+	/* Host uses buffers in the order they were made available */
+	bool in_order;
+
 	/* Number of free buffers */
 	unsigned int num_free;
 	/* Head of free buffer list. */
@@ -94,6 +97,8 @@ struct vring_virtqueue
 
 	/* Last used index we've seen. */
 	u16 last_used_idx;
+	/* In order: head of the next buffer we expect the host to use. */
+	unsigned int next_used_head;
 
 	/* How to notify other side. FIXME: commonalize hcalls! */
 	void (*notify)(struct virtqueue *vq);
@@ -237,10 +242,12 @@ add_head:
 }
 EXPORT_SYMBOL_GPL(virtqueue_add_buf_gfp);
 
-void virtqueue_kick(struct virtqueue *_vq)
+bool virtqueue_kick_prepare(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 	u16 new, old;
+	bool needs_kick;
+
 	START_USE(vq);
 	/* Descriptors and available array need to be set before we expose the
 	 * new available array entries. */
@@ -253,19 +260,37 @@ void virtqueue_kick(struct virtqueue *_vq)
 	/* Need to update avail index before checking if we should notify */
 	virtio_mb();
 
-	if (vq->event ?
-	    vring_need_event(vring_avail_event(&vq->vring), new, old) :
-	    !(vq->vring.used->flags & VRING_USED_F_NO_NOTIFY))
-		/* Prod other side to tell it about changes. */
-		vq->notify(&vq->vq);
+	if (vq->event)
+		needs_kick = vring_need_event(vring_avail_event(&vq->vring),
+					      new, old);
+	else
+		needs_kick = !(vq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
 
 	END_USE(vq);
+	return needs_kick;
+}
+EXPORT_SYMBOL_GPL(virtqueue_kick_prepare);
+
+void virtqueue_notify(struct virtqueue *_vq)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+
+	/* Prod other side to tell it about changes. */
+	vq->notify(_vq);
+}
+EXPORT_SYMBOL_GPL(virtqueue_notify);
+
+void virtqueue_kick(struct virtqueue *vq)
+{
+	if (virtqueue_kick_prepare(vq))
+		virtqueue_notify(vq);
 }
 EXPORT_SYMBOL_GPL(virtqueue_kick);
 
-static void detach_buf(struct vring_virtqueue *vq, unsigned int head)
+/* Returns the number of descriptors the buffer used. */
+static unsigned int detach_buf(struct vring_virtqueue *vq, unsigned int head)
 {
-	unsigned int i;
+	unsigned int i, count = 1;
 
 	/* Clear data ptr. */
 	vq->data[head] = NULL;
@@ -279,13 +304,18 @@ static void detach_buf(struct vring_virtqueue *vq, unsigned int head)
 
 	while (vq->vring.desc[i].flags & VRING_DESC_F_NEXT) {
 		i = vq->vring.desc[i].next;
-		vq->num_free++;
+		count++;
 	}
+	vq->num_free += count;
+
+	/* In order, the descriptors stay chained in ring order and are
+	 * handed out again once free_head wraps around to them. */
+	if (vq->in_order)
+		return count;
 
 	vq->vring.desc[i].next = vq->free_head;
 	vq->free_head = head;
-	/* Plus final descriptor */
-	vq->num_free++;
+	return count;
 }
 
 static inline bool more_used(const struct vring_virtqueue *vq)
@@ -293,11 +323,41 @@ static inline bool more_used(const struct vring_virtqueue *vq)
 	return vq->last_used_idx != vq->vring.used->idx;
 }
 
+/* Detach the buffer at last_used_idx; the caller checked more_used(). */
+static void *detach_used_buf(struct vring_virtqueue *vq, unsigned int *len)
+{
+	void *ret;
+	unsigned int i;
+
+	i = vq->vring.used->ring[vq->last_used_idx%vq->vring.num].id;
+	*len = vq->vring.used->ring[vq->last_used_idx%vq->vring.num].len;
+
+	if (unlikely(i >= vq->vring.num)) {
+		BAD_RING(vq, "id %u out of range\n", i);
+		return NULL;
+	}
+	if (unlikely(!vq->data[i])) {
+		BAD_RING(vq, "id %u is not a head!\n", i);
+		return NULL;
+	}
+	if (vq->in_order && unlikely(i != vq->next_used_head)) {
+		BAD_RING(vq, "id %u used out of order, expected %u\n",
+			 i, vq->next_used_head);
+		return NULL;
+	}
+
+	/* detach_buf clears data, so grab it now. */
+	ret = vq->data[i];
+	i += detach_buf(vq, i);
+	vq->next_used_head = i & (vq->vring.num - 1);
+	vq->last_used_idx++;
+	return ret;
+}
+
 void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 	void *ret;
-	unsigned int i;
 
 	START_USE(vq);
 
@@ -315,22 +375,10 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 	/* Only get used array entries after they have been exposed by host. */
 	virtio_rmb();
 
-	i = vq->vring.used->ring[vq->last_used_idx%vq->vring.num].id;
-	*len = vq->vring.used->ring[vq->last_used_idx%vq->vring.num].len;
-
-	if (unlikely(i >= vq->vring.num)) {
-		BAD_RING(vq, "id %u out of range\n", i);
-		return NULL;
-	}
-	if (unlikely(!vq->data[i])) {
-		BAD_RING(vq, "id %u is not a head!\n", i);
+	ret = detach_used_buf(vq, len);
+	if (unlikely(!ret))
 		return NULL;
-	}
 
-	/* detach_buf clears data, so grab it now. */
-	ret = vq->data[i];
-	detach_buf(vq, i);
-	vq->last_used_idx++;
 	/* If we expect an interrupt for the next entry, tell host
 	 * by writing event index and flush out the write before
 	 * the read in the next get_buf call. */
@@ -344,6 +392,47 @@ void *virtqueue_get_buf(struct virtqueue *_vq, unsigned int *len)
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_buf);
 
+unsigned int virtqueue_get_bufs(struct virtqueue *_vq, void **bufs,
+				unsigned int *lens, unsigned int max)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	unsigned int n, count;
+
+	START_USE(vq);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return 0;
+	}
+
+	/* Take one snapshot of the used index for the whole batch. */
+	n = (u16)(vq->vring.used->idx - vq->last_used_idx);
+	if (!n) {
+		END_USE(vq);
+		return 0;
+	}
+	n = min(n, max);
+
+	/* Only get used array entries after they have been exposed by host. */
+	virtio_rmb();
+
+	for (count = 0; count < n; count++) {
+		bufs[count] = detach_used_buf(vq, &lens[count]);
+		if (unlikely(!bufs[count]))
+			break;
+	}
+
+	/* Publish the event index once per batch instead of per buffer. */
+	if (!(vq->vring.avail->flags & VRING_AVAIL_F_NO_INTERRUPT)) {
+		vring_used_event(&vq->vring) = vq->last_used_idx;
+		virtio_mb();
+	}
+
+	END_USE(vq);
+	return count;
+}
+EXPORT_SYMBOL_GPL(virtqueue_get_bufs);
+
 void virtqueue_disable_cb(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
@@ -477,6 +566,7 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 	vq->notify = notify;
 	vq->broken = false;
 	vq->last_used_idx = 0;
+	vq->next_used_head = 0;
 	vq->num_added = 0;
 	list_add_tail(&vq->vq.list, &vdev->vqs);
 #ifdef DEBUG
@@ -485,18 +575,21 @@ struct virtqueue *vring_new_virtqueue(unsigned int num,
 
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC);
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->in_order = virtio_has_feature(vdev, VIRTIO_RING_F_IN_ORDER);
 
 	/* No callback?  Tell other side not to bother us. */
 	if (!callback)
 		vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
 
-	/* Put everything in free lists. */
+	/* Put everything in free lists.  The chain is prebuilt in ring order,
+	 * and for in order queues it wraps so it is never relinked. */
 	vq->num_free = num;
 	vq->free_head = 0;
 	for (i = 0; i < num-1; i++) {
 		vq->vring.desc[i].next = i+1;
 		vq->data[i] = NULL;
 	}
+	vq->vring.desc[i].next = 0;
 	vq->data[i] = NULL;
 
 	return &vq->vq;
@@ -521,6 +614,8 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_RING_F_EVENT_IDX:
 			break;
+		case VIRTIO_RING_F_IN_ORDER:
+			break;
 		default:
 			/* We don't understand this bit. */
 			clear_bit(i, vdev->features);
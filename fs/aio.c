@@ -25,6 +25,8 @@
 #include <linux/file.h>
 #include <linux/mm.h>
 #include <linux/mman.h>
+#include <linux/pagemap.h>
+#include <linux/vmalloc.h>
 #include <linux/mmu_context.h>
 #include <linux/slab.h>
 #include <linux/timer.h>
@@ -55,6 +57,7 @@ static struct kmem_cache	*kiocb_cachep;
 static struct kmem_cache	*kioctx_cachep;
 
 static struct workqueue_struct *aio_wq;
+static struct workqueue_struct *aio_read_wq;
 
 /* Used for rare fput completion. */
 static void aio_fput_routine(struct work_struct *);
@@ -77,6 +80,8 @@ static int __init aio_setup(void)
 
 	aio_wq = alloc_workqueue("aio", 0, 1);	/* used to limit concurrency */
 	BUG_ON(!aio_wq);
+	aio_read_wq = alloc_workqueue("aio_read", WQ_UNBOUND, 0);
+	BUG_ON(!aio_read_wq);
 
 	pr_debug("aio_setup: sizeof(struct page) = %d\n", (int)sizeof(struct page));
 
@@ -89,6 +94,10 @@ static void aio_free_ring(struct kioctx *ctx)
 	struct aio_ring_info *info = &ctx->ring_info;
 	long i;
 
+	if (info->ring)
+		vunmap(info->ring);
+	info->ring = NULL;
+
 	for (i=0; i<info->nr_pages; i++)
 		put_page(info->ring_pages[i]);
 
@@ -156,11 +165,22 @@ static int aio_setup_ring(struct kioctx *ctx)
 		return -EAGAIN;
 	}
 
+	/*
+	 * Keep the ring mapped for as long as the context exists, so that
+	 * posting and reading events doesn't need a kmap per event.
+	 */
+	info->ring = vmap(info->ring_pages, nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!info->ring) {
+		aio_free_ring(ctx);
+		return -ENOMEM;
+	}
+
 	ctx->user_id = info->mmap_base;
 
 	info->nr = nr_events;		/* trusted copy */
+	info->tail = info->commit = 0;
 
-	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
+	ring = info->ring;
 	ring->nr = nr_events;	/* user copy */
 	ring->id = ctx->user_id;
 	ring->head = ring->tail = 0;
@@ -168,33 +188,15 @@ static int aio_setup_ring(struct kioctx *ctx)
 	ring->compat_features = AIO_RING_COMPAT_FEATURES;
 	ring->incompat_features = AIO_RING_INCOMPAT_FEATURES;
 	ring->header_length = sizeof(struct aio_ring);
-	kunmap_atomic(ring, KM_USER0);
 
 	return 0;
 }
 
 
-/* aio_ring_event: returns a pointer to the event at the given index from
- * kmap_atomic(, km).  Release the pointer with put_aio_ring_event();
+/* aio_ring_event: returns a pointer to the event at the given index
+ * through the kernel mapping of the ring.
  */
-#define AIO_EVENTS_PER_PAGE	(PAGE_SIZE / sizeof(struct io_event))
-#define AIO_EVENTS_FIRST_PAGE	((PAGE_SIZE - sizeof(struct aio_ring)) / sizeof(struct io_event))
-#define AIO_EVENTS_OFFSET	(AIO_EVENTS_PER_PAGE - AIO_EVENTS_FIRST_PAGE)
-
-#define aio_ring_event(info, nr, km) ({					\
-	unsigned pos = (nr) + AIO_EVENTS_OFFSET;			\
-	struct io_event *__event;					\
-	__event = kmap_atomic(						\
-			(info)->ring_pages[pos / AIO_EVENTS_PER_PAGE], km); \
-	__event += pos % AIO_EVENTS_PER_PAGE;				\
-	__event;							\
-})
-
-#define put_aio_ring_event(event, km) do {	\
-	struct io_event *__event = (event);	\
-	(void)__event;				\
-	kunmap_atomic((void *)((unsigned long)__event & PAGE_MASK), km); \
-} while(0)
+#define aio_ring_event(info, nr)	(&(info)->ring->io_events[(nr)])
 
 static void ctx_rcu_free(struct rcu_head *head)
 {
@@ -217,7 +219,7 @@ static void ctx_rcu_free(struct rcu_head *head)
  */
 static void __put_ioctx(struct kioctx *ctx)
 {
-	BUG_ON(ctx->reqs_active);
+	BUG_ON(atomic_read(&ctx->reqs_active));
 
 	cancel_delayed_work(&ctx->wq);
 	cancel_work_sync(&ctx->wq.work);
@@ -345,8 +347,11 @@ static void aio_cancel_all(struct kioctx *ctx)
 		list_del_init(&iocb->ki_list);
 		cancel = iocb->ki_cancel;
 		kiocbSetCancelled(iocb);
-		if (cancel) {
-			iocb->ki_users++;
+		/*
+		 * The final aio_put_req() of a cancellable request waits
+		 * for ctx_lock, so the iocb can't go away under us here.
+		 */
+		if (cancel && atomic_inc_not_zero(&iocb->ki_users)) {
 			spin_unlock_irq(&ctx->ctx_lock);
 			cancel(iocb, &res);
 			spin_lock_irq(&ctx->ctx_lock);
@@ -360,23 +365,21 @@ static void wait_for_all_aios(struct kioctx *ctx)
 	struct task_struct *tsk = current;
 	DECLARE_WAITQUEUE(wait, tsk);
 
-	spin_lock_irq(&ctx->ctx_lock);
-	if (!ctx->reqs_active)
-		goto out;
+	if (!atomic_read(&ctx->reqs_active))
+		return;
 
+	/*
+	 * ctx->dead is set by now.  set_task_state() orders it against our
+	 * test of reqs_active, aio_reqs_done() does the opposite.
+	 */
 	add_wait_queue(&ctx->wait, &wait);
 	set_task_state(tsk, TASK_UNINTERRUPTIBLE);
-	while (ctx->reqs_active) {
-		spin_unlock_irq(&ctx->ctx_lock);
+	while (atomic_read(&ctx->reqs_active)) {
 		io_schedule();
 		set_task_state(tsk, TASK_UNINTERRUPTIBLE);
-		spin_lock_irq(&ctx->ctx_lock);
 	}
 	__set_task_state(tsk, TASK_RUNNING);
 	remove_wait_queue(&ctx->wait, &wait);
-
-out:
-	spin_unlock_irq(&ctx->ctx_lock);
 }
 
 /* wait_on_sync_kiocb:
@@ -384,9 +387,9 @@ out:
  */
 ssize_t wait_on_sync_kiocb(struct kiocb *iocb)
 {
-	while (iocb->ki_users) {
+	while (atomic_read(&iocb->ki_users)) {
 		set_current_state(TASK_UNINTERRUPTIBLE);
-		if (!iocb->ki_users)
+		if (!atomic_read(&iocb->ki_users))
 			break;
 		io_schedule();
 	}
@@ -422,15 +425,28 @@ void exit_aio(struct mm_struct *mm)
 			printk(KERN_DEBUG
 				"exit_aio:ioctx still alive: %d %d %d\n",
 				atomic_read(&ctx->users), ctx->dead,
-				ctx->reqs_active);
+				atomic_read(&ctx->reqs_active));
 		put_ioctx(ctx);
 	}
 }
 
-/* aio_get_req
- *	Allocate a slot for an aio request.  Increments the users count
- * of the kioctx so that the kioctx stays around until all requests are
- * complete.  Returns NULL if no requests are free.
+/* aio_reqs_done
+ *	Drops @nr requests from ctx->reqs_active and wakes up io_destroy()
+ *	if it is waiting for the last of them.  The context is freed by RCU
+ *	and may be released as soon as reqs_active reaches zero, so keep
+ *	the read side open while looking at it.
+ */
+static void aio_reqs_done(struct kioctx *ctx, int nr)
+{
+	rcu_read_lock();
+	if (atomic_sub_and_test(nr, &ctx->reqs_active) && unlikely(ctx->dead))
+		wake_up_all(&ctx->wait);
+	rcu_read_unlock();
+}
+
+/* __aio_get_req
+ *	Allocate and initialize an aio request.  Completion ring space for
+ *	the request is reserved by kiocb_batch_refill().
  *
  * Returns with kiocb->users set to 2.  The io submit code path holds
  * an extra reference while submitting the i/o.
@@ -440,15 +456,13 @@ void exit_aio(struct mm_struct *mm)
 static struct kiocb *__aio_get_req(struct kioctx *ctx)
 {
 	struct kiocb *req = NULL;
-	struct aio_ring *ring;
-	int okay = 0;
 
 	req = kmem_cache_alloc(kiocb_cachep, GFP_KERNEL);
 	if (unlikely(!req))
 		return NULL;
 
 	req->ki_flags = 0;
-	req->ki_users = 2;
+	atomic_set(&req->ki_users, 2);
 	req->ki_key = 0;
 	req->ki_ctx = ctx;
 	req->ki_cancel = NULL;
@@ -457,48 +471,108 @@ static struct kiocb *__aio_get_req(struct kioctx *ctx)
 	req->private = NULL;
 	req->ki_iovec = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
+	INIT_LIST_HEAD(&req->ki_list);
 	req->ki_eventfd = NULL;
 
-	/* Check if the completion queue has enough free space to
-	 * accept an event from this io.
-	 */
-	spin_lock_irq(&ctx->ctx_lock);
-	ring = kmap_atomic(ctx->ring_info.ring_pages[0], KM_USER0);
-	if (ctx->reqs_active < aio_ring_avail(&ctx->ring_info, ring)) {
-		list_add(&req->ki_list, &ctx->active_reqs);
-		ctx->reqs_active++;
-		okay = 1;
-	}
-	kunmap_atomic(ring, KM_USER0);
-	spin_unlock_irq(&ctx->ctx_lock);
+	return req;
+}
+
+/*
+ * io_submit() allocates requests in batches, so that ring space is
+ * reserved once per batch instead of once per iocb.
+ */
+#define KIOCB_BATCH_SIZE	32L
+struct kiocb_batch {
+	struct list_head head;
+	long count; /* number of requests left to allocate */
+};
+
+static void kiocb_batch_init(struct kiocb_batch *batch, long total)
+{
+	INIT_LIST_HEAD(&batch->head);
+	batch->count = total;
+}
+
+static void kiocb_batch_free(struct kioctx *ctx, struct kiocb_batch *batch)
+{
+	struct kiocb *req, *n;
+	int nr = 0;
 
-	if (!okay) {
+	list_for_each_entry_safe(req, n, &batch->head, ki_list) {
+		list_del(&req->ki_list);
 		kmem_cache_free(kiocb_cachep, req);
-		req = NULL;
+		nr++;
 	}
-
-	return req;
+	if (nr)
+		aio_reqs_done(ctx, nr);
 }
 
-static inline struct kiocb *aio_get_req(struct kioctx *ctx)
+/*
+ * Allocates up to KIOCB_BATCH_SIZE requests and reserves completion
+ * ring space for them.  Returns the number of requests added to the
+ * batch.
+ */
+static long kiocb_batch_refill(struct kioctx *ctx, struct kiocb_batch *batch)
 {
+	struct aio_ring_info *info = &ctx->ring_info;
+	long to_alloc, allocated, avail, active, excess, i;
 	struct kiocb *req;
-	/* Handle a potential starvation case -- should be exceedingly rare as 
-	 * requests will be stuck on fput_head only if the aio_fput_routine is 
-	 * delayed and the requests were the last user of the struct file.
+
+	to_alloc = min(batch->count, KIOCB_BATCH_SIZE);
+	for (allocated = 0; allocated < to_alloc; allocated++) {
+		req = __aio_get_req(ctx);
+		if (!req)
+			break;
+		list_add(&req->ki_list, &batch->head);
+	}
+	if (!allocated)
+		return 0;
+
+	/* Check if the completion queue has enough free space to
+	 * accept an event from each of these ios, and give back the
+	 * requests that don't fit.
 	 */
-	req = __aio_get_req(ctx);
-	if (unlikely(NULL == req)) {
+	avail = aio_ring_avail(info, info->ring);
+	active = atomic_add_return(allocated, &ctx->reqs_active);
+	if (active > avail) {
+		excess = min(active - avail, allocated);
+		for (i = 0; i < excess; i++) {
+			req = list_first_entry(&batch->head, struct kiocb,
+					       ki_list);
+			list_del(&req->ki_list);
+			kmem_cache_free(kiocb_cachep, req);
+		}
+		allocated -= excess;
+		aio_reqs_done(ctx, excess);
+	}
+
+	batch->count -= allocated;
+	return allocated;
+}
+
+static inline struct kiocb *aio_get_req(struct kioctx *ctx,
+					struct kiocb_batch *batch)
+{
+	struct kiocb *req;
+
+	if (list_empty(&batch->head) && !kiocb_batch_refill(ctx, batch)) {
+		/* Handle a potential starvation case -- should be exceedingly
+		 * rare as requests will be stuck on fput_head only if the
+		 * aio_fput_routine is delayed and the requests were the last
+		 * user of the struct file.
+		 */
 		aio_fput_routine(NULL);
-		req = __aio_get_req(ctx);
+		if (!kiocb_batch_refill(ctx, batch))
+			return NULL;
 	}
+
+	req = list_first_entry(&batch->head, struct kiocb, ki_list);
+	list_del_init(&req->ki_list);
 	return req;
 }
 
 static inline void really_put_req(struct kioctx *ctx, struct kiocb *req)
 {
-	assert_spin_locked(&ctx->ctx_lock);
-
 	if (req->ki_eventfd != NULL)
 		eventfd_ctx_put(req->ki_eventfd);
 	if (req->ki_dtor)
@@ -506,10 +580,7 @@ static inline void really_put_req(struct kioctx *ctx, struct kiocb *req)
 	if (req->ki_iovec != &req->ki_inline_vec)
 		kfree(req->ki_iovec);
 	kmem_cache_free(kiocb_cachep, req);
-	ctx->reqs_active--;
-
-	if (unlikely(!ctx->reqs_active && ctx->dead))
-		wake_up_all(&ctx->wait);
+	aio_reqs_done(ctx, 1);
 }
 
 static void aio_fput_routine(struct work_struct *data)
@@ -527,9 +598,7 @@ static void aio_fput_routine(struct work_struct *data)
 			fput(req->ki_filp);
 
 		/* Link the iocb into the context's free list */
-		spin_lock_irq(&ctx->ctx_lock);
 		really_put_req(ctx, req);
-		spin_unlock_irq(&ctx->ctx_lock);
 
 		put_ioctx(ctx);
 		spin_lock_irq(&fput_lock);
@@ -537,21 +606,17 @@ static void aio_fput_routine(struct work_struct *data)
 	spin_unlock_irq(&fput_lock);
 }
 
-/* __aio_put_req
- *	Returns true if this put was the last user of the request.
+/* aio_release_req
+ *	Frees a request whose last reference has been dropped and which
+ *	is no longer on ctx->active_reqs.
  */
-static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
+static void aio_release_req(struct kioctx *ctx, struct kiocb *req)
 {
+	unsigned long flags;
+
 	dprintk(KERN_DEBUG "aio_put(%p): f_count=%ld\n",
 		req, atomic_long_read(&req->ki_filp->f_count));
 
-	assert_spin_locked(&ctx->ctx_lock);
-
-	req->ki_users--;
-	BUG_ON(req->ki_users < 0);
-	if (likely(req->ki_users))
-		return 0;
-	list_del(&req->ki_list);		/* remove from active_reqs */
 	req->ki_cancel = NULL;
 	req->ki_retry = NULL;
 
@@ -563,14 +628,28 @@ static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
 	 */
 	if (unlikely(!fput_atomic(req->ki_filp))) {
 		get_ioctx(ctx);
-		spin_lock(&fput_lock);
+		spin_lock_irqsave(&fput_lock, flags);
 		list_add(&req->ki_list, &fput_head);
-		spin_unlock(&fput_lock);
+		spin_unlock_irqrestore(&fput_lock, flags);
 		schedule_work(&fput_work);
 	} else {
 		req->ki_filp = NULL;
 		really_put_req(ctx, req);
 	}
+}
+
+/* __aio_put_req
+ *	Returns true if this put was the last user of the request.
+ *	Called with ctx->ctx_lock held.
+ */
+static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
+{
+	assert_spin_locked(&ctx->ctx_lock);
+
+	if (likely(!atomic_dec_and_test(&req->ki_users)))
+		return 0;
+	list_del_init(&req->ki_list);		/* remove from active_reqs */
+	aio_release_req(ctx, req);
 	return 1;
 }
 
@@ -581,11 +660,22 @@ static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
 int aio_put_req(struct kiocb *req)
 {
 	struct kioctx *ctx = req->ki_ctx;
-	int ret;
-	spin_lock_irq(&ctx->ctx_lock);
-	ret = __aio_put_req(ctx, req);
-	spin_unlock_irq(&ctx->ctx_lock);
-	return ret;
+	unsigned long flags;
+
+	if (likely(!atomic_dec_and_test(&req->ki_users)))
+		return 0;
+
+	/*
+	 * Only cancellable requests are on active_reqs.  Unlink them under
+	 * ctx_lock, io_cancel() and aio_cancel_all() may be looking at them.
+	 */
+	if (req->ki_cancel) {
+		spin_lock_irqsave(&ctx->ctx_lock, flags);
+		list_del_init(&req->ki_list);
+		spin_unlock_irqrestore(&ctx->ctx_lock, flags);
+	}
+	aio_release_req(ctx, req);
+	return 1;
 }
 EXPORT_SYMBOL(aio_put_req);
 
@@ -776,7 +866,7 @@ static int __aio_run_iocbs(struct kioctx *ctx)
 		/*
 		 * Hold an extra reference while retrying i/o.
 		 */
-		iocb->ki_users++;       /* grab extra reference */
+		atomic_inc(&iocb->ki_users);	/* grab extra reference */
 		aio_run_iocb(iocb);
 		__aio_put_req(ctx, iocb);
  	}
@@ -889,6 +979,55 @@ void kick_iocb(struct kiocb *iocb)
 }
 EXPORT_SYMBOL(kick_iocb);
 
+/* aio_ring_post
+ *	Adds a completion event to the ring without taking ctx_lock.  A
+ *	slot is reserved by advancing info->tail with cmpxchg and filled
+ *	in; it is published to userspace once all earlier slots have been
+ *	published.  Ring space for the event was reserved when the request
+ *	was allocated, so the ring can't overflow here.
+ */
+static void aio_ring_post(struct kioctx *ctx, struct kiocb *iocb,
+			  long res, long res2)
+{
+	struct aio_ring_info	*info = &ctx->ring_info;
+	struct io_event	*event;
+	unsigned long	flags;
+	unsigned	tail, next;
+
+	/*
+	 * Publishing waits for the earlier slots, so an interrupt must
+	 * not post another event on this cpu while we hold a slot.
+	 */
+	local_irq_save(flags);
+	do {
+		tail = ACCESS_ONCE(info->tail);
+		next = tail + 1;
+		if (next >= info->nr)
+			next = 0;
+	} while (cmpxchg(&info->tail, tail, next) != tail);
+
+	event = aio_ring_event(info, tail);
+	event->obj = (u64)(unsigned long)iocb->ki_obj.user;
+	event->data = iocb->ki_user_data;
+	event->res = res;
+	event->res2 = res2;
+
+	dprintk("aio_complete: %p[%u]: %p: %p %Lx %lx %lx\n",
+		ctx, tail, iocb, iocb->ki_obj.user, iocb->ki_user_data,
+		res, res2);
+
+	while (ACCESS_ONCE(info->commit) != tail)
+		cpu_relax();
+
+	smp_mb();	/* make events visible before updating tail */
+
+	info->commit = next;
+	info->ring->tail = next;
+	local_irq_restore(flags);
+
+	pr_debug("added to ring %p at [%u]\n", iocb, tail);
+}
+
 /* aio_complete
  *	Called when the io request on the given iocb is complete.
  *	Returns true if this is the last user of the request.  The 
@@ -897,12 +1036,8 @@ EXPORT_SYMBOL(kick_iocb);
 int aio_complete(struct kiocb *iocb, long res, long res2)
 {
 	struct kioctx	*ctx = iocb->ki_ctx;
-	struct aio_ring_info	*info;
-	struct aio_ring	*ring;
-	struct io_event	*event;
 	unsigned long	flags;
-	unsigned long	tail;
-	int		ret;
+	int		cancelled = 0;
 
 	/*
 	 * Special case handling for sync iocbs:
@@ -912,87 +1047,61 @@ int aio_complete(struct kiocb *iocb, long res, long res2)
 	 *  - the sync task helpfully left a reference to itself in the iocb
 	 */
 	if (is_sync_kiocb(iocb)) {
-		BUG_ON(iocb->ki_users != 1);
+		BUG_ON(atomic_read(&iocb->ki_users) != 1);
 		iocb->ki_user_data = res;
-		iocb->ki_users = 0;
+		atomic_set(&iocb->ki_users, 0);
 		wake_up_process(iocb->ki_obj.tsk);
 		return 1;
 	}
 
-	info = &ctx->ring_info;
-
-	/* add a completion event to the ring buffer.
-	 * must be done holding ctx->ctx_lock to prevent
-	 * other code from messing with the tail
-	 * pointer since we might be called from irq
-	 * context.
-	 */
-	spin_lock_irqsave(&ctx->ctx_lock, flags);
-
-	if (iocb->ki_run_list.prev && !list_empty(&iocb->ki_run_list))
-		list_del_init(&iocb->ki_run_list);
-
 	/*
-	 * cancelled requests don't get events, userland was given one
-	 * when the event got cancelled.
-	 */
-	if (kiocbIsCancelled(iocb))
-		goto put_rq;
-
-	ring = kmap_atomic(info->ring_pages[0], KM_IRQ1);
-
-	tail = info->tail;
-	event = aio_ring_event(info, tail, KM_IRQ0);
-	if (++tail >= info->nr)
-		tail = 0;
-
-	event->obj = (u64)(unsigned long)iocb->ki_obj.user;
-	event->data = iocb->ki_user_data;
-	event->res = res;
-	event->res2 = res2;
-
-	dprintk("aio_complete: %p[%lu]: %p: %p %Lx %lx %lx\n",
-		ctx, tail, iocb, iocb->ki_obj.user, iocb->ki_user_data,
-		res, res2);
-
-	/* after flagging the request as done, we
-	 * must never even look at it again
+	 * Cancellable requests and requests on the retry list have to
+	 * serialize against io_cancel() and the kick handler under
+	 * ctx_lock.  Everything else goes straight to the ring.
 	 */
-	smp_wmb();	/* make event visible before updating tail */
+	if (unlikely(iocb->ki_cancel ||
+		     (iocb->ki_run_list.prev &&
+		      !list_empty(&iocb->ki_run_list)))) {
+		spin_lock_irqsave(&ctx->ctx_lock, flags);
 
-	info->tail = tail;
-	ring->tail = tail;
+		if (iocb->ki_run_list.prev && !list_empty(&iocb->ki_run_list))
+			list_del_init(&iocb->ki_run_list);
 
-	put_aio_ring_event(event, KM_IRQ0);
-	kunmap_atomic(ring, KM_IRQ1);
+		/*
+		 * cancelled requests don't get events, userland was given one
+		 * when the event got cancelled.
+		 */
+		cancelled = kiocbIsCancelled(iocb);
+		if (!cancelled)
+			aio_ring_post(ctx, iocb, res, res2);
 
-	pr_debug("added to ring %p at [%lu]\n", iocb, tail);
+		spin_unlock_irqrestore(&ctx->ctx_lock, flags);
+	} else
+		aio_ring_post(ctx, iocb, res, res2);
 
 	/*
 	 * Check if the user asked us to deliver the result through an
 	 * eventfd. The eventfd_signal() function is safe to be called
 	 * from IRQ context.
 	 */
-	if (iocb->ki_eventfd != NULL)
+	if (!cancelled && iocb->ki_eventfd != NULL)
 		eventfd_signal(iocb->ki_eventfd, 1);
 
-put_rq:
-	/* everything turned out well, dispose of the aiocb. */
-	ret = __aio_put_req(ctx, iocb);
-
 	/*
-	 * We have to order our ring_info tail store above and test
+	 * We have to order our ring tail store above and test
 	 * of the wait list below outside the wait lock.  This is
 	 * like in wake_up_bit() where clearing a bit has to be
-	 * ordered with the unlocked test.
+	 * ordered with the unlocked test.  Waiters are woken before
+	 * the request is put, as the final put may let io_destroy()
+	 * free the context.
 	 */
 	smp_mb();
 
 	if (waitqueue_active(&ctx->wait))
 		wake_up(&ctx->wait);
 
-	spin_unlock_irqrestore(&ctx->ctx_lock, flags);
-	return ret;
+	/* everything turned out well, dispose of the aiocb. */
+	return aio_put_req(iocb);
 }
 EXPORT_SYMBOL(aio_complete);
 
@@ -1005,11 +1114,10 @@ EXPORT_SYMBOL(aio_complete);
 static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 {
 	struct aio_ring_info *info = &ioctx->ring_info;
-	struct aio_ring *ring;
+	struct aio_ring *ring = info->ring;
 	unsigned long head;
 	int ret = 0;
 
-	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
 	dprintk("in aio_read_evt h%lu t%lu m%lu\n",
 		 (unsigned long)ring->head, (unsigned long)ring->tail,
 		 (unsigned long)ring->nr);
@@ -1021,18 +1129,16 @@ static int aio_read_evt(struct kioctx *ioctx, struct io_event *ent)
 
 	head = ring->head % info->nr;
 	if (head != ring->tail) {
-		struct io_event *evp = aio_ring_event(info, head, KM_USER1);
-		*ent = *evp;
+		smp_rmb(); /* read the tail before the event */
+		*ent = *aio_ring_event(info, head);
 		head = (head + 1) % info->nr;
 		smp_mb(); /* finish reading the event before updatng the head */
 		ring->head = head;
 		ret = 1;
-		put_aio_ring_event(evp, KM_USER1);
 	}
 	spin_unlock(&info->ring_lock);
 
 out:
-	kunmap_atomic(ring, KM_USER0);
 	dprintk("leaving aio_read_evt: %d  h%lu t%lu\n", ret,
 		 (unsigned long)ring->head, (unsigned long)ring->tail);
 	return ret;
@@ -1156,7 +1262,7 @@ retry:
 				break;
 			/* Try to only show up in io wait if there are ops
 			 *  in flight */
-			if (ctx->reqs_active)
+			if (atomic_read(&ctx->reqs_active))
 				io_schedule();
 			else
 				schedule();
@@ -1514,12 +1620,87 @@ static ssize_t aio_setup_iocb(struct kiocb *kiocb, bool compat)
 	return 0;
 }
 
+/*
+ * How many pages at the start of a read aio_read_would_block() looks up
+ * in the page cache, besides the last one.  Probing every page of a
+ * large read would cost more than the read itself when it is cached.
+ */
+#define AIO_READ_PROBE_PAGES	16
+
+static bool aio_page_cached(struct address_space *mapping, pgoff_t index)
+{
+	struct page *page = find_get_page(mapping, index);
+	bool uptodate;
+
+	if (!page)
+		return false;
+	uptodate = PageUptodate(page);
+	page_cache_release(page);
+	return uptodate;
+}
+
+/*
+ * Buffered reads of data that isn't in the page cache block in
+ * ->aio_read() until the pages have been read in, which stalls
+ * io_submit() and every iocb behind this one.  Such reads are handed
+ * to a worker thread instead.  This is a heuristic: only the head and
+ * the tail of the read are probed.
+ */
+static bool aio_read_would_block(struct kiocb *iocb)
+{
+	struct file *file = iocb->ki_filp;
+	struct address_space *mapping = file->f_mapping;
+	pgoff_t index, end, probe_end;
+
+	if (iocb->ki_opcode != IOCB_CMD_PREAD &&
+	    iocb->ki_opcode != IOCB_CMD_PREADV)
+		return false;
+	if ((file->f_flags & O_DIRECT) || !S_ISREG(mapping->host->i_mode))
+		return false;
+	if (iocb->ki_pos < 0 || !iocb->ki_left)
+		return false;
+
+	index = iocb->ki_pos >> PAGE_CACHE_SHIFT;
+	end = (iocb->ki_pos + iocb->ki_left - 1) >> PAGE_CACHE_SHIFT;
+	probe_end = min(end, index + AIO_READ_PROBE_PAGES - 1);
+	for (; index <= probe_end; index++)
+		if (!aio_page_cached(mapping, index))
+			return true;
+	if (end > probe_end && !aio_page_cached(mapping, end))
+		return true;
+	return false;
+}
+
+/*
+ * aio_read_work:
+ *	Runs a buffered read punted by io_submit_one() in the submitter's
+ *	mm context, and drops the submission reference it was handed.
+ */
+static void aio_read_work(struct work_struct *work)
+{
+	struct kiocb *iocb = container_of(work, struct kiocb, ki_work);
+	struct kioctx *ctx = iocb->ki_ctx;
+	mm_segment_t oldfs = get_fs();
+
+	set_fs(USER_DS);
+	use_mm(ctx->mm);
+	spin_lock_irq(&ctx->ctx_lock);
+	aio_run_iocb(iocb);
+	spin_unlock_irq(&ctx->ctx_lock);
+	unuse_mm(ctx->mm);
+	set_fs(oldfs);
+
+	aio_put_req(iocb);	/* drop extra ref to req */
+}
+
 static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
-			 struct iocb *iocb, bool compat)
+			 struct iocb *iocb, struct kiocb_batch *batch,
+			 bool compat)
 {
 	struct kiocb *req;
 	struct file *file;
 	ssize_t ret;
+	bool punt;
 
 	/* enforce forwards compatibility on users */
 	if (unlikely(iocb->aio_reserved1 || iocb->aio_reserved2)) {
@@ -1541,7 +1722,7 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	if (unlikely(!file))
 		return -EBADF;
 
-	req = aio_get_req(ctx);		/* returns with 2 references to req */
+	req = aio_get_req(ctx, batch);	/* returns with 2 references to req */
 	if (unlikely(!req)) {
 		fput(file);
 		return -EAGAIN;
@@ -1581,6 +1762,9 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	if (ret)
 		goto out_put_req;
 
+	/* probe the page cache before disabling interrupts */
+	punt = aio_read_would_block(req);
+
 	spin_lock_irq(&ctx->ctx_lock);
 	/*
 	 * We could have raced with io_destroy() and are currently holding a
@@ -1590,15 +1774,22 @@ static int io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	 * for outstanding IO and the barrier between these two is realized by
 	 * unlock of mm->ioctx_lock and lock of ctx->ctx_lock.  Analogously we
 	 * increment ctx->reqs_active before checking for ctx->dead and the
-	 * barrier is realized by unlock and lock of ctx->ctx_lock. Thus if we
-	 * don't see ctx->dead set here, io_destroy() waits for our IO to
-	 * finish.
+	 * barrier is realized by the atomic_add_return() in
+	 * kiocb_batch_refill(). Thus if we don't see ctx->dead set here,
+	 * io_destroy() waits for our IO to finish.
 	 */
 	if (ctx->dead) {
 		spin_unlock_irq(&ctx->ctx_lock);
 		ret = -EINVAL;
 		goto out_put_req;
 	}
+	if (punt) {
+		spin_unlock_irq(&ctx->ctx_lock);
+		/* the worker inherits our extra reference */
+		INIT_WORK(&req->ki_work, aio_read_work);
+		queue_work(aio_read_wq, &req->ki_work);
+		return 0;
+	}
 	aio_run_iocb(req);
 	if (!list_empty(&ctx->run_list)) {
 		/* drain the run list */
@@ -1623,6 +1814,7 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 	long ret = 0;
 	int i;
 	struct blk_plug plug;
+	struct kiocb_batch batch;
 
 	if (unlikely(nr < 0))
 		return -EINVAL;
@@ -1639,6 +1831,8 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 		return -EINVAL;
 	}
 
+	kiocb_batch_init(&batch, nr);
+
 	blk_start_plug(&plug);
 
 	/*
@@ -1659,12 +1853,14 @@ long do_io_submit(aio_context_t ctx_id, long nr,
 			break;
 		}
 
-		ret = io_submit_one(ctx, user_iocb, &tmp, compat);
+		ret = io_submit_one(ctx, user_iocb, &tmp, &batch, compat);
 		if (ret)
 			break;
 	}
 	blk_finish_plug(&plug);
 
+	kiocb_batch_free(ctx, &batch);
+
 	put_ioctx(ctx);
 	return i ? i : ret;
 }
@@ -1687,6 +1883,30 @@ SYSCALL_DEFINE3(io_submit, aio_context_t, ctx_id, long, nr,
 	return do_io_submit(ctx_id, nr, iocbpp, 0);
 }
 
+/* kiocb_set_cancel_fn
+ *	Makes @iocb cancellable through io_cancel().  Only cancellable
+ *	requests are kept on ctx->active_reqs, and only they need ctx_lock
+ *	when they complete.  Must be called before the i/o can complete.
+ */
+void kiocb_set_cancel_fn(struct kiocb *iocb,
+			 int (*cancel)(struct kiocb *, struct io_event *))
+{
+	struct kioctx *ctx = iocb->ki_ctx;
+	unsigned long flags;
+
+	if (is_sync_kiocb(iocb)) {
+		iocb->ki_cancel = cancel;
+		return;
+	}
+
+	spin_lock_irqsave(&ctx->ctx_lock, flags);
+	if (list_empty(&iocb->ki_list))
+		list_add(&iocb->ki_list, &ctx->active_reqs);
+	iocb->ki_cancel = cancel;
+	spin_unlock_irqrestore(&ctx->ctx_lock, flags);
+}
+EXPORT_SYMBOL(kiocb_set_cancel_fn);
+
 /* lookup_kiocb
  *	Finds a given iocb for cancellation.
  */
@@ -1736,9 +1956,9 @@ SYSCALL_DEFINE3(io_cancel, aio_context_t, ctx_id, struct iocb __user *, iocb,
 	spin_lock_irq(&ctx->ctx_lock);
 	ret = -EAGAIN;
 	kiocb = lookup_kiocb(ctx, iocb, key);
-	if (kiocb && kiocb->ki_cancel) {
+	if (kiocb && kiocb->ki_cancel &&
+	    atomic_inc_not_zero(&kiocb->ki_users)) {
 		cancel = kiocb->ki_cancel;
-		kiocb->ki_users ++;
 		kiocbSetCancelled(kiocb);
 	} else
 		cancel = NULL;
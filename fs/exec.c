@@ -269,6 +269,7 @@ static int __bprm_mm_init(struct linux_binprm *bprm)
 	bprm->vma = vma = kmem_cache_zalloc(vm_area_cachep, GFP_KERNEL);
 	if (!vma)
 		return -ENOMEM;
+	vma_init_speculative(vma);
 
 	down_write(&mm->mmap_sem);
 	vma->vm_mm = mm;
@@ -601,6 +602,7 @@ static int shift_arg_pages(struct vm_area_struct *vma, unsigned long shift)
 	unsigned long length = old_end - old_start;
 	unsigned long new_start = old_start - shift;
 	unsigned long new_end = old_end - shift;
+	unsigned long moved;
 	struct mmu_gather tlb;
 
 	BUG_ON(new_start > new_end);
@@ -622,8 +624,10 @@ static int shift_arg_pages(struct vm_area_struct *vma, unsigned long shift)
 	 * move the page tables downwards, on failure we rely on
 	 * process cleanup to remove whatever mess we made.
 	 */
-	if (length != move_page_tables(vma, old_start,
-				       vma, new_start, length))
+	vm_write_begin(vma);
+	moved = move_page_tables(vma, old_start, vma, new_start, length);
+	vm_write_end(vma);
+	if (length != moved)
 		return -ENOMEM;
 
 	lru_add_drain();
@@ -127,6 +127,22 @@ int jffs2_garbage_collect_pass(struct jffs2_sb_info *c)
 	int ret = 0, inum, nlink;
 	int xattr = 0;
 
+#ifdef CONFIG_JFFS2_FS_LAZY_CHECK
+	/* Erasing doesn't need the node CRCs to be checked. Do it first,
+	   so that the blocks the scan queued for erasure don't make us
+	   check the whole file system right after mount. */
+	spin_lock(&c->erase_completion_lock);
+	if (c->unchecked_size &&
+	    (!list_empty(&c->erase_complete_list) ||
+	     !list_empty(&c->erase_pending_list))) {
+		spin_unlock(&c->erase_completion_lock);
+		D1(printk(KERN_DEBUG "jffs2_garbage_collect_pass() erasing pending blocks before checking\n"));
+		if (jffs2_erase_pending_blocks(c, 1))
+			return 0;
+	} else
+		spin_unlock(&c->erase_completion_lock);
+#endif
+
 	if (mutex_lock_interruptible(&c->alloc_sem))
 		return -EINTR;
 
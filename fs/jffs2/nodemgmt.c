@@ -750,11 +750,13 @@ int jffs2_thread_should_wake(struct jffs2_sb_info *c)
 	    !list_empty(&c->erase_pending_list))
 		return 1;
 
+#ifndef CONFIG_JFFS2_FS_LAZY_CHECK
 	if (c->unchecked_size) {
 		D1(printk(KERN_DEBUG "jffs2_thread_should_wake(): unchecked_size %d, checked_ino #%d\n",
 			  c->unchecked_size, c->checked_ino));
 		return 1;
 	}
+#endif
 
 	/* dirty_size contains blocks on erase_pending_list
 	 * those blocks are counted in c->nr_erasing_blocks.
@@ -16,12 +16,16 @@
 #include <linux/pagemap.h>
 #include <linux/crc32.h>
 #include <linux/compiler.h>
+#include <linux/async.h>
 #include "nodelist.h"
 #include "summary.h"
 #include "debug.h"
 
 #define DEFAULT_EMPTY_SCAN_SIZE 256
 
+/* How many eraseblocks ahead of the scan summaries are read and checked */
+#define SUM_PREFETCH_DEPTH 32
+
 #define noisy_printk(noise, args...) do { \
 	if (*(noise)) { \
 		printk(KERN_NOTICE args); \
@@ -34,8 +38,22 @@
 
 static uint32_t pseudo_random;
 
+/* Summary node of an eraseblock, read and CRC-checked asynchronously while
+   the previous eraseblocks are being scanned. 'ret' is zero, a read error,
+   or 1 if a summary was found but its CRC was bad. */
+struct jffs2_sum_prefetch {
+	struct jffs2_sb_info *c;
+	struct jffs2_eraseblock *jeb;
+	struct jffs2_raw_summary *summary;
+	uint32_t sumlen;
+	int ret;
+	async_cookie_t cookie;
+};
+
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s);
+				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+				  struct jffs2_sum_prefetch *pf);
+static void jffs2_sum_prefetch(void *data, async_cookie_t cookie);
 
 /* These helper functions _must_ increase ofs and also do the dirty/used space accounting.
  * Returning an error will abort the mount - bad checksums etc. should just mark the space
@@ -93,6 +111,9 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	unsigned char *flashbuf = NULL;
 	uint32_t buf_size = 0;
 	struct jffs2_summary *s = NULL; /* summary info collected by the scan process */
+	struct jffs2_sum_prefetch *pf = NULL;
+	LIST_HEAD(prefetch_domain);
+	int next = 0;
 #ifndef __ECOS
 	size_t pointlen, try_size;
 
@@ -137,18 +158,44 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 			ret = -ENOMEM;
 			goto out;
 		}
+		/* Reading summaries in parallel is only worth it if they
+		   have to be read at all, i.e. not in the XIP case. If we
+		   can't get the memory, just scan one block at a time. */
+		if (buf_size)
+			pf = kcalloc(SUM_PREFETCH_DEPTH, sizeof(*pf), GFP_KERNEL);
 	}
 
 	for (i=0; i<c->nr_blocks; i++) {
 		struct jffs2_eraseblock *jeb = &c->blocks[i];
+		struct jffs2_sum_prefetch *p = NULL;
 
 		cond_resched();
 
+		if (pf) {
+			/* Keep the next SUM_PREFETCH_DEPTH summaries in flight.
+			   The slot being refilled is the one of the block we
+			   have just finished with. */
+			for (; next < c->nr_blocks && next < i + SUM_PREFETCH_DEPTH; next++) {
+				p = &pf[next % SUM_PREFETCH_DEPTH];
+				p->c = c;
+				p->jeb = &c->blocks[next];
+				p->cookie = async_schedule_domain(jffs2_sum_prefetch, p,
+								  &prefetch_domain);
+			}
+			p = &pf[i % SUM_PREFETCH_DEPTH];
+			async_synchronize_cookie_domain(p->cookie + 1, &prefetch_domain);
+		}
+
 		/* reset summary info for next eraseblock scan */
 		jffs2_sum_reset_collected(s);
 
 		ret = jffs2_scan_eraseblock(c, jeb, buf_size?flashbuf:(flashbuf+jeb->offset),
-						buf_size, s);
+						buf_size, s, p);
+
+		if (p) {
+			kfree(p->summary);
+			p->summary = NULL;
+		}
 
 		if (ret < 0)
 			goto out;
@@ -269,6 +316,12 @@ int jffs2_scan_medium(struct jffs2_sb_info *c)
 	}
 	ret = 0;
  out:
+	if (pf) {
+		async_synchronize_full_domain(&prefetch_domain);
+		for (i=0; i<SUM_PREFETCH_DEPTH; i++)
+			kfree(pf[i].summary);
+		kfree(pf);
+	}
 	if (buf_size)
 		kfree(flashbuf);
 #ifndef __ECOS
@@ -299,6 +352,62 @@ static int jffs2_fill_scan_buf(struct jffs2_sb_info *c, void *buf,
 	return 0;
 }
 
+/* Read the summary node of an eraseblock and check its CRCs. Runs
+   asynchronously, so it must not touch anything but the eraseblock's
+   prefetch slot. */
+static void jffs2_sum_prefetch(void *data, async_cookie_t cookie)
+{
+	struct jffs2_sum_prefetch *pf = data;
+	struct jffs2_sb_info *c = pf->c;
+	struct jffs2_eraseblock *jeb = pf->jeb;
+	struct jffs2_sum_marker sm;
+	struct jffs2_raw_summary *summary;
+	uint32_t sumlen;
+	int ret;
+
+	pf->summary = NULL;
+	pf->ret = 0;
+
+	/* jffs2_scan_eraseblock() won't look at bad blocks */
+	if (jffs2_cleanmarker_oob(c) && c->mtd->block_isbad(c->mtd, jeb->offset))
+		return;
+
+	ret = jffs2_fill_scan_buf(c, &sm, jeb->offset + c->sector_size - sizeof(sm),
+				  sizeof(sm));
+	if (ret) {
+		pf->ret = ret;
+		return;
+	}
+
+	if (je32_to_cpu(sm.magic) != JFFS2_SUM_MAGIC ||
+	    je32_to_cpu(sm.offset) >= c->sector_size - sizeof(*summary))
+		return;
+
+	sumlen = c->sector_size - je32_to_cpu(sm.offset);
+	summary = kmalloc(sumlen, GFP_KERNEL);
+	if (!summary) {
+		pf->ret = -ENOMEM;
+		return;
+	}
+
+	ret = jffs2_fill_scan_buf(c, summary, jeb->offset + je32_to_cpu(sm.offset),
+				  sumlen);
+	if (ret) {
+		kfree(summary);
+		pf->ret = ret;
+		return;
+	}
+
+	if (jffs2_sum_check_sumnode(c, summary, sumlen)) {
+		kfree(summary);
+		pf->ret = 1;
+		return;
+	}
+
+	pf->summary = summary;
+	pf->sumlen = sumlen;
+}
+
 int jffs2_scan_classify_jeb(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb)
 {
 	if ((jeb->used_size + jeb->unchecked_size) == PAD(c->cleanmarker_size) && !jeb->dirty_size
@@ -433,9 +542,11 @@ static int jffs2_scan_xref_node(struct jffs2_sb_info *c, struct jffs2_eraseblock
 #endif
 
 /* Called with 'buf_size == 0' if buf is in fact a pointer _directly_ into
-   the flash, XIP-style */
+   the flash, XIP-style. If 'pf' is not NULL, the summary node of the block
+   was already read and checked by jffs2_sum_prefetch() */
 static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
-				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s) {
+				  unsigned char *buf, uint32_t buf_size, struct jffs2_summary *s,
+				  struct jffs2_sum_prefetch *pf) {
 	struct jffs2_unknown_node *node;
 	struct jffs2_unknown_node crcnode;
 	uint32_t ofs, prevofs, max_ofs;
@@ -474,7 +585,19 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 	}
 #endif
 
-	if (jffs2_sum_active()) {
+	if (jffs2_sum_active() && pf) {
+		if (pf->ret < 0)
+			return pf->ret;
+		if (pf->ret)
+			JFFS2_WARNING("Summary node crc error, skipping summary information.\n");
+		if (pf->summary) {
+			err = jffs2_sum_process_sumnode(c, jeb, pf->summary, pf->sumlen,
+							&pseudo_random);
+			/* As below: an error or a block classification */
+			if (err)
+				return err;
+		}
+	} else if (jffs2_sum_active()) {
 		struct jffs2_sum_marker *sm;
 		void *sumptr = NULL;
 		uint32_t sumlen;
@@ -30,6 +30,14 @@ static bool should_merge(struct fsnotify_event *old, struct fsnotify_event *new)
 	return false;
 }
 
+/*
+ * How many of the most recently queued events are checked for a merge.
+ * Repeated events on the same object tend to arrive close together, and
+ * bounding the search keeps queueing cheap even when the listener falls far
+ * behind and the queue holds thousands of events.
+ */
+#define FANOTIFY_MAX_MERGE_EVENTS 128
+
 /* and the list better be locked by something too! */
 static struct fsnotify_event *fanotify_merge(struct list_head *list,
 					     struct fsnotify_event *event)
@@ -37,6 +45,7 @@ static struct fsnotify_event *fanotify_merge(struct list_head *list,
 	struct fsnotify_event_holder *test_holder;
 	struct fsnotify_event *test_event = NULL;
 	struct fsnotify_event *new_event;
+	int i = 0;
 
 	pr_debug("%s: list=%p event=%p\n", __func__, list, event);
 
@@ -46,6 +55,8 @@ static struct fsnotify_event *fanotify_merge(struct list_head *list,
 			test_event = test_holder->event;
 			break;
 		}
+		if (++i >= FANOTIFY_MAX_MERGE_EVENTS)
+			break;
 	}
 
 	if (!test_event)
@@ -123,44 +123,55 @@ static unsigned int inotify_poll(struct file *file, poll_table *wait)
 	return ret;
 }
 
+/* max number of events dequeued per notification_mutex hold in inotify_read */
+#define INOTIFY_READ_BATCH	16
+
 /*
- * Get an inotify_kernel_event if one exists and is small
- * enough to fit in "count". Return an error pointer if
- * not large enough.
+ * Dequeue as many events as fit into @count bytes of user buffer, up to
+ * INOTIFY_READ_BATCH, so a reader draining a busy queue takes the
+ * notification_mutex once per batch rather than once per event.  Returns the
+ * number of events stored in @events, 0 if the queue is empty or -EINVAL if
+ * not even the first event fits.
  *
  * Called with the group->notification_mutex held.
  */
-static struct fsnotify_event *get_one_event(struct fsnotify_group *group,
-					    size_t count)
+static int get_events(struct fsnotify_group *group, size_t count,
+		      struct fsnotify_event **events)
 {
-	size_t event_size = sizeof(struct inotify_event);
 	struct fsnotify_event *event;
+	size_t event_size;
+	int nr = 0;
 
-	if (fsnotify_notify_queue_is_empty(group))
-		return NULL;
+	BUG_ON(!mutex_is_locked(&group->notification_mutex));
 
-	event = fsnotify_peek_notify_event(group);
+	while (nr < INOTIFY_READ_BATCH &&
+	       !fsnotify_notify_queue_is_empty(group)) {
+		event = fsnotify_peek_notify_event(group);
 
-	pr_debug("%s: group=%p event=%p\n", __func__, group, event);
+		pr_debug("%s: group=%p event=%p\n", __func__, group, event);
 
-	if (event->name_len)
-		event_size += roundup(event->name_len + 1, event_size);
+		event_size = sizeof(struct inotify_event);
+		if (event->name_len)
+			event_size += roundup(event->name_len + 1, event_size);
 
-	if (event_size > count)
-		return ERR_PTR(-EINVAL);
+		if (event_size > count)
+			return nr ? nr : -EINVAL;
 
-	/* held the notification_mutex the whole time, so this is the
-	 * same event we peeked above */
-	fsnotify_remove_notify_event(group);
+		/* held the notification_mutex the whole time, so this is the
+		 * same event we peeked above */
+		fsnotify_remove_notify_event(group);
+		events[nr++] = event;
+		count -= event_size;
+	}
 
-	return event;
+	return nr;
 }
 
 /*
  * Copy an event to user space, returning how much we copied.
  *
  * We already checked that the event size is smaller than the
- * buffer we had in "get_one_event()" above.
+ * buffer we had in "get_events()" above.
  */
 static ssize_t copy_event_to_user(struct fsnotify_group *group,
 				  struct fsnotify_event *event,
@@ -227,13 +238,43 @@ static ssize_t copy_event_to_user(struct fsnotify_group *group,
 	return event_size;
 }
 
+/*
+ * Put the events of a batch that were not copied, because an earlier event
+ * faulted, back at the head of the queue in their original order.  Only if
+ * no event holder can be allocated is an event dropped.
+ */
+static void requeue_events(struct fsnotify_group *group,
+			   struct fsnotify_event **events, int nr)
+{
+	struct fsnotify_event_private_data *fsn_priv;
+	struct fsnotify_event *event;
+
+	mutex_lock(&group->notification_mutex);
+	while (nr--) {
+		event = events[nr];
+		if (!fsnotify_requeue_notify_event(group, event))
+			continue;
+
+		spin_lock(&event->lock);
+		fsn_priv = fsnotify_remove_priv_from_event(group, event);
+		spin_unlock(&event->lock);
+
+		if (fsn_priv)
+			inotify_free_event_priv(fsn_priv);
+		fsnotify_put_event(event);
+	}
+	mutex_unlock(&group->notification_mutex);
+
+	wake_up(&group->notification_waitq);
+}
+
 static ssize_t inotify_read(struct file *file, char __user *buf,
 			    size_t count, loff_t *pos)
 {
 	struct fsnotify_group *group;
-	struct fsnotify_event *kevent;
+	struct fsnotify_event *kevents[INOTIFY_READ_BATCH];
 	char __user *start;
-	int ret;
+	int i, nr, ret;
 	DEFINE_WAIT(wait);
 
 	start = buf;
@@ -243,21 +284,28 @@ static ssize_t inotify_read(struct file *file, char __user *buf,
 		prepare_to_wait(&group->notification_waitq, &wait, TASK_INTERRUPTIBLE);
 
 		mutex_lock(&group->notification_mutex);
-		kevent = get_one_event(group, count);
+		nr = get_events(group, count, kevents);
 		mutex_unlock(&group->notification_mutex);
 
-		pr_debug("%s: group=%p kevent=%p\n", __func__, group, kevent);
+		pr_debug("%s: group=%p nr=%d\n", __func__, group, nr);
 
-		if (kevent) {
-			ret = PTR_ERR(kevent);
-			if (IS_ERR(kevent))
+		if (nr) {
+			ret = nr;
+			if (nr < 0)
 				break;
-			ret = copy_event_to_user(group, kevent, buf);
-			fsnotify_put_event(kevent);
-			if (ret < 0)
+			for (i = 0; i < nr; i++) {
+				ret = copy_event_to_user(group, kevents[i], buf);
+				fsnotify_put_event(kevents[i]);
+				if (ret < 0)
+					break;
+				buf += ret;
+				count -= ret;
+			}
+			if (ret < 0) {
+				requeue_events(group, kevents + i + 1,
+					       nr - i - 1);
 				break;
-			buf += ret;
-			count -= ret;
+			}
 			continue;
 		}
 
@@ -94,7 +94,8 @@ void fsnotify_put_event(struct fsnotify_event *event)
 
 		BUG_ON(!list_empty(&event->private_data_list));
 
-		kfree(event->file_name);
+		if (event->file_name != event->inline_name)
+			kfree(event->file_name);
 		put_pid(event->tgid);
 		kmem_cache_free(fsnotify_event_cachep, event);
 	}
@@ -260,6 +261,48 @@ struct fsnotify_event *fsnotify_remove_notify_event(struct fsnotify_group *group
 	return event;
 }
 
+/*
+ * Put an event taken off the queue with fsnotify_remove_notify_event() back at
+ * the head of the queue, e.g. because it could not be delivered.  The reference
+ * that came with the event is handed back to the queue.  Returns -ENOMEM, and
+ * leaves the reference with the caller, if no holder could be allocated.
+ */
+int fsnotify_requeue_notify_event(struct fsnotify_group *group,
+				  struct fsnotify_event *event)
+{
+	struct fsnotify_event_holder *holder = NULL;
+
+	BUG_ON(!mutex_is_locked(&group->notification_mutex));
+
+	pr_debug("%s: group=%p event=%p\n", __func__, group, event);
+
+	/* the in event holder may have been taken by another group meanwhile */
+	if (!list_empty(&event->holder.event_list)) {
+alloc_holder:
+		holder = fsnotify_alloc_event_holder();
+		if (!holder)
+			return -ENOMEM;
+	}
+
+	spin_lock(&event->lock);
+
+	if (list_empty(&event->holder.event_list)) {
+		if (unlikely(holder))
+			fsnotify_destroy_event_holder(holder);
+		holder = &event->holder;
+	} else if (unlikely(!holder)) {
+		spin_unlock(&event->lock);
+		goto alloc_holder;
+	}
+
+	group->q_len++;
+	holder->event = event;
+	list_add(&holder->event_list, &group->notification_list);
+	spin_unlock(&event->lock);
+
+	return 0;
+}
+
 /*
  * This will not remove the event, that must be done with fsnotify_remove_notify_event()
  */
@@ -311,6 +354,27 @@ static void initialize_event(struct fsnotify_event *event)
 	INIT_LIST_HEAD(&event->private_data_list);
 }
 
+/*
+ * Point event->file_name at a copy of @name.  Short names, which are the
+ * vast majority, are stored in the event itself so creating an event for
+ * them is a single allocation.
+ */
+static int fsnotify_set_event_name(struct fsnotify_event *event,
+				   const unsigned char *name, size_t len,
+				   gfp_t gfp)
+{
+	if (len < FSNOTIFY_INLINE_NAME_LEN) {
+		memcpy(event->inline_name, name, len + 1);
+		event->file_name = event->inline_name;
+	} else {
+		event->file_name = kmemdup(name, len + 1, gfp);
+		if (!event->file_name)
+			return -ENOMEM;
+	}
+	event->name_len = len;
+	return 0;
+}
+
 /*
  * Caller damn well better be holding whatever mutex is protecting the
  * old_holder->event_list and the new_event must be a clean event which
@@ -368,8 +432,8 @@ struct fsnotify_event *fsnotify_clone_event(struct fsnotify_event *old_event)
 	initialize_event(event);
 
 	if (event->name_len) {
-		event->file_name = kstrdup(old_event->file_name, GFP_KERNEL);
-		if (!event->file_name) {
+		if (fsnotify_set_event_name(event, old_event->file_name,
+					    old_event->name_len, GFP_KERNEL)) {
 			kmem_cache_free(fsnotify_event_cachep, event);
 			return NULL;
 		}
@@ -409,12 +473,11 @@ struct fsnotify_event *fsnotify_create_event(struct inode *to_tell, __u32 mask,
 	initialize_event(event);
 
 	if (name) {
-		event->file_name = kstrdup(name, gfp);
-		if (!event->file_name) {
+		if (fsnotify_set_event_name(event, name,
+					    strlen((const char *)name), gfp)) {
 			kmem_cache_free(fsnotify_event_cachep, event);
 			return NULL;
 		}
-		event->name_len = strlen(event->file_name);
 	}
 
 	event->tgid = get_pid(task_tgid(current));
@@ -37,13 +37,24 @@
  * Generic range manager structs
  */
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #ifdef CONFIG_DEBUG_FS
 #include <linux/seq_file.h>
 #endif
 
+enum drm_mm_search_flags {
+	DRM_MM_SEARCH_DEFAULT =		0,	/* lowest suitable hole */
+	DRM_MM_SEARCH_BEST =		1 << 0,	/* smallest suitable hole */
+	DRM_MM_SEARCH_TOPDOWN =		1 << 1,	/* highest suitable hole */
+};
+
 struct drm_mm_node {
 	struct list_head node_list;
-	struct list_head hole_stack;
+	/* Links in the hole trees, only valid while hole_follows is set. */
+	struct rb_node rb_hole_size;
+	struct rb_node rb_hole_addr;
+	unsigned long hole_size;
+	unsigned long subtree_max_hole;
 	unsigned hole_follows : 1;
 	unsigned scanned_block : 1;
 	unsigned scanned_prev_free : 1;
@@ -56,8 +67,10 @@ struct drm_mm_node {
 };
 
 struct drm_mm {
-	/* List of all memory nodes that immediately precede a free hole. */
-	struct list_head hole_stack;
+	/* All memory nodes that immediately precede a free hole, sorted by
+	 * the size and by the start address of that hole. */
+	struct rb_root holes_size;
+	struct rb_root holes_addr;
 	/* head_node.node_list is the list of all memory nodes, ordered
 	 * according to the (increasing) start address of the memory node. */
 	struct drm_mm_node head_node;
@@ -68,7 +81,7 @@ struct drm_mm {
 	unsigned scan_alignment;
 	unsigned long scan_size;
 	unsigned long scan_hit_start;
-	unsigned scan_hit_size;
+	unsigned long scan_hit_end;
 	unsigned scanned_blocks;
 	unsigned long scan_start;
 	unsigned long scan_end;
@@ -82,7 +95,7 @@ static inline bool drm_mm_node_allocated(struct drm_mm_node *node)
 
 static inline bool drm_mm_initialized(struct drm_mm *mm)
 {
-	return mm->hole_stack.next;
+	return mm->head_node.mm;
 }
 #define drm_mm_for_each_node(entry, mm) list_for_each_entry(entry, \
 						&(mm)->head_node.node_list, \
@@ -140,26 +153,58 @@ static inline struct drm_mm_node *drm_mm_get_block_atomic_range(
 	return drm_mm_get_block_range_generic(parent, size, alignment,
 						start, end, 1);
 }
-extern int drm_mm_insert_node(struct drm_mm *mm, struct drm_mm_node *node,
-			      unsigned long size, unsigned alignment);
-extern int drm_mm_insert_node_in_range(struct drm_mm *mm,
-				       struct drm_mm_node *node,
-				       unsigned long size, unsigned alignment,
-				       unsigned long start, unsigned long end);
+extern int drm_mm_insert_node_generic(struct drm_mm *mm,
+				      struct drm_mm_node *node,
+				      unsigned long size, unsigned alignment,
+				      unsigned long start, unsigned long end,
+				      enum drm_mm_search_flags flags);
+static inline int drm_mm_insert_node(struct drm_mm *mm,
+				     struct drm_mm_node *node,
+				     unsigned long size, unsigned alignment)
+{
+	return drm_mm_insert_node_generic(mm, node, size, alignment,
+					  0, ~0UL, DRM_MM_SEARCH_DEFAULT);
+}
+static inline int drm_mm_insert_node_in_range(struct drm_mm *mm,
+					      struct drm_mm_node *node,
+					      unsigned long size,
+					      unsigned alignment,
+					      unsigned long start,
+					      unsigned long end)
+{
+	return drm_mm_insert_node_generic(mm, node, size, alignment,
+					  start, end, DRM_MM_SEARCH_DEFAULT);
+}
 extern void drm_mm_put_block(struct drm_mm_node *cur);
 extern void drm_mm_remove_node(struct drm_mm_node *node);
 extern void drm_mm_replace_node(struct drm_mm_node *old, struct drm_mm_node *new);
-extern struct drm_mm_node *drm_mm_search_free(const struct drm_mm *mm,
-					      unsigned long size,
-					      unsigned alignment,
-					      int best_match);
-extern struct drm_mm_node *drm_mm_search_free_in_range(
+extern struct drm_mm_node *drm_mm_search_free_generic(const struct drm_mm *mm,
+						      unsigned long size,
+						      unsigned alignment,
+						      unsigned long start,
+						      unsigned long end,
+						      enum drm_mm_search_flags flags);
+static inline struct drm_mm_node *drm_mm_search_free(const struct drm_mm *mm,
+						     unsigned long size,
+						     unsigned alignment,
+						     int best_match)
+{
+	return drm_mm_search_free_generic(mm, size, alignment, 0, ~0UL,
+					  best_match ? DRM_MM_SEARCH_BEST :
+						       DRM_MM_SEARCH_DEFAULT);
+}
+static inline struct drm_mm_node *drm_mm_search_free_in_range(
 						const struct drm_mm *mm,
 						unsigned long size,
 						unsigned alignment,
 						unsigned long start,
 						unsigned long end,
-						int best_match);
+						int best_match)
+{
+	return drm_mm_search_free_generic(mm, size, alignment, start, end,
+					  best_match ? DRM_MM_SEARCH_BEST :
+						       DRM_MM_SEARCH_DEFAULT);
+}
 extern int drm_mm_init(struct drm_mm *mm, unsigned long start,
 		       unsigned long size);
 extern void drm_mm_takedown(struct drm_mm *mm);
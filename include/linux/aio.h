@@ -87,7 +87,7 @@ struct kioctx;
 struct kiocb {
 	struct list_head	ki_run_list;
 	unsigned long		ki_flags;
-	int			ki_users;
+	atomic_t		ki_users;
 	unsigned		ki_key;		/* id of this request */
 
 	struct file		*ki_filp;
@@ -116,13 +116,17 @@ struct kiocb {
  	unsigned long		ki_cur_seg;
 
 	struct list_head	ki_list;	/* the aio core uses this
-						 * for cancellation */
+						 * for cancellation and
+						 * submission batching */
 
 	/*
 	 * If the aio_resfd field of the userspace iocb is not zero,
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/* used to punt buffered reads that would block to a worker */
+	struct work_struct	ki_work;
 };
 
 #define is_sync_kiocb(iocb)	((iocb)->ki_key == KIOCB_SYNC_KEY)
@@ -130,7 +134,7 @@ struct kiocb {
 	do {						\
 		struct task_struct *tsk = current;	\
 		(x)->ki_flags = 0;			\
-		(x)->ki_users = 1;			\
+		atomic_set(&(x)->ki_users, 1);		\
 		(x)->ki_key = KIOCB_SYNC_KEY;		\
 		(x)->ki_filp = (filp);			\
 		(x)->ki_ctx = NULL;			\
@@ -167,10 +171,13 @@ struct aio_ring_info {
 	unsigned long		mmap_size;
 
 	struct page		**ring_pages;
+	struct aio_ring		*ring;		/* kernel mapping of the ring */
 	spinlock_t		ring_lock;
 	long			nr_pages;
 
-	unsigned		nr, tail;
+	unsigned		nr;
+	unsigned		tail;		/* next slot to be reserved */
+	unsigned		commit;		/* slots published to userspace */
 
 	struct page		*internal_pages[AIO_RING_PAGES];
 };
@@ -188,8 +195,8 @@ struct kioctx {
 
 	spinlock_t		ctx_lock;
 
-	int			reqs_active;
-	struct list_head	active_reqs;	/* used for cancellation */
+	atomic_t		reqs_active;
+	struct list_head	active_reqs;	/* cancellable reqs */
 	struct list_head	run_list;	/* used for kicked reqs */
 
 	/* sys_io_setup currently limits this to an unsigned int */
@@ -210,6 +217,8 @@ extern ssize_t wait_on_sync_kiocb(struct kiocb *iocb);
 extern int aio_put_req(struct kiocb *iocb);
 extern void kick_iocb(struct kiocb *iocb);
 extern int aio_complete(struct kiocb *iocb, long res, long res2);
+extern void kiocb_set_cancel_fn(struct kiocb *iocb,
+			int (*cancel)(struct kiocb *, struct io_event *));
 struct mm_struct;
 extern void exit_aio(struct mm_struct *mm);
 extern long do_io_submit(aio_context_t ctx_id, long nr,
@@ -219,6 +228,8 @@ static inline ssize_t wait_on_sync_kiocb(struct kiocb *iocb) { return 0; }
 static inline int aio_put_req(struct kiocb *iocb) { return 0; }
 static inline void kick_iocb(struct kiocb *iocb) { }
 static inline int aio_complete(struct kiocb *iocb, long res, long res2) { return 0; }
+static inline void kiocb_set_cancel_fn(struct kiocb *iocb,
+			int (*cancel)(struct kiocb *, struct io_event *)) { }
 struct mm_struct;
 static inline void exit_aio(struct mm_struct *mm) { }
 static inline long do_io_submit(aio_context_t ctx_id, long nr,
@@ -96,6 +96,8 @@ struct bus_type {
 
 	const struct dev_pm_ops *pm;
 
+	bool async_probe;	/* probe all drivers asynchronously */
+
 	struct subsys_private *p;
 };
 
@@ -190,6 +192,7 @@ struct device_driver {
 	const char		*mod_name;	/* used for built-in modules */
 
 	bool suppress_bind_attrs;	/* disables bind/unbind via sysfs */
+	bool async_probe;		/* probe devices asynchronously */
 
 	const struct of_device_id	*of_match_table;
 
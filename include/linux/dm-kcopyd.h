@@ -21,13 +21,45 @@
 
 #define DM_KCOPYD_IGNORE_ERROR 1
 
+/*
+ * Background copies (resync, merge) can be throttled so they leave the
+ * disks free for normal io some of the time.  @throttle is the percentage
+ * of time kcopyd may have io in flight; 100 means unthrottled.  The
+ * other fields are private to kcopyd.
+ *
+ * Several clients may share one throttle to be limited as a group.
+ */
+struct dm_kcopyd_throttle {
+	unsigned throttle;
+	unsigned num_io_jobs;
+	unsigned io_period;
+	unsigned total_period;
+	unsigned last_jiffies;
+};
+
+/*
+ * Declares a throttle named dm_kcopyd_throttle for the current module,
+ * tunable through the module parameter @name.
+ */
+#define DECLARE_DM_KCOPYD_THROTTLE_WITH_MODULE_PARM(name, description)	\
+static struct dm_kcopyd_throttle dm_kcopyd_throttle = { 100, 0, 0, 0, 0 }; \
+module_param_named(name, dm_kcopyd_throttle.throttle, uint, 0644);	\
+MODULE_PARM_DESC(name, description)
+
 /*
  * To use kcopyd you must first create a dm_kcopyd_client object.
+ * @throttle may be NULL if the client's copies are never throttled.
  */
 struct dm_kcopyd_client;
-struct dm_kcopyd_client *dm_kcopyd_client_create(void);
+struct dm_kcopyd_client *dm_kcopyd_client_create(struct dm_kcopyd_throttle *throttle);
 void dm_kcopyd_client_destroy(struct dm_kcopyd_client *kc);
 
+/*
+ * Total number of sectors successfully copied by this client, for
+ * progress and throughput reporting.
+ */
+uint64_t dm_kcopyd_copied_sectors(struct dm_kcopyd_client *kc);
+
 /*
  * Submit a copy job to kcopyd.  This is built on top of the
  * previous three fns.
@@ -598,6 +598,15 @@ struct fb_pixmap {
 };
 
 #ifdef CONFIG_FB_DEFERRED_IO
+/* maximum number of disjoint damage rectangles tracked between flushes */
+#define FB_DEFERRED_IO_MAX_DAMAGE	4
+
+/* damaged area in pixels, x2 and y2 are exclusive */
+struct fb_damage_rect {
+	u32 x1, y1;
+	u32 x2, y2;
+};
+
 struct fb_deferred_io {
 	/* delay between mkwrite and deferred handler */
 	unsigned long delay;
@@ -605,6 +614,16 @@ struct fb_deferred_io {
 	struct list_head pagelist; /* list of touched pages */
 	/* callback */
 	void (*deferred_io)(struct fb_info *info, struct list_head *pagelist);
+	/*
+	 * optional callback, called with the coalesced damage rectangles
+	 * after deferred_io so the driver only needs to push changed pixels
+	 */
+	void (*deferred_io_damage)(struct fb_info *info,
+				   const struct fb_damage_rect *rects, int count);
+	spinlock_t damage_lock; /* protects the damage rectangles */
+	int damage_count;
+	struct fb_damage_rect damage[FB_DEFERRED_IO_MAX_DAMAGE];
+	unsigned long flushed_bytes; /* bytes handed to the driver so far */
 };
 #endif
 
@@ -1045,6 +1064,10 @@ extern void fb_deferred_io_open(struct fb_info *info,
 				struct inode *inode,
 				struct file *file);
 extern void fb_deferred_io_cleanup(struct fb_info *info);
+extern void fb_deferred_io_damage(struct fb_info *info, u32 x, u32 y,
+				  u32 width, u32 height);
+extern void fb_deferred_io_damage_range(struct fb_info *info,
+					unsigned long offset, size_t len);
 extern int fb_deferred_io_fsync(struct file *file, int datasync);
 
 static inline bool fb_be_math(struct fb_info *info)
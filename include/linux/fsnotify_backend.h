@@ -200,6 +200,12 @@ struct fsnotify_event_private_data {
 	struct list_head event_list;
 };
 
+/*
+ * Names up to this length (including the trailing '\0') are stored inside the
+ * event itself instead of in a separate allocation.
+ */
+#define FSNOTIFY_INLINE_NAME_LEN	32
+
 /*
  * all of the information about the original object we want to now send to
  * a group.  If you want to carry more info from the accessing task to the
@@ -239,6 +245,7 @@ struct fsnotify_event {
 	const unsigned char *file_name;
 	size_t name_len;
 	struct pid *tgid;
+	unsigned char inline_name[FSNOTIFY_INLINE_NAME_LEN]; /* short file_name */
 
 #ifdef CONFIG_FANOTIFY_ACCESS_PERMISSIONS
 	__u32 response;	/* userspace answer to question */
@@ -384,6 +391,9 @@ extern bool fsnotify_notify_queue_is_empty(struct fsnotify_group *group);
 extern struct fsnotify_event *fsnotify_peek_notify_event(struct fsnotify_group *group);
 /* return AND dequeue the first event on the notification queue */
 extern struct fsnotify_event *fsnotify_remove_notify_event(struct fsnotify_group *group);
+/* put a dequeued event back at the head of the notification queue */
+extern int fsnotify_requeue_notify_event(struct fsnotify_group *group,
+					 struct fsnotify_event *event);
 
 /* functions used to manipulate the marks attached to inodes */
 
@@ -344,6 +344,11 @@ struct module
 
 	unsigned int taints;	/* same bits as kernel:tainted */
 
+#ifdef CONFIG_MODULE_SYMBOL_HASH
+	/* Our exported symbols in the global symbol hash */
+	struct module_symhash *symhash;
+#endif
+
 #ifdef CONFIG_GENERIC_BUG
 	/* Support for BUG */
 	unsigned num_bugs;
@@ -33,7 +33,7 @@
  */
 
 
-#define TASKSTATS_VERSION	8
+#define TASKSTATS_VERSION	9
 #define TS_COMM_LEN		32	/* should be >= TASK_COMM_LEN
 					 * in linux/sched.h */
 
@@ -163,6 +163,12 @@ struct taskstats {
 	/* Delay waiting for memory reclaim */
 	__u64	freepages_count;
 	__u64	freepages_delay_total;
+	/* version 8 ends here */
+
+	__u32	ac_tgid;		/* Thread group ID */
+	__u32	ac_nr_threads;		/* Threads in the thread group */
+	__u64	cur_rss;		/* Current RSS usage, in KB */
+	__u64	cur_vm;			/* Current virtual memory size, in KB */
 };
 
 
@@ -91,6 +91,7 @@ struct tty_bufhead {
 	struct tty_buffer *free;	/* Free queue head */
 	int memory_used;		/* Buffer space used excluding
 								free queue */
+	int memory_free;		/* Buffer space in the free queue */
 };
 /*
  * When a break, frame error, or parity error happens, these codes are
@@ -38,10 +38,25 @@ struct virtqueue {
  * virtqueue_kick: update after add_buf
  *	vq: the struct virtqueue
  *	After one or more add_buf calls, invoke this to kick the other side.
+ * virtqueue_kick_prepare: first half of split virtqueue_kick call.
+ *	vq: the struct virtqueue
+ *	Publishes the added buffers and returns true if the other side needs
+ *	to be notified, which can then be done with virtqueue_notify outside
+ *	of the driver's lock.
+ * virtqueue_notify: second half of split virtqueue_kick call.
+ *	vq: the struct virtqueue
  * virtqueue_get_buf: get the next used buffer
  *	vq: the struct virtqueue we're talking about.
  *	len: the length written into the buffer
  *	Returns NULL or the "data" token handed to add_buf.
+ * virtqueue_get_bufs: get up to max used buffers at once
+ *	vq: the struct virtqueue we're talking about.
+ *	bufs: array receiving the "data" tokens handed to add_buf.
+ *	lens: array receiving the lengths written into the buffers.
+ *	max: the size of the arrays.
+ *	Returns the number of buffers detached.  Cheaper than calling
+ *	virtqueue_get_buf in a loop: the used index and event index are
+ *	only accessed once per batch.
  * virtqueue_disable_cb: disable callbacks
  *	vq: the struct virtqueue we're talking about.
  *	Note that this is not necessarily synchronous, hence unreliable and only
@@ -87,8 +102,15 @@ static inline int virtqueue_add_buf(struct virtqueue *vq,
 
 void virtqueue_kick(struct virtqueue *vq);
 
+bool virtqueue_kick_prepare(struct virtqueue *vq);
+
+void virtqueue_notify(struct virtqueue *vq);
+
 void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len);
 
+unsigned int virtqueue_get_bufs(struct virtqueue *vq, void **bufs,
+				unsigned int *lens, unsigned int max);
+
 void virtqueue_disable_cb(struct virtqueue *vq);
 
 bool virtqueue_enable_cb(struct virtqueue *vq);
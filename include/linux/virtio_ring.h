@@ -58,6 +58,11 @@
  * at the end of the used ring. Guest should ignore the used->flags field. */
 #define VIRTIO_RING_F_EVENT_IDX		29
 
+/* The Host uses buffers in the same order in which they were made available.
+ * The Guest then hands out descriptors in ring order, wrapping around at the
+ * end of the table, so descriptor chains are always contiguous. */
+#define VIRTIO_RING_F_IN_ORDER		31
+
 /* Virtio ring descriptors: 16 bytes.  These can chain together via "next". */
 struct vring_desc {
 	/* Address (guest-physical). */
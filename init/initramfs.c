@@ -8,6 +8,13 @@
 #include <linux/dirent.h>
 #include <linux/syscalls.h>
 #include <linux/utime.h>
+#include <linux/file.h>
+#include <linux/namei.h>
+#include <linux/kthread.h>
+#include <linux/async.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
+#include <linux/initrd.h>
 
 static __initdata char *message;
 static void __init error(char *x)
@@ -288,7 +295,45 @@ static void __init clean_path(char *path, mode_t mode)
 	}
 }
 
-static __initdata int wfd;
+static __initdata struct file *wfile;
+static __initdata loff_t wfile_pos;
+
+/*
+ * Regular files are created and written through their struct file rather
+ * than through file descriptors, which saves the fd table updates and the
+ * repeated lookups of the sys_* calls for every file in the archive.
+ */
+static void __init wfile_setattr(void)
+{
+	struct dentry *dentry = wfile->f_path.dentry;
+	struct inode *inode = dentry->d_inode;
+	struct iattr newattrs;
+
+	newattrs.ia_valid = ATTR_UID | ATTR_GID | ATTR_MODE | ATTR_CTIME;
+	newattrs.ia_uid = uid;
+	newattrs.ia_gid = gid;
+	newattrs.ia_mode = (mode & S_IALLUGO) | (inode->i_mode & ~S_IALLUGO);
+	mutex_lock(&inode->i_mutex);
+	notify_change(dentry, &newattrs);
+	mutex_unlock(&inode->i_mutex);
+
+	if (body_len)
+		do_truncate(dentry, body_len, 0, wfile);
+}
+
+static void __init wfile_write(const char *buf, size_t len)
+{
+	while (len) {
+		ssize_t ret = vfs_write(wfile, (const char __user __force *)buf,
+					len, &wfile_pos);
+		if (ret <= 0) {
+			error("write error");
+			return;
+		}
+		buf += ret;
+		len -= ret;
+	}
+}
 
 static int __init do_name(void)
 {
@@ -302,16 +347,14 @@ static int __init do_name(void)
 	if (S_ISREG(mode)) {
 		int ml = maybe_link();
 		if (ml >= 0) {
-			int openflags = O_WRONLY|O_CREAT;
+			int openflags = O_WRONLY|O_CREAT|O_LARGEFILE;
 			if (ml != 1)
 				openflags |= O_TRUNC;
-			wfd = sys_open(collected, openflags, mode);
+			wfile = filp_open(collected, openflags, mode);
 
-			if (wfd >= 0) {
-				sys_fchown(wfd, uid, gid);
-				sys_fchmod(wfd, mode);
-				if (body_len)
-					sys_ftruncate(wfd, body_len);
+			if (!IS_ERR(wfile)) {
+				wfile_pos = 0;
+				wfile_setattr();
 				vcollected = kstrdup(collected, GFP_KERNEL);
 				state = CopyFile;
 			}
@@ -336,15 +379,15 @@ static int __init do_name(void)
 static int __init do_copy(void)
 {
 	if (count >= body_len) {
-		sys_write(wfd, victim, body_len);
-		sys_close(wfd);
+		wfile_write(victim, body_len);
+		fput(wfile);
 		do_utime(vcollected, mtime);
 		kfree(vcollected);
 		eat(body_len);
 		state = SkipIt;
 		return 0;
 	} else {
-		sys_write(wfd, victim, count);
+		wfile_write(victim, count);
 		body_len -= count;
 		eat(count);
 		return 1;
@@ -384,13 +427,10 @@ static int __init write_buffer(char *buf, unsigned len)
 	return len - count;
 }
 
-static int __init flush_buffer(void *bufv, unsigned len)
+static void __init unpack_buffer(char *buf, unsigned len)
 {
-	char *buf = (char *) bufv;
 	int written;
-	int origLen = len;
-	if (message)
-		return -1;
+
 	while ((written = write_buffer(buf, len)) < len && !message) {
 		char c = buf[written];
 		if (c == '0') {
@@ -404,6 +444,114 @@ static int __init flush_buffer(void *bufv, unsigned len)
 		} else
 			error("junk in compressed archive");
 	}
+}
+
+/*
+ * Decompression and unpacking run in parallel: the decompressor queues its
+ * output in chunks, and a writer thread feeds them to the cpio state machine.
+ * The amount of queued data is bounded, so the decompressor is throttled if
+ * the writer can't keep up. If the writer thread can't be started, the
+ * output is unpacked synchronously.
+ */
+#define UNPACK_CHUNK_SIZE	(16 * 1024)
+#define UNPACK_MAX_QUEUED	(64 * UNPACK_CHUNK_SIZE)
+
+struct unpack_chunk {
+	struct list_head list;
+	unsigned len;
+	char data[];
+};
+
+static __initdata LIST_HEAD(unpack_queue);
+static DEFINE_SPINLOCK(unpack_lock);
+static DECLARE_WAIT_QUEUE_HEAD(unpack_wait);
+/* Bytes queued or being unpacked, protected by unpack_lock */
+static __initdata unsigned unpack_queued;
+static __initdata struct task_struct *unpack_writer;
+
+static unsigned __init unpack_pending(void)
+{
+	unsigned ret;
+
+	spin_lock(&unpack_lock);
+	ret = unpack_queued;
+	spin_unlock(&unpack_lock);
+	return ret;
+}
+
+static int __init unpack_writer_fn(void *unused)
+{
+	struct unpack_chunk *chunk;
+
+	for (;;) {
+		wait_event(unpack_wait,
+			   unpack_pending() || kthread_should_stop());
+
+		spin_lock(&unpack_lock);
+		if (list_empty(&unpack_queue)) {
+			spin_unlock(&unpack_lock);
+			break;
+		}
+		chunk = list_first_entry(&unpack_queue, struct unpack_chunk,
+					 list);
+		list_del(&chunk->list);
+		spin_unlock(&unpack_lock);
+
+		if (!message)
+			unpack_buffer(chunk->data, chunk->len);
+
+		spin_lock(&unpack_lock);
+		unpack_queued -= chunk->len;
+		spin_unlock(&unpack_lock);
+		kfree(chunk);
+		wake_up(&unpack_wait);
+	}
+	return 0;
+}
+
+/* Wait until everything queued so far is unpacked */
+static void __init unpack_drain(void)
+{
+	if (unpack_writer)
+		wait_event(unpack_wait, !unpack_pending());
+}
+
+static int __init flush_buffer(void *bufv, unsigned len)
+{
+	char *buf = (char *) bufv;
+	int origLen = len;
+	struct unpack_chunk *chunk;
+	unsigned n;
+
+	if (message)
+		return -1;
+	if (!unpack_writer) {
+		unpack_buffer(buf, len);
+		return origLen;
+	}
+
+	while (len) {
+		n = min_t(unsigned, len, UNPACK_CHUNK_SIZE);
+		chunk = kmalloc(sizeof(*chunk) + n, GFP_KERNEL);
+		if (!chunk) {
+			/* Keep the order: unpack the rest ourselves */
+			unpack_drain();
+			unpack_buffer(buf, len);
+			break;
+		}
+		chunk->len = n;
+		memcpy(chunk->data, buf, n);
+		buf += n;
+		len -= n;
+
+		wait_event(unpack_wait,
+			   unpack_pending() + n <= UNPACK_MAX_QUEUED);
+		spin_lock(&unpack_lock);
+		list_add_tail(&chunk->list, &unpack_queue);
+		unpack_queued += n;
+		spin_unlock(&unpack_lock);
+		wake_up(&unpack_wait);
+	}
 	return origLen;
 }
 
@@ -428,6 +576,9 @@ static char * __init unpack_to_rootfs(char *buf, unsigned len)
 	state = Start;
 	this_header = 0;
 	message = NULL;
+	unpack_writer = kthread_run(unpack_writer_fn, NULL, "initramfs");
+	if (IS_ERR(unpack_writer))
+		unpack_writer = NULL;
 	while (!message && len) {
 		loff_t saved_offset = this_header;
 		if (*buf == '0' && !(this_header & 3)) {
@@ -448,6 +599,7 @@ static char * __init unpack_to_rootfs(char *buf, unsigned len)
 		if (decompress) {
 			res = decompress(buf, len, NULL, flush_buffer, NULL,
 				   &my_inptr, error);
+			unpack_drain();
 			if (res)
 				error("decompressor failed");
 		} else if (compress_name) {
@@ -465,6 +617,10 @@ static char * __init unpack_to_rootfs(char *buf, unsigned len)
 		buf += my_inptr;
 		len -= my_inptr;
 	}
+	if (unpack_writer) {
+		kthread_stop(unpack_writer);
+		unpack_writer = NULL;
+	}
 	dir_utime();
 	kfree(name_buf);
 	kfree(symlink_buf);
@@ -569,9 +725,13 @@ static void __init clean_rootfs(void)
 }
 #endif
 
-static int __init populate_rootfs(void)
+static void __init do_populate_rootfs(void *unused, async_cookie_t cookie)
 {
-	char *err = unpack_to_rootfs(__initramfs_start, __initramfs_size);
+	char *err;
+	ktime_t calltime;
+
+	calltime = ktime_get();
+	err = unpack_to_rootfs(__initramfs_start, __initramfs_size);
 	if (err)
 		panic(err);	/* Failed to decompress INTERNAL initramfs */
 	if (initrd_start) {
@@ -582,7 +742,7 @@ static int __init populate_rootfs(void)
 			initrd_end - initrd_start);
 		if (!err) {
 			free_initrd();
-			return 0;
+			goto done;
 		} else {
 			clean_rootfs();
 			unpack_to_rootfs(__initramfs_start, __initramfs_size);
@@ -606,6 +766,40 @@ static int __init populate_rootfs(void)
 		free_initrd();
 #endif
 	}
+done:
+	if (initcall_debug)
+		printk(KERN_DEBUG "initramfs: unpacked in %lld usecs\n",
+		       ktime_to_ns(ktime_sub(ktime_get(), calltime)) >> 10);
+}
+
+/*
+ * Unless disabled with "initramfs_async=0", the initramfs is unpacked in
+ * the background while the rest of the initcalls run. Everything which
+ * needs files from the rootfs has to call wait_for_initramfs() first.
+ */
+static int __initdata initramfs_async = 1;
+
+static int __init initramfs_async_setup(char *str)
+{
+	initramfs_async = simple_strtol(str, NULL, 0);
+	return 1;
+}
+__setup("initramfs_async=", initramfs_async_setup);
+
+static LIST_HEAD(initramfs_domain);
+
+void wait_for_initramfs(void)
+{
+	async_synchronize_full_domain(&initramfs_domain);
+}
+
+static int __init populate_rootfs(void)
+{
+	if (initramfs_async)
+		async_schedule_domain(do_populate_rootfs, NULL,
+				      &initramfs_domain);
+	else
+		do_populate_rootfs(NULL, 0);
 	return 0;
 }
 rootfs_initcall(populate_rootfs);
@@ -51,6 +51,13 @@ extern const u16 kallsyms_token_index[] __attribute__((weak));
 
 extern const unsigned long kallsyms_markers[] __attribute__((weak));
 
+#ifdef CONFIG_KALLSYMS_HASH
+/* Generated by scripts/kallsyms --hash-table, see kallsyms_hash_lookup() */
+extern const unsigned long kallsyms_hash_size
+__attribute__((weak, section(".rodata")));
+extern const u32 kallsyms_hash_table[] __attribute__((weak));
+#endif
+
 static inline int is_kernel_inittext(unsigned long addr)
 {
 	if (addr >= (unsigned long)_sinittext
@@ -168,6 +175,44 @@ static unsigned int get_symbol_offset(unsigned long pos)
 	return name - kallsyms_names;
 }
 
+#ifdef CONFIG_KALLSYMS_HASH
+/* FNV-1a, has to match hash_name() in scripts/kallsyms.c */
+static unsigned int kallsyms_hash_name(const char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Look a symbol up in the build-time generated hash table. Each slot holds
+ * a symbol index plus one, and collisions are resolved by linear probing.
+ * Returns 1 and the address of the symbol if it was found.
+ */
+static int kallsyms_hash_lookup(const char *name, unsigned long *addr)
+{
+	char namebuf[KSYM_NAME_LEN];
+	unsigned long mask = kallsyms_hash_size - 1;
+	unsigned long slot;
+	u32 idx;
+
+	slot = kallsyms_hash_name(name) & mask;
+	while ((idx = kallsyms_hash_table[slot])) {
+		kallsyms_expand_symbol(get_symbol_offset(idx - 1), namebuf);
+		if (strcmp(namebuf, name) == 0) {
+			*addr = kallsyms_addresses[idx - 1];
+			return 1;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return 0;
+}
+#endif
+
 /* Lookup the address for this symbol. Returns 0 if not found. */
 unsigned long kallsyms_lookup_name(const char *name)
 {
@@ -175,6 +220,14 @@ unsigned long kallsyms_lookup_name(const char *name)
 	unsigned long i;
 	unsigned int off;
 
+#ifdef CONFIG_KALLSYMS_HASH
+	if (kallsyms_hash_size) {
+		if (kallsyms_hash_lookup(name, &i))
+			return i;
+		return module_kallsyms_lookup_name(name);
+	}
+#endif
+
 	for (i = 0, off = 0; i < kallsyms_num_syms; i++) {
 		off = kallsyms_expand_symbol(off, namebuf);
 
@@ -58,6 +58,7 @@
 #include <linux/jump_label.h>
 #include <linux/pfn.h>
 #include <linux/bsearch.h>
+#include <linux/hash.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/module.h>
@@ -254,14 +255,7 @@ static bool each_symbol_in_section(const struct symsearch *arr,
 	return false;
 }
 
-/* Returns true as soon as fn returns true, otherwise false. */
-bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
-				    struct module *owner,
-				    void *data),
-			 void *data)
-{
-	struct module *mod;
-	static const struct symsearch arr[] = {
+static const struct symsearch kernel_symsearch[] = {
 		{ __start___ksymtab, __stop___ksymtab, __start___kcrctab,
 		  NOT_GPL_ONLY, false },
 		{ __start___ksymtab_gpl, __stop___ksymtab_gpl,
@@ -277,36 +271,58 @@ bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
 		{ __start___ksymtab_unused_gpl, __stop___ksymtab_unused_gpl,
 		  __start___kcrctab_unused_gpl,
 		  GPL_ONLY, true },
+#endif
+};
+
+#define MODULE_SYMSEARCH_MAX ARRAY_SIZE(kernel_symsearch)
+
+/* Fill in the export tables of a module, returns the number of entries. */
+static unsigned int module_symsearch(struct module *mod,
+				     struct symsearch *arr)
+{
+	const struct symsearch tmp[MODULE_SYMSEARCH_MAX] = {
+		{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
+		  NOT_GPL_ONLY, false },
+		{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
+		  mod->gpl_crcs,
+		  GPL_ONLY, false },
+		{ mod->gpl_future_syms,
+		  mod->gpl_future_syms + mod->num_gpl_future_syms,
+		  mod->gpl_future_crcs,
+		  WILL_BE_GPL_ONLY, false },
+#ifdef CONFIG_UNUSED_SYMBOLS
+		{ mod->unused_syms,
+		  mod->unused_syms + mod->num_unused_syms,
+		  mod->unused_crcs,
+		  NOT_GPL_ONLY, true },
+		{ mod->unused_gpl_syms,
+		  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
+		  mod->unused_gpl_crcs,
+		  GPL_ONLY, true },
 #endif
 	};
 
-	if (each_symbol_in_section(arr, ARRAY_SIZE(arr), NULL, fn, data))
+	memcpy(arr, tmp, sizeof(tmp));
+	return ARRAY_SIZE(tmp);
+}
+
+/* Returns true as soon as fn returns true, otherwise false. */
+bool each_symbol_section(bool (*fn)(const struct symsearch *arr,
+				    struct module *owner,
+				    void *data),
+			 void *data)
+{
+	struct module *mod;
+
+	if (each_symbol_in_section(kernel_symsearch,
+				   ARRAY_SIZE(kernel_symsearch), NULL, fn, data))
 		return true;
 
 	list_for_each_entry_rcu(mod, &modules, list) {
-		struct symsearch arr[] = {
-			{ mod->syms, mod->syms + mod->num_syms, mod->crcs,
-			  NOT_GPL_ONLY, false },
-			{ mod->gpl_syms, mod->gpl_syms + mod->num_gpl_syms,
-			  mod->gpl_crcs,
-			  GPL_ONLY, false },
-			{ mod->gpl_future_syms,
-			  mod->gpl_future_syms + mod->num_gpl_future_syms,
-			  mod->gpl_future_crcs,
-			  WILL_BE_GPL_ONLY, false },
-#ifdef CONFIG_UNUSED_SYMBOLS
-			{ mod->unused_syms,
-			  mod->unused_syms + mod->num_unused_syms,
-			  mod->unused_crcs,
-			  NOT_GPL_ONLY, true },
-			{ mod->unused_gpl_syms,
-			  mod->unused_gpl_syms + mod->num_unused_gpl_syms,
-			  mod->unused_gpl_crcs,
-			  GPL_ONLY, true },
-#endif
-		};
+		struct symsearch arr[MODULE_SYMSEARCH_MAX];
+		unsigned int num = module_symsearch(mod, arr);
 
-		if (each_symbol_in_section(arr, ARRAY_SIZE(arr), mod, fn, data))
+		if (each_symbol_in_section(arr, num, mod, fn, data))
 			return true;
 	}
 	return false;
@@ -388,6 +404,169 @@ static bool find_symbol_in_section(const struct symsearch *syms,
 	return false;
 }
 
+#ifdef CONFIG_MODULE_SYMBOL_HASH
+/*
+ * All exported symbols of the kernel and of the loaded modules are kept in
+ * a hash table keyed by name, so that resolving the undefined symbols of a
+ * module does not have to search every export table for every symbol.
+ * Insertions are done under module_mutex, removal of module symbols happens
+ * under stop_machine (or before the module ever became visible), readers
+ * need preempt disabled or module_mutex, just like for the module list.
+ */
+#define SYMHASH_BITS 12
+
+struct symhash_entry {
+	struct hlist_node node;
+	const struct kernel_symbol *sym;
+	const struct symsearch *syms;
+	struct module *owner;
+};
+
+struct module_symhash {
+	struct symsearch syms[MODULE_SYMSEARCH_MAX];
+	unsigned int num;
+	struct symhash_entry entries[0];
+};
+
+static struct hlist_head symhash[1 << SYMHASH_BITS];
+static bool symhash_ready;
+
+static struct hlist_head *symhash_bucket(const char *name)
+{
+	unsigned int hash = full_name_hash((const unsigned char *)name,
+					   strlen(name));
+
+	return &symhash[hash_32(hash, SYMHASH_BITS)];
+}
+
+static void symhash_add(struct symhash_entry *e,
+			const struct symsearch *syms, struct module *owner,
+			const struct kernel_symbol *sym)
+{
+	e->sym = sym;
+	e->syms = syms;
+	e->owner = owner;
+	hlist_add_head_rcu(&e->node, symhash_bucket(sym->name));
+}
+
+static unsigned int symhash_count(const struct symsearch *arr,
+				  unsigned int num)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < num; i++)
+		count += arr[i].stop - arr[i].start;
+	return count;
+}
+
+/* Called under module_mutex before the module is added to the list. */
+static int module_symhash_add(struct module *mod)
+{
+	struct symsearch arr[MODULE_SYMSEARCH_MAX];
+	struct module_symhash *mh;
+	const struct kernel_symbol *sym;
+	unsigned int i, num, count;
+
+	mod->symhash = NULL;
+	if (!symhash_ready)
+		return 0;
+
+	num = module_symsearch(mod, arr);
+	count = symhash_count(arr, num);
+	if (!count)
+		return 0;
+
+	mh = kmalloc(sizeof(*mh) + count * sizeof(mh->entries[0]), GFP_KERNEL);
+	if (!mh)
+		return -ENOMEM;
+
+	memcpy(mh->syms, arr, sizeof(arr));
+	mh->num = count;
+	count = 0;
+	for (i = 0; i < num; i++)
+		for (sym = arr[i].start; sym < arr[i].stop; sym++)
+			symhash_add(&mh->entries[count++], &mh->syms[i],
+				    mod, sym);
+	mod->symhash = mh;
+	return 0;
+}
+
+/* Called under stop_machine, or with the module not yet visible. */
+static void module_symhash_del(struct module *mod)
+{
+	unsigned int i;
+
+	if (!mod->symhash)
+		return;
+	for (i = 0; i < mod->symhash->num; i++)
+		hlist_del_rcu(&mod->symhash->entries[i].node);
+}
+
+/* The caller has to make sure nobody can still be walking the entries. */
+static void module_symhash_free(struct module *mod)
+{
+	kfree(mod->symhash);
+	mod->symhash = NULL;
+}
+
+static int __init symhash_init(void)
+{
+	const struct symsearch *arr = kernel_symsearch;
+	unsigned int num = ARRAY_SIZE(kernel_symsearch);
+	const struct kernel_symbol *sym;
+	struct symhash_entry *e;
+	unsigned int i;
+
+	e = vmalloc(symhash_count(arr, num) * sizeof(*e));
+	if (!e) {
+		printk(KERN_WARNING "module: no memory for symbol hash\n");
+		return -ENOMEM;
+	}
+
+	mutex_lock(&module_mutex);
+	/* No modules can be loaded yet, so only the kernel exports. */
+	for (i = 0; i < num; i++)
+		for (sym = arr[i].start; sym < arr[i].stop; sym++)
+			symhash_add(e++, &arr[i], NULL, sym);
+	smp_wmb();
+	symhash_ready = true;
+	mutex_unlock(&module_mutex);
+	return 0;
+}
+core_initcall(symhash_init);
+
+static bool find_symbol_in_hash(struct find_symbol_arg *fsa)
+{
+	struct symhash_entry *e;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu(e, pos, symhash_bucket(fsa->name), node) {
+		if (strcmp(e->sym->name, fsa->name) == 0)
+			return check_symbol(e->syms, e->owner,
+					    e->sym - e->syms->start, fsa);
+	}
+	return false;
+}
+#else
+static inline int module_symhash_add(struct module *mod)
+{
+	return 0;
+}
+static inline void module_symhash_del(struct module *mod) { }
+static inline void module_symhash_free(struct module *mod) { }
+#endif /* CONFIG_MODULE_SYMBOL_HASH */
+
+static bool find_symbol_fsa(struct find_symbol_arg *fsa)
+{
+#ifdef CONFIG_MODULE_SYMBOL_HASH
+	if (symhash_ready) {
+		smp_rmb();
+		return find_symbol_in_hash(fsa);
+	}
+#endif
+	return each_symbol_section(find_symbol_in_section, fsa);
+}
+
 /* Find a symbol and return it, along with, (optional) crc and
  * (optional) module which owns it.  Needs preempt disabled or module_mutex. */
 const struct kernel_symbol *find_symbol(const char *name,
@@ -402,7 +581,7 @@ const struct kernel_symbol *find_symbol(const char *name,
 	fsa.gplok = gplok;
 	fsa.warn = warn;
 
-	if (each_symbol_section(find_symbol_in_section, &fsa)) {
+	if (find_symbol_fsa(&fsa)) {
 		if (owner)
 			*owner = fsa.owner;
 		if (crc)
@@ -1582,6 +1761,7 @@ static int __unlink_module(void *_mod)
 {
 	struct module *mod = _mod;
 	list_del(&mod->list);
+	module_symhash_del(mod);
 	module_bug_cleanup(mod);
 	return 0;
 }
@@ -1706,6 +1886,7 @@ static void free_module(struct module *mod)
 	mutex_lock(&module_mutex);
 	stop_machine(__unlink_module, mod, NULL);
 	mutex_unlock(&module_mutex);
+	module_symhash_free(mod);
 	mod_sysfs_teardown(mod);
 
 	/* Remove dynamic debug info */
@@ -2820,6 +3001,10 @@ static struct module *load_module(void __user *umod,
 	if (err < 0)
 		goto ddebug;
 
+	err = module_symhash_add(mod);
+	if (err < 0)
+		goto ddebug;
+
 	module_bug_finalize(info.hdr, info.sechdrs, mod);
 	list_add_rcu(&mod->list, &modules);
 	mutex_unlock(&module_mutex);
@@ -2846,6 +3031,7 @@ static struct module *load_module(void __user *umod,
 	mutex_lock(&module_mutex);
 	/* Unlink carefully: kallsyms could be walking list. */
 	list_del_rcu(&mod->list);
+	module_symhash_del(mod);
 	module_bug_cleanup(mod);
 
  ddebug:
@@ -2854,6 +3040,7 @@ static struct module *load_module(void __user *umod,
  unlock:
 	mutex_unlock(&module_mutex);
 	synchronize_sched();
+	module_symhash_free(mod);
 	kfree(mod->args);
  free_arch_cleanup:
 	module_arch_cleanup(mod);
@@ -27,6 +27,8 @@
 #include <linux/cgroup.h>
 #include <linux/fs.h>
 #include <linux/file.h>
+#include <linux/pid_namespace.h>
+#include <linux/ptrace.h>
 #include <net/genetlink.h>
 #include <asm/atomic.h>
 
@@ -570,6 +572,62 @@ static int taskstats_user_cmd(struct sk_buff *skb, struct genl_info *info)
 		return -EINVAL;
 }
 
+/*
+ * Dump the per-pid stats of every task in the caller's pid namespace
+ * that it may ptrace, the same restriction as /proc/<pid>/io.  Records
+ * are packed into each skb until it is full, so one recvmsg()
+ * returns a whole batch of tasks instead of needing a request per task.
+ * cb->args[0] holds the pid to continue from.
+ */
+static int taskstats_user_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	struct pid_namespace *ns = task_active_pid_ns(current);
+	struct task_struct *tsk;
+	struct taskstats *stats;
+	struct pid *pid;
+	void *reply;
+	pid_t nr;
+
+	for (nr = cb->args[0]; ; nr++) {
+		rcu_read_lock();
+		pid = find_ge_pid(nr, ns);
+		tsk = NULL;
+		if (pid) {
+			nr = pid_nr_ns(pid, ns);
+			tsk = pid_task(pid, PIDTYPE_PID);
+			if (tsk)
+				get_task_struct(tsk);
+		}
+		rcu_read_unlock();
+		if (!pid)
+			break;
+		if (!tsk)
+			continue;
+		if (!ptrace_may_access(tsk, PTRACE_MODE_READ)) {
+			put_task_struct(tsk);
+			continue;
+		}
+
+		reply = genlmsg_put(skb, NETLINK_CB(cb->skb).pid,
+				    cb->nlh->nlmsg_seq, &family, NLM_F_MULTI,
+				    TASKSTATS_CMD_NEW);
+		stats = reply ? mk_reply(skb, TASKSTATS_TYPE_PID, nr) : NULL;
+		if (!stats) {
+			/* skb is full, continue with this task next time */
+			if (reply)
+				genlmsg_cancel(skb, reply);
+			put_task_struct(tsk);
+			break;
+		}
+		fill_stats(tsk, stats);
+		put_task_struct(tsk);
+		genlmsg_end(skb, reply);
+	}
+
+	cb->args[0] = nr;
+	return skb->len;
+}
+
 static struct taskstats *taskstats_tgid_alloc(struct task_struct *tsk)
 {
 	struct signal_struct *sig = tsk->signal;
@@ -656,6 +714,7 @@ err:
 static struct genl_ops taskstats_ops = {
 	.cmd		= TASKSTATS_CMD_GET,
 	.doit		= taskstats_user_cmd,
+	.dumpit		= taskstats_user_dump,
 	.policy		= taskstats_cmd_get_policy,
 };
 
@@ -0,0 +1,56 @@
+/*
+ * The ChaCha20 block function, as specified in RFC 7539.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
+#include <asm/byteorder.h>
+#include <crypto/chacha20.h>
+
+#define QUARTERROUND(a, b, c, d) do {			\
+	x[a] += x[b]; x[d] = rol32(x[d] ^ x[a], 16);	\
+	x[c] += x[d]; x[b] = rol32(x[b] ^ x[c], 12);	\
+	x[a] += x[b]; x[d] = rol32(x[d] ^ x[a], 8);	\
+	x[c] += x[d]; x[b] = rol32(x[b] ^ x[c], 7);	\
+} while (0)
+
+/**
+ * chacha20_block - generate one block of ChaCha20 keystream
+ * @state: the 16 word input state: constants, key, block counter and nonce
+ * @stream: 64 byte, 32-bit aligned output buffer
+ *
+ * The block counter in @state[12] is advanced for the next call.
+ */
+void chacha20_block(u32 *state, void *stream)
+{
+	__le32 *out = stream;
+	u32 x[CHACHA20_STATE_WORDS];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(x); i++)
+		x[i] = state[i];
+
+	for (i = 0; i < 20; i += 2) {
+		QUARTERROUND(0, 4,  8, 12);
+		QUARTERROUND(1, 5,  9, 13);
+		QUARTERROUND(2, 6, 10, 14);
+		QUARTERROUND(3, 7, 11, 15);
+
+		QUARTERROUND(0, 5, 10, 15);
+		QUARTERROUND(1, 6, 11, 12);
+		QUARTERROUND(2, 7,  8, 13);
+		QUARTERROUND(3, 4,  9, 14);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(x); i++)
+		out[i] = cpu_to_le32(x[i] + state[i]);
+
+	state[12]++;
+}
+EXPORT_SYMBOL(chacha20_block);
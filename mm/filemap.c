@@ -1752,8 +1752,78 @@ page_not_uptodate:
 }
 EXPORT_SYMBOL(filemap_fault);
 
+/**
+ * filemap_map_pages - map cached pages around a read fault
+ * @vma:	vma in which the fault was taken
+ * @vmf:	range to map, see struct vm_fault
+ *
+ * Maps the pages between @vmf->pgoff and @vmf->max_pgoff that are uptodate
+ * in the page cache and can be locked without waiting. Anything else,
+ * including pages with the readahead marker set, is left for ->fault(),
+ * so that readahead keeps working. Called with the page table lock held.
+ */
+void filemap_map_pages(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct file *file = vma->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	unsigned long address = (unsigned long) vmf->virtual_address;
+	struct page *pages[PAGEVEC_SIZE];
+	pgoff_t index = vmf->pgoff;
+	unsigned int i, nr;
+	loff_t size;
+	pte_t *pte;
+
+	while (index <= vmf->max_pgoff) {
+		nr = find_get_pages(mapping, index,
+				    min_t(unsigned long, PAGEVEC_SIZE,
+					  vmf->max_pgoff - index + 1), pages);
+		if (!nr)
+			break;
+
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
+
+			index = page->index + 1;
+			if (page->index > vmf->max_pgoff)
+				goto skip;
+
+			if (!PageUptodate(page) ||
+			    PageReadahead(page) ||
+			    PageHWPoison(page))
+				goto skip;
+			if (!trylock_page(page))
+				goto skip;
+
+			if (page->mapping != mapping || !PageUptodate(page))
+				goto unlock;
+
+			size = i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1;
+			if (page->index >= size >> PAGE_CACHE_SHIFT)
+				goto unlock;
+
+			pte = vmf->pte + page->index - vmf->pgoff;
+			if (!pte_none(*pte))
+				goto unlock;
+
+			if (file->f_ra.mmap_miss > 0)
+				file->f_ra.mmap_miss--;
+			do_set_pte(vma, address +
+				   (page->index - vmf->pgoff) * PAGE_SIZE,
+				   page, pte, false, false);
+			unlock_page(page);
+			continue;
+unlock:
+			unlock_page(page);
+skip:
+			page_cache_release(page);
+		}
+	}
+}
+EXPORT_SYMBOL(filemap_map_pages);
+
 const struct vm_operations_struct generic_file_vm_ops = {
 	.fault		= filemap_fault,
+	.map_pages	= filemap_map_pages,
 };
 
 /* This is used for a general mmap of a disk file */
@@ -891,6 +891,14 @@ static int try_to_merge_one_page(struct vm_area_struct *vma,
 			 */
 			set_page_stable_node(page, NULL);
 			mark_page_accessed(page);
+			/*
+			 * The page may come from a MADV_FREE range, clean and
+			 * with clean ptes, while the pages merged into it later
+			 * were dirty: make sure reclaim writes it out rather
+			 * than dropping it as lazily freed.
+			 */
+			if (!PageDirty(page))
+				SetPageDirty(page);
 			err = 0;
 		} else if (pages_identical(page, kpage))
 			err = replace_page(vma, page, kpage, orig_pte);
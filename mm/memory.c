@@ -57,6 +57,7 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/debugfs.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -3142,6 +3143,133 @@ oom:
 	return VM_FAULT_OOM;
 }
 
+/**
+ * do_set_pte - setup new PTE entry for given page and add reverse page mapping.
+ *
+ * @vma: virtual memory area
+ * @address: user virtual address
+ * @page: page to map
+ * @pte: pointer to target page table entry
+ * @write: true, if new entry is writable
+ * @anon: true, if it's anonymous page
+ *
+ * Caller must hold page table lock relevant for @pte.
+ *
+ * Target users are page handler itself and implementations of
+ * vm_ops->map_pages.
+ */
+void do_set_pte(struct vm_area_struct *vma, unsigned long address,
+		struct page *page, pte_t *pte, bool write, bool anon)
+{
+	pte_t entry;
+
+	flush_icache_page(vma, page);
+	entry = mk_pte(page, vma->vm_page_prot);
+	if (write)
+		entry = maybe_mkwrite(pte_mkdirty(entry), vma);
+	if (anon) {
+		inc_mm_counter_fast(vma->vm_mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, address);
+	} else {
+		inc_mm_counter_fast(vma->vm_mm, MM_FILEPAGES);
+		page_add_file_rmap(page);
+	}
+	set_pte_at(vma->vm_mm, address, pte, entry);
+
+	/* no need to invalidate: a not-present page won't be cached */
+	update_mmu_cache(vma, address, pte);
+}
+
+/*
+ * Fault-around: on a read fault, ask ->map_pages() to also map the pages
+ * surrounding the faulting address that are already uptodate in the page
+ * cache, in the naturally aligned window of fault_around_bytes containing
+ * the address. This saves a minor fault for every neighbouring page that
+ * gets touched later, e.g. while an executable or a library starts up.
+ */
+static unsigned long fault_around_bytes __read_mostly = 65536;
+
+#ifdef CONFIG_DEBUG_FS
+static int fault_around_bytes_get(void *data, u64 *val)
+{
+	*val = fault_around_bytes;
+	return 0;
+}
+
+/*
+ * do_fault_around() expects fault_around_bytes rounded down to a power of
+ * two number of pages, and the window must not span more than a page table.
+ * Writing PAGE_SIZE or less disables fault-around.
+ */
+static int fault_around_bytes_set(void *data, u64 val)
+{
+	if (val / PAGE_SIZE > PTRS_PER_PTE)
+		return -EINVAL;
+	if (val > PAGE_SIZE)
+		fault_around_bytes = rounddown_pow_of_two(val);
+	else
+		fault_around_bytes = PAGE_SIZE; /* rounddown_pow_of_two(0) is undefined */
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(fault_around_bytes_fops,
+		fault_around_bytes_get, fault_around_bytes_set, "%llu\n");
+
+static int __init fault_around_debugfs(void)
+{
+	void *ret;
+
+	ret = debugfs_create_file("fault_around_bytes", 0644, NULL, NULL,
+			&fault_around_bytes_fops);
+	if (!ret)
+		printk(KERN_WARNING "Failed to create fault_around_bytes in debugfs\n");
+	return 0;
+}
+late_initcall(fault_around_debugfs);
+#endif
+
+static void do_fault_around(struct vm_area_struct *vma, unsigned long address,
+		pte_t *pte, pgoff_t pgoff, unsigned int flags)
+{
+	unsigned long start_addr, nr_pages, mask;
+	pgoff_t max_pgoff;
+	struct vm_fault vmf;
+	int off;
+
+	nr_pages = ACCESS_ONCE(fault_around_bytes) >> PAGE_SHIFT;
+	mask = ~(nr_pages * PAGE_SIZE - 1) & PAGE_MASK;
+
+	start_addr = max(address & mask, vma->vm_start);
+	off = ((address - start_addr) >> PAGE_SHIFT) & (PTRS_PER_PTE - 1);
+	pte -= off;
+	pgoff -= off;
+
+	/*
+	 * max_pgoff is either end of page table or end of vma
+	 * or fault_around_bytes from pgoff, depending what is nearest.
+	 */
+	max_pgoff = pgoff - ((start_addr >> PAGE_SHIFT) & (PTRS_PER_PTE - 1)) +
+		PTRS_PER_PTE - 1;
+	max_pgoff = min3(max_pgoff, vma_pages(vma) + vma->vm_pgoff - 1,
+			pgoff + nr_pages - 1);
+
+	/* Check if it makes any sense to call ->map_pages */
+	while (!pte_none(*pte)) {
+		if (++pgoff > max_pgoff)
+			return;
+		start_addr += PAGE_SIZE;
+		if (start_addr >= vma->vm_end)
+			return;
+		pte++;
+	}
+
+	vmf.virtual_address = (void __user *) start_addr;
+	vmf.pte = pte;
+	vmf.pgoff = pgoff;
+	vmf.max_pgoff = max_pgoff;
+	vmf.flags = flags;
+	vma->vm_ops->map_pages(vma, &vmf);
+}
+
 /*
  * __do_fault() tries to create a new page mapping. It aggressively
  * tries to share with existing pages, but makes a separate copy if
@@ -3162,7 +3290,6 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pte_t *page_table;
 	spinlock_t *ptl;
 	struct page *page;
-	pte_t entry;
 	int anon = 0;
 	int charged = 0;
 	struct page *dirty_page = NULL;
@@ -3170,6 +3297,22 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	int ret;
 	int page_mkwrite = 0;
 
+	/*
+	 * For a read fault, let ->map_pages() map the page and its cached
+	 * neighbours first, and only fall back to ->fault() if the page
+	 * itself was not ready to be mapped (cold cache or the like).
+	 */
+	if (!(flags & (FAULT_FLAG_WRITE | FAULT_FLAG_NONLINEAR)) &&
+	    vma->vm_ops->map_pages && fault_around_bytes >> PAGE_SHIFT > 1) {
+		page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+		do_fault_around(vma, address, page_table, pgoff, flags);
+		if (!pte_same(*page_table, orig_pte)) {
+			pte_unmap_unlock(page_table, ptl);
+			return 0;
+		}
+		pte_unmap_unlock(page_table, ptl);
+	}
+
 	vmf.virtual_address = (void __user *)(address & PAGE_MASK);
 	vmf.pgoff = pgoff;
 	vmf.flags = flags;
@@ -3266,25 +3409,12 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	 */
 	/* Only go through if we didn't race with anybody else... */
 	if (likely(pte_same(*page_table, orig_pte))) {
-		flush_icache_page(vma, page);
-		entry = mk_pte(page, vma->vm_page_prot);
-		if (flags & FAULT_FLAG_WRITE)
-			entry = maybe_mkwrite(pte_mkdirty(entry), vma);
-		if (anon) {
-			inc_mm_counter_fast(mm, MM_ANONPAGES);
-			page_add_new_anon_rmap(page, vma, address);
-		} else {
-			inc_mm_counter_fast(mm, MM_FILEPAGES);
-			page_add_file_rmap(page);
-			if (flags & FAULT_FLAG_WRITE) {
-				dirty_page = page;
-				get_page(dirty_page);
-			}
+		do_set_pte(vma, address, page, page_table,
+			   flags & FAULT_FLAG_WRITE, anon);
+		if (!anon && (flags & FAULT_FLAG_WRITE)) {
+			dirty_page = page;
+			get_page(dirty_page);
 		}
-		set_pte_at(mm, address, page_table, entry);
-
-		/* no need to invalidate: a not-present page won't be cached */
-		update_mmu_cache(vma, address, page_table);
 	} else {
 		if (charged)
 			mem_cgroup_uncharge_page(page);
@@ -3506,6 +3636,258 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults.
+ *
+ * The bulk of the faults taken by a multithreaded process, first touches
+ * of anonymous memory and read faults on file pages that are already
+ * cached, are resolved here without mmap_sem, so they no longer queue up
+ * behind a thread doing mmap() or munmap().
+ *
+ * The vma is looked up and pinned by get_vma(), and what the fault needs
+ * from it is sampled at a given vm_sequence.  Nothing is committed until
+ * the pte lock is held and vm_sequence is seen unchanged: the paths that
+ * reshape a vma or rewrite its page tables under mmap_sem bump it, and
+ * munmap() clears vm_rb before zapping the range.  Page tables are walked
+ * with interrupts disabled, which holds off the TLB shootdown IPI that
+ * precedes their freeing, just as get_user_pages_fast() relies on.
+ *
+ * Whenever something does not fit, VM_FAULT_RETRY is returned and the
+ * caller takes mmap_sem and goes through handle_mm_fault() as usual.
+ */
+static bool vma_has_changed(struct vm_area_struct *vma, unsigned int seq)
+{
+	return RB_EMPTY_NODE(&vma->vm_rb) ||
+		read_seqcount_retry(&vma->vm_sequence, seq);
+}
+
+/*
+ * Map and lock the pte for address, provided the vma is still the one
+ * that was sampled and pmd still points to the same page table.
+ */
+static pte_t *spf_pte_map_lock(struct vm_area_struct *vma, unsigned int seq,
+		unsigned long address, pmd_t *pmd, pmd_t orig_pmd,
+		spinlock_t **ptlp)
+{
+	spinlock_t *ptl;
+	pte_t *pte = NULL;
+
+	local_irq_disable();
+	if (vma_has_changed(vma, seq) || !pmd_same(*pmd, orig_pmd))
+		goto out;
+
+	ptl = pte_lockptr(vma->vm_mm, pmd);
+	pte = pte_offset_map(pmd, address);
+	/*
+	 * The lock holder may be waiting for this cpu to answer a TLB
+	 * shootdown IPI, so with interrupts off it can only be tried.
+	 */
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		pte = NULL;
+		goto out;
+	}
+	if (vma_has_changed(vma, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		pte = NULL;
+		goto out;
+	}
+	*ptlp = ptl;
+out:
+	local_irq_enable();
+	return pte;
+}
+
+/*
+ * Find the pmd for address and check that the pte it maps there is
+ * still empty, without allocating any page table level.
+ */
+static pmd_t *spf_walk(struct vm_area_struct *vma, unsigned int seq,
+		unsigned long address, pmd_t *orig_pmd)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd = NULL;
+	pte_t *pte, entry;
+
+	local_irq_disable();
+	if (vma_has_changed(vma, seq))
+		goto out;
+
+	pgd = pgd_offset(vma->vm_mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out;
+
+	pmd = pmd_offset(pud, address);
+	*orig_pmd = *pmd;
+	barrier();
+	/* leave page table allocation and huge pmds to handle_mm_fault() */
+	if (pmd_none(*orig_pmd) || pmd_trans_huge(*orig_pmd) ||
+	    unlikely(pmd_bad(*orig_pmd))) {
+		pmd = NULL;
+		goto out;
+	}
+
+	pte = pte_offset_map(pmd, address);
+	entry = *pte;
+	pte_unmap(pte);
+	if (!pte_none(entry))
+		pmd = NULL;
+out:
+	local_irq_enable();
+	return pmd;
+}
+
+/*
+ * Try to resolve a user fault at address without mmap_sem.  Returns 0 if
+ * the fault was handled, VM_FAULT_RETRY if the caller must fall back to
+ * handle_mm_fault() under mmap_sem.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	const struct vm_operations_struct *vm_ops;
+	struct vm_area_struct *vma;
+	unsigned long vm_flags;
+	pgprot_t page_prot;
+	pmd_t *pmd, orig_pmd;
+	pte_t *pte, entry;
+	spinlock_t *ptl;
+	struct page *page = NULL;
+	unsigned int seq;
+	int ret = VM_FAULT_RETRY;
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		return VM_FAULT_RETRY;
+
+	seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	smp_rmb();
+	if (seq & 1)
+		goto out_put;
+
+	if (address < vma->vm_start || address >= vma->vm_end)
+		goto out_put;
+
+	vm_flags = vma->vm_flags;
+	/*
+	 * Leave alone the mappings whose ptes may be filled outside the
+	 * fault path, e.g. by remap_pfn_range(), or that need mmap_sem to
+	 * grow.
+	 */
+	if (vm_flags & (VM_HUGETLB | VM_NONLINEAR | VM_GROWSDOWN | VM_GROWSUP |
+			VM_PFNMAP | VM_MIXEDMAP | VM_IO))
+		goto out_put;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vm_flags & VM_WRITE))
+			goto out_put;
+	} else if (!(vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto out_put;
+
+	vm_ops = vma->vm_ops;
+	if (vm_ops) {
+		/* file pages can only be mapped from the page cache here */
+		if (flags & FAULT_FLAG_WRITE)
+			goto out_put;
+	} else {
+		/*
+		 * anon_vma_prepare() needs mmap_sem, and a vma policy could
+		 * be replaced under us while allocating.
+		 */
+		if ((flags & FAULT_FLAG_WRITE) && !vma->anon_vma)
+			goto out_put;
+		if (vma_policy(vma))
+			goto out_put;
+	}
+	page_prot = vma->vm_page_prot;
+
+	if (read_seqcount_retry(&vma->vm_sequence, seq))
+		goto out_put;
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	pmd = spf_walk(vma, seq, address, &orig_pmd);
+	if (!pmd)
+		goto out_put;
+
+	if (vm_ops) {
+		pgoff_t pgoff = ((address - vma->vm_start) >> PAGE_SHIFT) +
+				vma->vm_pgoff;
+
+		pte = spf_pte_map_lock(vma, seq, address, pmd, orig_pmd, &ptl);
+		if (!pte)
+			goto out_put;
+		/* the vma is known to be live from here on */
+		if (vm_ops->map_pages) {
+			if (pte_none(*pte))
+				do_fault_around(vma, address, pte, pgoff, flags);
+			if (!pte_none(*pte))
+				ret = 0;
+		}
+		pte_unmap_unlock(pte, ptl);
+		goto out_put;
+	}
+
+	if (!(flags & FAULT_FLAG_WRITE)) {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address), page_prot));
+	} else {
+		/*
+		 * With no vma policy, alloc_page_vma() would have used the
+		 * task's policy just the same.
+		 */
+		page = alloc_page(GFP_HIGHUSER_MOVABLE);
+		if (!page)
+			goto out_put;
+		clear_user_highpage(page, address);
+		__SetPageUptodate(page);
+
+		if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+			page_cache_release(page);
+			goto out_put;
+		}
+		entry = pte_mkwrite(pte_mkdirty(mk_pte(page, page_prot)));
+	}
+
+	pte = spf_pte_map_lock(vma, seq, address, pmd, orig_pmd, &ptl);
+	if (!pte)
+		goto out_release;
+	ret = 0;
+	/* somebody else may have resolved the fault meanwhile */
+	if (!pte_none(*pte))
+		goto unlock;
+
+	if (page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(page, vma, address);
+		page = NULL;
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, pte);
+unlock:
+	pte_unmap_unlock(pte, ptl);
+out_release:
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+out_put:
+	put_vma(vma);
+	if (!ret) {
+		count_vm_event(PGFAULT);
+		count_vm_event(SPECULATIVE_PGFAULT);
+		mem_cgroup_count_vm_event(mm, PGFAULT);
+	}
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -1221,6 +1221,14 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		swp_entry_t entry = { .val = page_private(page) };
 
 		if (PageSwapCache(page)) {
+			/*
+			 * Not written to since MADV_FREE: the contents can
+			 * be dropped rather than swapped out.
+			 */
+			if ((flags & TTU_LAZYFREE) && !PageDirty(page)) {
+				dec_mm_counter(mm, MM_ANONPAGES);
+				goto discard;
+			}
 			/*
 			 * Store the swap location in the pte.
 			 * See handle_pte_fault() ...
@@ -1257,6 +1265,7 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else
 		dec_mm_counter(mm, MM_FILEPAGES);
 
+discard:
 	page_remove_rmap(page);
 	page_cache_release(page);
 
@@ -169,13 +169,15 @@ int add_to_swap(struct page *page)
 	 * deadlock in the swap out path.
 	 */
 	/*
-	 * Add it to the swap cache and mark it dirty
+	 * Add it to the swap cache. The page is not marked dirty here:
+	 * the caller learns whether it needs writing out when the dirty
+	 * bits are transferred from its ptes on unmap, which lets pages
+	 * that stayed clean since MADV_FREE be dropped without any I/O.
 	 */
 	err = add_to_swap_cache(page, entry,
 			__GFP_HIGH|__GFP_NOMEMALLOC|__GFP_NOWARN);
 
 	if (!err) {	/* Success */
-		SetPageDirty(page);
 		return 1;
 	} else {	/* -ENOMEM radix-tree allocation failure */
 		/*
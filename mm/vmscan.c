@@ -740,6 +740,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		struct address_space *mapping;
 		struct page *page;
 		int may_enter_fs;
+		bool lazyfree = false;
 
 		cond_resched();
 
@@ -805,6 +806,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 				goto keep_locked;
 			if (!add_to_swap(page))
 				goto activate_locked;
+			lazyfree = true;
 			may_enter_fs = 1;
 		}
 
@@ -815,7 +817,9 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * processes. Try to unmap it here.
 		 */
 		if (page_mapped(page) && mapping) {
-			switch (try_to_unmap(page, TTU_UNMAP)) {
+			switch (try_to_unmap(page, lazyfree ?
+					     TTU_UNMAP | TTU_LAZYFREE :
+					     TTU_UNMAP)) {
 			case SWAP_FAIL:
 				goto activate_locked;
 			case SWAP_AGAIN:
@@ -827,6 +831,18 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
+		/*
+		 * A page that just entered the swap cache and is still clean
+		 * after unmapping was not written to since MADV_FREE (none
+		 * of its ptes was dirty), so it can go without pageout.
+		 */
+		if (lazyfree && !PageDirty(page)) {
+			if (!__remove_mapping(mapping, page))
+				goto keep_locked;
+			count_vm_event(PGLAZYFREED);
+			goto removed;
+		}
+
 		if (PageDirty(page)) {
 			nr_dirty++;
 
@@ -908,7 +924,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 
 		if (!mapping || !__remove_mapping(mapping, page))
 			goto keep_locked;
-
+removed:
 		/*
 		 * At this point, we have no other references and there is
 		 * no way to pick any more up (removed from LRU, removed
@@ -928,6 +944,8 @@ free_it:
 		continue;
 
 cull_mlocked:
+		if (lazyfree && !PageDirty(page))
+			SetPageDirty(page);
 		if (PageSwapCache(page))
 			try_to_free_swap(page);
 		unlock_page(page);
@@ -943,6 +961,13 @@ activate_locked:
 		SetPageActive(page);
 		pgactivate++;
 keep_locked:
+		/*
+		 * Nothing was written to the swap slot of a page added to
+		 * the swap cache above: keep it dirty until it is written,
+		 * or a later pass would free it with stale swap contents.
+		 */
+		if (lazyfree && !PageDirty(page))
+			SetPageDirty(page);
 		unlock_page(page);
 keep:
 		reset_reclaim_mode(sc);
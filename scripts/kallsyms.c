@@ -54,8 +54,13 @@ static struct text_range text_ranges[] = {
 static struct sym_entry *table;
 static unsigned int table_size, table_cnt;
 static int all_symbols = 0;
+static int hash_table = 0;
 static char symbol_prefix_char = '\0';
 
+/* name -> index + 1 hash table for kallsyms_lookup_name(), 0 is empty */
+static unsigned int *hash_slots;
+static unsigned int hash_size;
+
 int token_profit[0x10000];
 
 /* the table that holds the result of the compression */
@@ -65,7 +70,7 @@ unsigned char best_table_len[256];
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: kallsyms [--all-symbols] [--symbol-prefix=<prefix char>] < in.map > out.S\n");
+	fprintf(stderr, "Usage: kallsyms [--all-symbols] [--hash-table] [--symbol-prefix=<prefix char>] < in.map > out.S\n");
 	exit(1);
 }
 
@@ -285,6 +290,49 @@ static int expand_symbol(unsigned char *data, int len, char *result)
 	return total;
 }
 
+/*
+ * FNV-1a hash of a symbol name. This has to match kallsyms_hash_name() in
+ * kernel/kallsyms.c.
+ */
+static unsigned int hash_name(const unsigned char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name) {
+		hash ^= *name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*
+ * Build an open addressing (linear probing) hash table of the symbol
+ * names. Symbols are inserted in table order, so of several symbols with
+ * the same name the kernel finds the same one a linear search would.
+ */
+static void build_hash_table(void)
+{
+	unsigned int i, slot;
+
+	hash_size = 1;
+	while (hash_size < table_cnt + table_cnt / 2)
+		hash_size <<= 1;
+
+	hash_slots = calloc(hash_size, sizeof(*hash_slots));
+	if (!hash_slots) {
+		fprintf(stderr, "kallsyms failure: "
+			"unable to allocate required amount of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < table_cnt; i++) {
+		slot = hash_name(table[i].sym + 1) & (hash_size - 1);
+		while (hash_slots[slot])
+			slot = (slot + 1) & (hash_size - 1);
+		hash_slots[slot] = i + 1;
+	}
+}
+
 static void write_src(void)
 {
 	unsigned int i, k, off;
@@ -374,6 +422,17 @@ static void write_src(void)
 	for (i = 0; i < 256; i++)
 		printf("\t.short\t%d\n", best_idx[i]);
 	printf("\n");
+
+	if (hash_table) {
+		output_label("kallsyms_hash_size");
+		printf("\tPTR\t%d\n", hash_size);
+		printf("\n");
+
+		output_label("kallsyms_hash_table");
+		for (i = 0; i < hash_size; i++)
+			printf("\t.long\t%d\n", hash_slots[i]);
+		printf("\n");
+	}
 }
 
 
@@ -640,6 +699,8 @@ int main(int argc, char **argv)
 		for (i = 1; i < argc; i++) {
 			if(strcmp(argv[i], "--all-symbols") == 0)
 				all_symbols = 1;
+			else if (strcmp(argv[i], "--hash-table") == 0)
+				hash_table = 1;
 			else if (strncmp(argv[i], "--symbol-prefix=", 16) == 0) {
 				char *p = &argv[i][16];
 				/* skip quote */
@@ -654,6 +715,8 @@ int main(int argc, char **argv)
 
 	read_map(stdin);
 	sort_symbols();
+	if (hash_table)
+		build_hash_table();
 	optimize_token_table();
 	write_src();
 
@@ -22,6 +22,7 @@
 
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/hrtimer.h>
 #include <linux/math64.h>
 #include <sound/core.h>
 #include <sound/control.h>
@@ -489,7 +490,13 @@ static int snd_pcm_update_hw_ptr0(struct snd_pcm_substream *substream,
 	runtime->hw_ptr_base = hw_base;
 	runtime->status->hw_ptr = new_hw_ptr;
 	runtime->hw_ptr_jiffies = jiffies;
-	if (runtime->tstamp_mode == SNDRV_PCM_TSTAMP_ENABLE)
+	/*
+	 * Without period interrupts the status page is only refreshed at the
+	 * wakeup threshold and on HWSYNC.  Always stamp it then, so that mmap
+	 * users can interpolate the position from hw_ptr, tstamp and the rate.
+	 */
+	if (runtime->tstamp_mode == SNDRV_PCM_TSTAMP_ENABLE ||
+	    runtime->no_period_wakeup)
 		snd_pcm_gettime(runtime, (struct timespec *)&runtime->status->tstamp);
 
 	return snd_pcm_update_state(substream, runtime);
@@ -1742,6 +1749,27 @@ void snd_pcm_period_elapsed(struct snd_pcm_substream *substream)
 
 EXPORT_SYMBOL(snd_pcm_period_elapsed);
 
+/*
+ * Without period interrupts nothing wakes up a waiter when data becomes
+ * available, so sleep until the stream is expected to reach the wakeup
+ * threshold at its nominal rate and let the caller re-read the position.
+ * This keeps the number of wakeups down to one per threshold crossing
+ * instead of one per period.
+ */
+static void wait_for_frames(struct snd_pcm_runtime *runtime,
+			    snd_pcm_uframes_t frames)
+{
+	ktime_t expires;
+
+	if (!runtime->rate) {
+		schedule();
+		return;
+	}
+	expires = ns_to_ktime(div_u64((u64)frames * NSEC_PER_SEC +
+				      runtime->rate - 1, runtime->rate));
+	schedule_hrtimeout(&expires, HRTIMER_MODE_REL);
+}
+
 /*
  * Wait until avail_min data becomes available
  * Returns a negative error code if any error occurs during operation.
@@ -1756,7 +1784,7 @@ static int wait_for_avail(struct snd_pcm_substream *substream,
 	wait_queue_t wait;
 	int err = 0;
 	snd_pcm_uframes_t avail = 0;
-	long wait_time, tout;
+	long wait_time, tout = 1;
 
 	init_waitqueue_entry(&wait, current);
 	set_current_state(TASK_INTERRUPTIBLE);
@@ -1794,7 +1822,10 @@ static int wait_for_avail(struct snd_pcm_substream *substream,
 			break;
 		snd_pcm_stream_unlock_irq(substream);
 
-		tout = schedule_timeout(wait_time);
+		if (runtime->no_period_wakeup)
+			wait_for_frames(runtime, runtime->twake - avail);
+		else
+			tout = schedule_timeout(wait_time);
 
 		snd_pcm_stream_lock_irq(substream);
 		set_current_state(TASK_INTERRUPTIBLE);
@@ -1817,6 +1848,13 @@ static int wait_for_avail(struct snd_pcm_substream *substream,
 			err = -EBADFD;
 			goto _endloop;
 		}
+		if (runtime->no_period_wakeup) {
+			/* no interrupt has moved the position for us */
+			err = snd_pcm_update_hw_ptr(substream);
+			if (err < 0)
+				break;
+			continue;
+		}
 		if (!tout) {
 			snd_printd("%s write error (DMA or IRQ trouble?)\n",
 				   is_playback ? "playback" : "capture");
@@ -271,7 +271,9 @@ static int dummy_systimer_start(struct snd_pcm_substream *substream)
 	struct dummy_systimer_pcm *dpcm = substream->runtime->private_data;
 	spin_lock(&dpcm->lock);
 	dpcm->base_time = jiffies;
-	dummy_systimer_rearm(dpcm);
+	/* the position is derived from jiffies, no timer needed for it */
+	if (!substream->runtime->no_period_wakeup)
+		dummy_systimer_rearm(dpcm);
 	spin_unlock(&dpcm->lock);
 	return 0;
 }
@@ -397,7 +399,10 @@ static int dummy_hrtimer_start(struct snd_pcm_substream *substream)
 	struct dummy_hrtimer_pcm *dpcm = substream->runtime->private_data;
 
 	dpcm->base_time = hrtimer_cb_get_time(&dpcm->timer);
-	hrtimer_start(&dpcm->timer, dpcm->period_time, HRTIMER_MODE_REL);
+	/* the position is derived from base_time, no timer needed for it */
+	if (!substream->runtime->no_period_wakeup)
+		hrtimer_start(&dpcm->timer, dpcm->period_time,
+			      HRTIMER_MODE_REL);
 	atomic_set(&dpcm->running, 1);
 	return 0;
 }
@@ -522,7 +527,8 @@ static struct snd_pcm_hardware dummy_pcm_hardware = {
 	.info =			(SNDRV_PCM_INFO_MMAP |
 				 SNDRV_PCM_INFO_INTERLEAVED |
 				 SNDRV_PCM_INFO_RESUME |
-				 SNDRV_PCM_INFO_MMAP_VALID),
+				 SNDRV_PCM_INFO_MMAP_VALID |
+				 SNDRV_PCM_INFO_NO_PERIOD_WAKEUP),
 	.formats =		USE_FORMATS,
 	.rates =		USE_RATE,
 	.rate_min =		USE_RATE_MIN,
@@ -143,13 +143,16 @@ static void wait_for_interrupt(struct vdev_info *dev)
 		}
 }
 
-static void run_test(struct vdev_info *dev, struct vq_info *vq, int bufs)
+static void run_test(struct vdev_info *dev, struct vq_info *vq, int bufs,
+		     int batch)
 {
 	struct scatterlist sl;
 	long started = 0, completed = 0;
 	long completed_before;
 	int r, test = 1;
 	unsigned len;
+	void *done[batch];
+	unsigned lens[batch];
 	long long spurious = 0;
 	r = ioctl(dev->control, VHOST_TEST_RUN, &test);
 	assert(r >= 0);
@@ -169,7 +172,14 @@ static void run_test(struct vdev_info *dev, struct vq_info *vq, int bufs)
 				r = -1;
 
 			/* Flush out completed bufs if any */
-			if (virtqueue_get_buf(vq->vq, &len)) {
+			if (batch > 1) {
+				len = virtqueue_get_bufs(vq->vq, done, lens,
+							 batch);
+				if (len) {
+					completed += len;
+					r = 0;
+				}
+			} else if (virtqueue_get_buf(vq->vq, &len)) {
 				++completed;
 				r = 0;
 			}
@@ -213,6 +223,15 @@ const struct option longopts[] = {
 		.name = "no-indirect",
 		.val = 'i',
 	},
+	{
+		.name = "no-in-order",
+		.val = 'o',
+	},
+	{
+		.name = "batch",
+		.val = 'b',
+		.has_arg = required_argument,
+	},
 	{
 	}
 };
@@ -222,6 +241,8 @@ static void help()
 	fprintf(stderr, "Usage: virtio_test [--help]"
 		" [--no-indirect]"
 		" [--no-event-idx]"
+		" [--no-in-order]"
+		" [--batch=N]"
 		"\n");
 }
 
@@ -229,7 +250,9 @@ int main(int argc, char **argv)
 {
 	struct vdev_info dev;
 	unsigned long long features = (1ULL << VIRTIO_RING_F_INDIRECT_DESC) |
-		(1ULL << VIRTIO_RING_F_EVENT_IDX);
+		(1ULL << VIRTIO_RING_F_EVENT_IDX) |
+		(1ULL << VIRTIO_RING_F_IN_ORDER);
+	int batch = 1;
 	int o;
 
 	for (;;) {
@@ -249,6 +272,13 @@ int main(int argc, char **argv)
 		case 'i':
 			features &= ~(1ULL << VIRTIO_RING_F_INDIRECT_DESC);
 			break;
+		case 'o':
+			features &= ~(1ULL << VIRTIO_RING_F_IN_ORDER);
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			assert(batch > 0);
+			break;
 		default:
 			assert(0);
 			break;
@@ -258,6 +288,6 @@ int main(int argc, char **argv)
 done:
 	vdev_info_init(&dev, features);
 	vq_info_add(&dev, 256);
-	run_test(&dev, &dev.vqs[0], 0x100000);
+	run_test(&dev, &dev.vqs[0], 0x100000, batch);
 	return 0;
 }